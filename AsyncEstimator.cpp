@@ -0,0 +1,409 @@
+#include "AsyncEstimator.h"
+#include "DepthIO.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#else
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+AsyncEstimator::AsyncEstimator( CRForestEstimator* estimator,
+								const EstimationParams& params,
+								unsigned int threads,
+								unsigned int queue_size ){
+
+	m_estimator = estimator;
+	m_params = params;
+	m_threads = MAX( 1, threads );
+	m_queue_size = MAX( 1, queue_size );
+
+	m_callback = 0;
+	m_user = 0;
+	m_stop = 1;
+
+	m_next_frame = 0;
+	m_pushed = m_processed = m_dropped_queued = m_dropped_stale = 0;
+	m_last_delivered = -1;
+	m_have_latest = false;
+
+	//one frame per worker, the queued ones and one being copied in by push()
+	for(unsigned int i=0;i<m_threads+m_queue_size+1;++i){
+		m_jobs.push_back( new Job() );
+		m_free.push_back( m_jobs.back() );
+	}
+
+	pthread_mutex_init( &m_mutex, NULL );
+	pthread_cond_init( &m_job_cond, NULL );
+	pthread_mutex_init( &m_result_mutex, NULL );
+	pthread_cond_init( &m_result_cond, NULL );
+	pthread_mutex_init( &m_callback_mutex, NULL );
+
+}
+
+AsyncEstimator::~AsyncEstimator(){
+
+	stop();
+
+	for(unsigned int i=0;i<m_jobs.size();++i)
+		delete m_jobs[i];
+
+	pthread_mutex_destroy( &m_callback_mutex );
+	pthread_cond_destroy( &m_result_cond );
+	pthread_mutex_destroy( &m_result_mutex );
+	pthread_cond_destroy( &m_job_cond );
+	pthread_mutex_destroy( &m_mutex );
+
+}
+
+bool AsyncEstimator::start(){
+
+	if( !m_workers.empty() )
+		return true;
+
+	atomic_store( &m_stop, 0 );
+
+	for(unsigned int t=0;t<m_threads;++t){
+
+		pthread_t thread;
+		if( pthread_create( &thread, NULL, worker_thread, this ) != 0 ){
+			printf("pthread_create failed\n");
+			stop();
+			return false;
+		}
+		m_workers.push_back( thread );
+
+	}
+
+	return true;
+
+}
+
+void AsyncEstimator::stop(){
+
+	pthread_mutex_lock( &m_mutex );
+	atomic_store( &m_stop, 1 );
+	pthread_cond_broadcast( &m_job_cond );
+	pthread_mutex_unlock( &m_mutex );
+
+	for(unsigned int t=0;t<m_workers.size();++t)
+		pthread_join( m_workers[t], NULL );
+	m_workers.clear();
+
+	//frames still queued will never be processed
+	pthread_mutex_lock( &m_mutex );
+	while( !m_pending.empty() ){
+		m_free.push_back( m_pending.front() );
+		m_pending.pop_front();
+		atomic_fetch_add( &m_dropped_queued, 1 );
+	}
+	pthread_mutex_unlock( &m_mutex );
+
+	pthread_mutex_lock( &m_result_mutex );
+	pthread_cond_broadcast( &m_result_cond );
+	pthread_mutex_unlock( &m_result_mutex );
+
+}
+
+void AsyncEstimator::set_callback( async_result_fn fn, void* user ){
+
+	pthread_mutex_lock( &m_result_mutex );
+	m_callback = fn;
+	m_user = user;
+	pthread_mutex_unlock( &m_result_mutex );
+
+}
+
+void AsyncEstimator::set_params( const EstimationParams& params ){
+
+	pthread_mutex_lock( &m_mutex );
+	m_params = params;
+	pthread_mutex_unlock( &m_mutex );
+
+}
+
+EstimationParams AsyncEstimator::params(){
+
+	pthread_mutex_lock( &m_mutex );
+	EstimationParams p = m_params;
+	pthread_mutex_unlock( &m_mutex );
+	return p;
+
+}
+
+long AsyncEstimator::push( const Mat& im3D, double timestamp ){
+
+	Job* job = take_job( timestamp, getTickCount() );
+	if( !job )
+		return -1;
+
+	//copy outside the lock, the buffers are reused so this does not allocate
+	job->from_depth = false;
+	im3D.copyTo( job->im3D );
+
+	return queue_job( job );
+
+}
+
+long AsyncEstimator::push_depth( const Mat& depth, const float* depth_intrinsic, int max_z, double timestamp ){
+
+	Job* job = take_job( timestamp, getTickCount() );
+	if( !job )
+		return -1;
+
+	job->from_depth = true;
+	depth.copyTo( job->depth );
+	memcpy( job->depth_intrinsic, depth_intrinsic, sizeof(job->depth_intrinsic) );
+	job->max_z = max_z;
+
+	return queue_job( job );
+
+}
+
+//a buffer for the next frame, 0 if there is none
+AsyncEstimator::Job* AsyncEstimator::take_job( double timestamp, int64 push_tick ){
+
+	pthread_mutex_lock( &m_mutex );
+
+	if( atomic_load( &m_stop ) ){
+		pthread_mutex_unlock( &m_mutex );
+		return 0;
+	}
+
+	atomic_fetch_add( &m_pushed, 1 );
+
+	Job* job = 0;
+	if( !m_free.empty() ){
+
+		job = m_free.back();
+		m_free.pop_back();
+
+	}
+	else if( !m_pending.empty() ){
+
+		//reuse the oldest queued frame
+		job = m_pending.front();
+		m_pending.pop_front();
+		atomic_fetch_add( &m_dropped_queued, 1 );
+
+	}
+	else{
+
+		//only happens with several threads pushing at the same time
+		atomic_fetch_add( &m_dropped_queued, 1 );
+		pthread_mutex_unlock( &m_mutex );
+		return 0;
+
+	}
+
+	job->frame = m_next_frame++;
+	job->timestamp = timestamp;
+	job->push_tick = push_tick;
+	job->params = m_params;
+
+	pthread_mutex_unlock( &m_mutex );
+	return job;
+
+}
+
+long AsyncEstimator::queue_job( Job* job ){
+
+	long frame = job->frame;
+
+	pthread_mutex_lock( &m_mutex );
+
+	//keep the queue sorted by frame number in case several threads push
+	std::deque< Job* >::iterator it = m_pending.end();
+	while( it != m_pending.begin() && (*(it-1))->frame > job->frame )
+		--it;
+	m_pending.insert( it, job );
+
+	//latest frame wins
+	while( m_pending.size() > m_queue_size ){
+
+		m_free.push_back( m_pending.front() );
+		m_pending.pop_front();
+		atomic_fetch_add( &m_dropped_queued, 1 );
+
+	}
+
+	pthread_cond_signal( &m_job_cond );
+	pthread_mutex_unlock( &m_mutex );
+
+	//the job may already be taken by a worker
+	return frame;
+
+}
+
+void* AsyncEstimator::worker_thread( void* arg ){
+
+	((AsyncEstimator*)arg)->worker();
+	return NULL;
+
+}
+
+void AsyncEstimator::worker(){
+
+	//kept across frames so their memory is reused
+	EstimationWorkspace workspace;
+	std::vector< HeadPose > heads;
+	AsyncResult result;
+
+	while(true){
+
+		pthread_mutex_lock( &m_mutex );
+		while( m_pending.empty() && !atomic_load( &m_stop ) )
+			pthread_cond_wait( &m_job_cond, &m_mutex );
+
+		if( atomic_load( &m_stop ) ){
+			pthread_mutex_unlock( &m_mutex );
+			break;
+		}
+
+		Job* job = m_pending.front();
+		m_pending.pop_front();
+		pthread_mutex_unlock( &m_mutex );
+
+		int64 t0 = getTickCount();
+
+		result.means.clear();
+		result.cluster_sizes.clear();
+
+		if( job->from_depth )
+			depthTo3D( job->depth, job->im3D, job->depth_intrinsic, job->max_z );
+
+		m_estimator->estimate_poses( job->im3D, heads, job->params, &workspace );
+
+		for(unsigned int h=0;h<heads.size();++h){
+			result.means.push_back( heads[h].pose );
+			result.cluster_sizes.push_back( heads[h].votes );
+		}
+
+		int64 t1 = getTickCount();
+
+		result.frame = job->frame;
+		result.timestamp = job->timestamp;
+		result.params = job->params;
+		result.estimate_ms = 1000.0*(t1-t0)/getTickFrequency();
+		result.latency_ms = 1000.0*(t1-job->push_tick)/getTickFrequency();
+
+		pthread_mutex_lock( &m_mutex );
+		m_free.push_back( job );
+		pthread_mutex_unlock( &m_mutex );
+
+		atomic_fetch_add( &m_processed, 1 );
+		deliver( result );
+
+	}
+
+}
+
+void AsyncEstimator::deliver( AsyncResult& result ){
+
+	//one delivery at a time, so the callbacks see increasing frame numbers
+	pthread_mutex_lock( &m_callback_mutex );
+	pthread_mutex_lock( &m_result_mutex );
+
+	//another worker already delivered a newer frame
+	if( result.frame <= m_last_delivered ){
+
+		atomic_fetch_add( &m_dropped_stale, 1 );
+		pthread_mutex_unlock( &m_result_mutex );
+		pthread_mutex_unlock( &m_callback_mutex );
+		return;
+
+	}
+
+	m_last_delivered = result.frame;
+	m_latest = result;
+	m_have_latest = true;
+
+	async_result_fn callback = m_callback;
+	void* user = m_user;
+
+	pthread_cond_broadcast( &m_result_cond );
+	pthread_mutex_unlock( &m_result_mutex );
+
+	//without m_result_mutex, latest() and wait() do not wait for the callback
+	if( callback )
+		callback( result, user );
+
+	pthread_mutex_unlock( &m_callback_mutex );
+
+}
+
+bool AsyncEstimator::latest( AsyncResult& result, long last_frame ){
+
+	pthread_mutex_lock( &m_result_mutex );
+
+	bool found = m_have_latest && m_latest.frame > last_frame;
+	if( found )
+		result = m_latest;
+
+	pthread_mutex_unlock( &m_result_mutex );
+	return found;
+
+}
+
+//microseconds since 1970, the clock pthread_cond_timedwait() measures its timeout on
+static long long wall_clock_us(){
+
+#ifndef _WIN32
+	timeval now;
+	gettimeofday( &now, NULL );
+	return (long long)now.tv_sec*1000000 + now.tv_usec;
+#else
+	//100 ns intervals since 1601
+	FILETIME now;
+	GetSystemTimeAsFileTime( &now );
+	long long t = ( (long long)now.dwHighDateTime << 32 ) | now.dwLowDateTime;
+	return t/10 - 11644473600000000LL;
+#endif
+
+}
+
+bool AsyncEstimator::wait( long frame, AsyncResult& result, int timeout_ms ){
+
+	timespec until;
+	if( timeout_ms >= 0 ){
+
+		long long us = wall_clock_us() + (long long)timeout_ms*1000;
+		until.tv_sec = (time_t)( us/1000000 );
+		until.tv_nsec = (long)( us%1000000 )*1000;
+
+	}
+
+	pthread_mutex_lock( &m_result_mutex );
+
+	//a dropped frame counts as done as soon as a newer one is delivered
+	while( m_last_delivered < frame && !atomic_load( &m_stop ) ){
+
+		if( timeout_ms < 0 )
+			pthread_cond_wait( &m_result_cond, &m_result_mutex );
+		else if( pthread_cond_timedwait( &m_result_cond, &m_result_mutex, &until ) != 0 )
+			break;
+
+	}
+
+	bool found = m_have_latest && m_latest.frame == frame;
+	if( found )
+		result = m_latest;
+
+	pthread_mutex_unlock( &m_result_mutex );
+	return found;
+
+}
+
+long AsyncEstimator::pushed(){ return atomic_load( &m_pushed ); }
+long AsyncEstimator::processed(){ return atomic_load( &m_processed ); }
+long AsyncEstimator::dropped_queued(){ return atomic_load( &m_dropped_queued ); }
+long AsyncEstimator::dropped_stale(){ return atomic_load( &m_dropped_stale ); }
+long AsyncEstimator::dropped(){ return dropped_queued() + dropped_stale(); }
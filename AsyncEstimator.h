@@ -0,0 +1,130 @@
+#pragma once
+
+#ifndef AsyncEstimator_H
+#define AsyncEstimator_H
+
+#include <vector>
+#include <deque>
+#include <pthread.h>
+#include "CRForestEstimator.h"
+#include "Atomic.h"
+
+struct AsyncResult {
+
+	long frame; //number returned by push()
+	double timestamp; //source timestamp given to push()
+
+	std::vector< cv::Vec<float,POSE_SIZE> > means;
+	std::vector< unsigned int > cluster_sizes; //votes per head
+
+	double estimate_ms; //time spent in estimate()
+	double latency_ms; //from push() until the result was ready
+
+	EstimationParams params; //the frame was estimated with
+
+};
+
+//called on a worker thread, never concurrently and always with increasing frame numbers.
+//latest(), wait() and set_callback() can be used from it, stop() cannot
+typedef void (*async_result_fn)( const AsyncResult& result, void* user );
+
+// Non-blocking front end for CRForestEstimator: push() hands a frame over and returns
+// immediately, worker threads run the estimation. If frames arrive faster than they can be
+// processed, the oldest queued frames are dropped, so latency never builds up.
+class AsyncEstimator {
+
+public:
+
+	//queue_size = frames waiting for a worker, 1 means only the latest frame is kept
+	AsyncEstimator( CRForestEstimator* estimator,
+					const EstimationParams& params,
+					unsigned int threads = 1,
+					unsigned int queue_size = 1 );
+	~AsyncEstimator();
+
+	bool start();
+	void stop();
+
+	void set_callback( async_result_fn fn, void* user = 0 );
+
+	//used for all frames pushed afterwards
+	void set_params( const EstimationParams& params );
+	EstimationParams params();
+
+	//copies the 3D image and returns its frame number, or -1 if it had to be dropped right away
+	long push( const cv::Mat& im3D, double timestamp );
+
+	//same for a CV_16SC1 depth image in mm, the worker back-projects it with depthTo3D().
+	//Copies a sixth of the data push() does and leaves the conversion to the worker
+	long push_depth( const cv::Mat& depth, const float* depth_intrinsic, int max_z, double timestamp );
+
+	//most recent result, returns false if there is none newer than last_frame
+	bool latest( AsyncResult& result, long last_frame = -1 );
+
+	//waits until frame is done or has been dropped, returns true if its result is in result
+	bool wait( long frame, AsyncResult& result, int timeout_ms = -1 );
+
+	long pushed();
+	long processed();
+	long dropped(); //overwritten while queued + finished after a newer frame
+	long dropped_queued();
+	long dropped_stale();
+
+private:
+
+	struct Job {
+
+		long frame;
+		double timestamp;
+		int64 push_tick;
+		EstimationParams params;
+		cv::Mat im3D;
+
+		bool from_depth; //im3D is made from depth by the worker
+		cv::Mat depth;
+		float depth_intrinsic[9];
+		int max_z;
+
+	};
+
+	Job* take_job( double timestamp, int64 push_tick );
+	long queue_job( Job* job );
+
+	static void* worker_thread( void* arg );
+	void worker();
+	void deliver( AsyncResult& result );
+
+	CRForestEstimator* m_estimator;
+	EstimationParams m_params;
+	unsigned int m_threads;
+	unsigned int m_queue_size;
+
+	async_result_fn m_callback;
+	void* m_user;
+
+	std::vector< Job* > m_jobs;
+	std::vector< Job* > m_free;
+	std::deque< Job* > m_pending;
+
+	std::vector< pthread_t > m_workers;
+	volatile long m_stop;
+
+	long m_next_frame;
+	volatile long m_pushed, m_processed, m_dropped_queued, m_dropped_stale;
+
+	long m_last_delivered;
+	AsyncResult m_latest;
+	bool m_have_latest;
+
+	pthread_mutex_t m_mutex; //queue, counters, params
+	pthread_cond_t m_job_cond;
+	pthread_mutex_t m_result_mutex; //m_latest, m_last_delivered, m_callback
+	pthread_mutex_t m_callback_mutex; //held by the worker delivering, keeps the callbacks in order
+	pthread_cond_t m_result_cond;
+
+	AsyncEstimator( const AsyncEstimator& );
+	AsyncEstimator& operator=( const AsyncEstimator& );
+
+};
+
+#endif
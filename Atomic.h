@@ -0,0 +1,39 @@
+#pragma once
+
+#ifndef Atomic_H
+#define Atomic_H
+
+// Minimal set of atomic operations used by the lock-free queues and the
+// counters shared between threads (GCC/Clang builtins, Interlocked on MSVC)
+
+#ifdef _MSC_VER
+#include <windows.h>
+#include <intrin.h>
+#endif
+
+#ifdef _MSC_VER
+
+inline long atomic_load( const volatile long* p ){ long v = *p; _ReadWriteBarrier(); return v; }
+inline void atomic_store( volatile long* p, long v ){ InterlockedExchange( p, v ); }
+inline long atomic_fetch_add( volatile long* p, long v ){ return InterlockedExchangeAdd( p, v ); }
+inline long atomic_exchange( volatile long* p, long v ){ return InterlockedExchange( p, v ); }
+inline bool atomic_compare_exchange( volatile long* p, long expected, long desired ){
+	return InterlockedCompareExchange( p, desired, expected ) == expected;
+}
+inline void atomic_fence(){ MemoryBarrier(); }
+
+#else
+
+//loads acquire, stores release; exchange/fetch_add/compare_exchange and atomic_fence are full barriers
+inline long atomic_load( const volatile long* p ){ return __atomic_load_n( p, __ATOMIC_ACQUIRE ); }
+inline void atomic_store( volatile long* p, long v ){ __atomic_store_n( p, v, __ATOMIC_RELEASE ); }
+inline long atomic_fetch_add( volatile long* p, long v ){ return __atomic_fetch_add( p, v, __ATOMIC_SEQ_CST ); }
+inline long atomic_exchange( volatile long* p, long v ){ return __atomic_exchange_n( p, v, __ATOMIC_SEQ_CST ); }
+inline bool atomic_compare_exchange( volatile long* p, long expected, long desired ){
+	return __atomic_compare_exchange_n( p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+inline void atomic_fence(){ __atomic_thread_fence( __ATOMIC_SEQ_CST ); }
+
+#endif
+
+#endif
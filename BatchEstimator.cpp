@@ -0,0 +1,292 @@
+#include "BatchEstimator.h"
+#include "DepthIO.h"
+
+#include <stdio.h>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+using namespace std;
+using namespace cv;
+
+bool loadEstimatorConfig( const char* filename,
+						  std::string& treepath,
+						  int& ntrees,
+						  int& max_z,
+						  EstimationParams& params ){
+
+	ifstream in(filename);
+	string dummy;
+
+	if(!in.is_open()) {
+		cerr << "File not found " << filename << endl;
+		return false;
+	}
+
+	// Path to trees
+	in >> dummy;
+	in >> treepath;
+
+	// Number of trees
+	in >> dummy;
+	in >> ntrees;
+
+	in >> dummy;
+	in >> params.max_variance;
+
+	in >> dummy;
+	in >> params.larger_radius_ratio;
+
+	in >> dummy;
+	in >> params.smaller_radius_ratio;
+
+	in >> dummy;
+	in >> params.stride;
+
+	in >> dummy;
+	in >> max_z;
+
+	in >> dummy;
+	in >> params.threshold;
+
+	return !in.fail();
+
+}
+
+BatchEstimator::BatchEstimator( CRForestEstimator* estimator, const EstimationParams& params, int max_z ){
+
+	m_estimator = estimator;
+	m_params = params;
+	m_max_z = max_z;
+	m_files = 0;
+	m_next_index = 0;
+	m_next_output = 0;
+
+}
+
+unsigned int BatchEstimator::default_threads(){
+
+	long n = sysconf( _SC_NPROCESSORS_ONLN );
+	return n > 0 ? (unsigned int)n : 1;
+
+}
+
+bool BatchEstimator::get_calibration( const std::string& filename, float* intrinsics ){
+
+	std::string cal = depthCalibrationFile( filename );
+
+	unsigned int i = 0;
+	for( ; i<m_cal_dirs.size(); ++i )
+		if( m_cal_dirs[i] == cal )
+			break;
+
+	if( i == m_cal_dirs.size() ){
+
+		std::vector<float> K(9, 0.f);
+		m_cal_ok.push_back( loadDepthCalibration( cal, &K[0] ) );
+		m_cal.push_back( K );
+		m_cal_dirs.push_back( cal );
+
+		if( !m_cal_ok.back() )
+			cerr << "could not read " << cal << endl;
+
+	}
+
+	for(int k=0;k<9;++k)
+		intrinsics[k] = m_cal[i][k];
+	return m_cal_ok[i];
+
+}
+
+void BatchEstimator::process( const std::string& filename, BatchResult& result, EstimationWorkspace* workspace ){
+
+	result.filename = filename;
+	result.means.clear();
+	result.cluster_sizes.clear();
+	result.decode_ms = 0;
+	result.estimate_ms = 0;
+
+	int64 t0 = getTickCount();
+
+	float intrinsics[9];
+	Mat img3D;
+
+	//decoded straight into the estimator's input
+	result.ok = get_calibration( filename, intrinsics ) &&
+				loadDepthTo3D( filename.c_str(), img3D, intrinsics, m_max_z ) >= 0;
+
+	if( !result.ok )
+		return;
+
+	int64 t1 = getTickCount();
+
+	std::vector< HeadPose > heads;
+	m_estimator->estimate_poses( img3D, heads, m_params, workspace );
+
+	for(unsigned int h=0;h<heads.size();++h){
+		result.means.push_back( heads[h].pose );
+		result.cluster_sizes.push_back( heads[h].votes );
+	}
+
+	int64 t2 = getTickCount();
+
+	result.decode_ms = 1000.0*(t1-t0)/getTickFrequency();
+	result.estimate_ms = 1000.0*(t2-t1)/getTickFrequency();
+
+}
+
+void* BatchEstimator::worker_thread( void* arg ){
+
+	((BatchEstimator*)arg)->worker();
+	return NULL;
+
+}
+
+void BatchEstimator::worker(){
+
+	unsigned int window = m_slots.size();
+	BatchResult result;
+	EstimationWorkspace workspace;
+
+	while(true){
+
+		pthread_mutex_lock( &m_mutex );
+
+		//do not run too far ahead of the output, results are handed out in order
+		while( m_next_index < m_files->size() && m_next_index >= m_next_output + window )
+			pthread_cond_wait( &m_space_cond, &m_mutex );
+
+		if( m_next_index >= m_files->size() ){
+			pthread_mutex_unlock( &m_mutex );
+			break;
+		}
+
+		unsigned int index = m_next_index++;
+		pthread_mutex_unlock( &m_mutex );
+
+		process( (*m_files)[index], result, &workspace );
+		result.index = index;
+
+		pthread_mutex_lock( &m_mutex );
+		std::swap( m_slots[ index % window ], result );
+		m_ready[ index % window ] = 1;
+		pthread_cond_broadcast( &m_result_cond );
+		pthread_mutex_unlock( &m_mutex );
+
+	}
+
+}
+
+BatchStats BatchEstimator::run( const std::vector< std::string >& files,
+								unsigned int threads,
+								batch_result_fn fn,
+								void* user,
+								bool report_progress ){
+
+	BatchStats stats;
+	stats.frames = 0;
+	stats.failed = 0;
+	stats.heads = 0;
+	stats.seconds = 0;
+	stats.decode_ms = 0;
+	stats.estimate_ms = 0;
+
+	if( threads == 0 )
+		threads = default_threads();
+
+	//read all calibration files up front, the workers then only look them up
+	float K[9];
+	for(unsigned int i=0;i<files.size();++i)
+		get_calibration( files[i], K );
+
+	unsigned int window = 4*threads;
+
+	m_files = &files;
+	m_slots.assign( window, BatchResult() );
+	m_ready.assign( window, 0 );
+	m_next_index = 0;
+	m_next_output = 0;
+
+	pthread_mutex_init( &m_mutex, NULL );
+	pthread_cond_init( &m_result_cond, NULL );
+	pthread_cond_init( &m_space_cond, NULL );
+
+	int64 start = getTickCount();
+	int64 last_report = start;
+
+	std::vector< pthread_t > workers;
+	for(unsigned int t=0;t<threads;++t){
+
+		pthread_t thread;
+		if( pthread_create( &thread, NULL, worker_thread, this ) == 0 )
+			workers.push_back( thread );
+
+	}
+
+	if( workers.empty() ){
+
+		//no threads available, do it serially
+		cerr << "pthread_create failed, running on one thread" << endl;
+		m_next_index = files.size();
+
+	}
+
+	BatchResult result;
+
+	for(unsigned int i=0;i<files.size();++i){
+
+		if( workers.empty() ){
+
+			process( files[i], result );
+			result.index = i;
+
+		}
+		else{
+
+			pthread_mutex_lock( &m_mutex );
+			while( !m_ready[ i % window ] )
+				pthread_cond_wait( &m_result_cond, &m_mutex );
+
+			std::swap( result, m_slots[ i % window ] );
+			m_ready[ i % window ] = 0;
+			m_next_output = i+1;
+			pthread_cond_broadcast( &m_space_cond );
+			pthread_mutex_unlock( &m_mutex );
+
+		}
+
+		stats.frames++;
+		if( !result.ok )
+			stats.failed++;
+		stats.heads += result.means.size();
+		stats.decode_ms += result.decode_ms;
+		stats.estimate_ms += result.estimate_ms;
+
+		if( fn )
+			fn( result, user );
+
+		int64 now = getTickCount();
+		if( report_progress && (now-last_report) > 2*getTickFrequency() ){
+
+			double sec = (now-start)/getTickFrequency();
+			fprintf( stderr, "%u/%u frames, %.1f frames/s\n", stats.frames, (unsigned int)files.size(), stats.frames/sec );
+			last_report = now;
+
+		}
+
+	}
+
+	for(unsigned int t=0;t<workers.size();++t)
+		pthread_join( workers[t], NULL );
+
+	pthread_cond_destroy( &m_space_cond );
+	pthread_cond_destroy( &m_result_cond );
+	pthread_mutex_destroy( &m_mutex );
+
+	m_files = 0;
+	m_slots.clear();
+
+	stats.seconds = (getTickCount()-start)/getTickFrequency();
+	return stats;
+
+}
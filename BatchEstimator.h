@@ -0,0 +1,98 @@
+#pragma once
+
+#ifndef BatchEstimator_H
+#define BatchEstimator_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "CRForestEstimator.h"
+
+// reads the config.txt format used by the demos (tree path, no. of trees, max variance,
+// larger/smaller radius ratio, stride, max z, head threshold)
+bool loadEstimatorConfig( const char* filename,
+						  std::string& treepath,
+						  int& ntrees,
+						  int& max_z,
+						  EstimationParams& params );
+
+struct BatchResult {
+
+	unsigned int index; //position in the input list
+	std::string filename;
+	bool ok; //false if the frame or its calibration could not be read
+
+	std::vector< cv::Vec<float,POSE_SIZE> > means;
+	std::vector< unsigned int > cluster_sizes; //votes per head
+
+	double decode_ms; //reading + back-projection
+	double estimate_ms;
+
+};
+
+struct BatchStats {
+
+	unsigned int frames;
+	unsigned int failed;
+	unsigned int heads;
+	double seconds; //wall clock
+	double decode_ms; //summed over all frames
+	double estimate_ms;
+
+	double fps() const { return seconds > 0 ? frames/seconds : 0; }
+
+};
+
+//called for each frame, in input order, from the thread that called run()
+typedef void (*batch_result_fn)( const BatchResult& result, void* user );
+
+// Runs a loaded forest over a list of depth files. Decoding and estimation are
+// spread over several threads sharing the forest, results are handed back in input order.
+class BatchEstimator {
+
+public:
+
+	BatchEstimator( CRForestEstimator* estimator, const EstimationParams& params, int max_z );
+
+	//threads = 0 uses one thread per core
+	BatchStats run( const std::vector< std::string >& files,
+					unsigned int threads,
+					batch_result_fn fn,
+					void* user = 0,
+					bool report_progress = true );
+
+	//decodes and estimates a single frame on the calling thread
+	void process( const std::string& filename, BatchResult& result, EstimationWorkspace* workspace = 0 );
+
+	static unsigned int default_threads();
+
+private:
+
+	bool get_calibration( const std::string& filename, float* intrinsics );
+
+	static void* worker_thread( void* arg );
+	void worker();
+
+	CRForestEstimator* m_estimator;
+	EstimationParams m_params;
+	int m_max_z;
+
+	//calibration per folder, read once
+	std::vector< std::string > m_cal_dirs;
+	std::vector< std::vector<float> > m_cal;
+	std::vector< bool > m_cal_ok;
+
+	//state shared by the workers of run()
+	const std::vector< std::string >* m_files;
+	std::vector< BatchResult > m_slots;
+	std::vector< char > m_ready;
+	unsigned int m_next_index;
+	unsigned int m_next_output;
+
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_result_cond;
+	pthread_cond_t m_space_cond;
+
+};
+
+#endif
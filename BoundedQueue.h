@@ -0,0 +1,186 @@
+#pragma once
+
+#ifndef BoundedQueue_H
+#define BoundedQueue_H
+
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>
+#include "Atomic.h"
+
+// Bounded single-producer/single-consumer queue. push() and pop() are lock-free;
+// the *_wait() variants only fall back to a mutex/condition when they have to sleep.
+template< class T >
+class BoundedQueue {
+
+public:
+
+	BoundedQueue( unsigned int capacity = 1 ){
+
+		m_head = 0;
+		m_tail = 0;
+		m_waiters = 0;
+		m_items.resize( capacity + 1 );
+		pthread_mutex_init( &m_mutex, NULL );
+		pthread_cond_init( &m_cond, NULL );
+
+	}
+
+	~BoundedQueue(){
+
+		pthread_cond_destroy( &m_cond );
+		pthread_mutex_destroy( &m_mutex );
+
+	}
+
+	//not thread safe, only call while no thread is using the queue
+	void reset( unsigned int capacity ){
+
+		m_head = 0;
+		m_tail = 0;
+		m_items.assign( capacity + 1, T() );
+
+	}
+
+	unsigned int capacity() const { return (unsigned int)m_items.size() - 1; }
+
+	unsigned int size() const {
+
+		long n = atomic_load( &m_tail ) - atomic_load( &m_head );
+		return (unsigned int)( n < 0 ? n + (long)m_items.size() : n );
+
+	}
+
+	bool empty() const { return atomic_load( &m_head ) == atomic_load( &m_tail ); }
+
+	//producer side, returns false if the queue is full
+	bool push( const T& item ){
+
+		long tail = m_tail;
+		long next = next_index( tail );
+
+		if( next == atomic_load( &m_head ) )
+			return false;
+
+		m_items[tail] = item;
+		atomic_store( &m_tail, next );
+
+		notify();
+		return true;
+
+	}
+
+	//consumer side, returns false if the queue is empty
+	bool pop( T& item ){
+
+		long head = m_head;
+
+		if( head == atomic_load( &m_tail ) )
+			return false;
+
+		item = m_items[head];
+		m_items[head] = T();
+		atomic_store( &m_head, next_index( head ) );
+
+		notify();
+		return true;
+
+	}
+
+	//blocking variants, return false once *stop becomes non-zero
+	bool push_wait( const T& item, const volatile long* stop ){
+
+		while( !push( item ) ){
+
+			if( stop && atomic_load( stop ) )
+				return false;
+			sleep_until_changed( stop, false );
+
+		}
+		return true;
+
+	}
+
+	bool pop_wait( T& item, const volatile long* stop ){
+
+		while( !pop( item ) ){
+
+			if( stop && atomic_load( stop ) )
+				return false;
+			sleep_until_changed( stop, true );
+
+		}
+		return true;
+
+	}
+
+	//wake up all threads blocked in *_wait(), e.g. after setting the stop flag
+	void wake(){
+
+		pthread_mutex_lock( &m_mutex );
+		pthread_cond_broadcast( &m_cond );
+		pthread_mutex_unlock( &m_mutex );
+
+	}
+
+private:
+
+	long next_index( long i ) const { return ( i + 1 == (long)m_items.size() ) ? 0 : i + 1; }
+
+	void notify(){
+
+		//pairs with the increment of m_waiters in sleep_until_changed
+		atomic_fence();
+		if( atomic_load( &m_waiters ) )
+			wake();
+
+	}
+
+	void sleep_until_changed( const volatile long* stop, bool wait_for_item ){
+
+		//spin a little before going to sleep, stages are usually only slightly out of step
+		for(int i=0;i<64;++i){
+			if( wait_for_item ? !empty() : ( next_index( m_tail ) != atomic_load( &m_head ) ) )
+				return;
+		}
+
+		pthread_mutex_lock( &m_mutex );
+		atomic_fetch_add( &m_waiters, 1 );
+
+		bool ready = wait_for_item ? !empty() : ( next_index( m_tail ) != atomic_load( &m_head ) );
+		if( !ready && !( stop && atomic_load( stop ) ) ){
+
+			//the timeout is only a safety net, notify() wakes us up
+			timeval now;
+			gettimeofday( &now, NULL );
+			timespec until;
+			until.tv_sec = now.tv_sec;
+			until.tv_nsec = now.tv_usec * 1000 + 10000000;
+			if( until.tv_nsec >= 1000000000 ){
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait( &m_cond, &m_mutex, &until );
+
+		}
+
+		atomic_fetch_add( &m_waiters, -1 );
+		pthread_mutex_unlock( &m_mutex );
+
+	}
+
+	std::vector< T > m_items;
+
+	volatile long m_head; //next slot to pop, only written by the consumer
+	volatile long m_tail; //next slot to push, only written by the producer
+	volatile long m_waiters;
+
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond;
+
+	BoundedQueue( const BoundedQueue& );
+	BoundedQueue& operator=( const BoundedQueue& );
+
+};
+
+#endif
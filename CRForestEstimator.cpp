@@ -1,7 +1,9 @@
 
 
 #include "CRForestEstimator.h"
+#include "Atomic.h"
 #include <vector>
+#include <algorithm>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -53,6 +55,19 @@ CRForestEstimator::~CRForestEstimator() {
 		if (crForest[i])
 			delete crForest[i];
 
+	delete m_pool;
+
+}
+
+void CRForestEstimator::set_num_threads( unsigned int threads ){
+
+	delete m_pool;
+	m_pool = 0;
+
+	//the calling thread works too
+	if( threads > 1 )
+		m_pool = new ThreadPool( threads-1 );
+
 }
 
 
@@ -83,7 +98,8 @@ bool CRForestEstimator::load_forest( const std::string& path,
 
 
 
-void CRForestEstimator::do_regression( const Mat & im3D, int stride, float max_variance, float prob_th, std::vector< Vote >& votes ){
+template< class Sink >
+void CRForestEstimator::regress_patches( const Mat & im3D, int stride, float max_variance, float prob_th, int trees, Sink& sink ){
 
 	int p_width = int(crForest[0]->m_p_w);
 	int p_height = int(crForest[0]->m_p_h);
@@ -125,6 +141,8 @@ void CRForestEstimator::do_regression( const Mat & im3D, int stride, float max_v
 	int half_w = roi.width/2;
 	int half_h = roi.height/2;
 
+	std::vector< const leaf_data* > leaves( trees_used( trees ) );
+
 	//process each patch
 	for(roi.y=bbox.y; roi.y<bbox.y+bbox.height-p_height; roi.y+=stride) {
 
@@ -146,11 +164,13 @@ void CRForestEstimator::do_regression( const Mat & im3D, int stride, float max_v
 			   continue;
 
 			//send the patch down the trees and retrieve leaves
-			std::vector< const leaf_data* > leaves( crForest.size() );
-
-			for(unsigned int t=0;t<crForest.size();++t)
+			for(unsigned int t=0;t<leaves.size();++t)
 				leaves[t] = crForest[t]->regressionIntegral( featureChans, maskIntegral, roi );
 
+			float cx = rowX[roi.x + half_w];
+			float cy = rowY[roi.x + half_w];
+			float cz = rowZ[roi.x + half_w];
+
 			if(!m_avg_votes){
 				//go through the results
 				for(unsigned int t=0;t<leaves.size();++t){
@@ -158,170 +178,412 @@ void CRForestEstimator::do_regression( const Mat & im3D, int stride, float max_v
 					if ( leaves[t]->trace > max_variance || leaves[t]->p < prob_th )
 						continue;
 
-					Vote v;
+					sink( leaves[t], cx, cy, cz );
+				}
+			}
+			else{
+
+				float pp = 0.f;
 
-					//add the 3D location under the patch center to the vote for the head center
-					v.vote[0] = leaves[t]->mean.at<float>(0) + rowX[roi.x + half_w];
-					v.vote[1] = leaves[t]->mean.at<float>(1) + rowY[roi.x + half_w];
-					v.vote[2] = leaves[t]->mean.at<float>(2) + rowZ[roi.x + half_w];
+				//go through the results
+				for(unsigned int t=0;t<leaves.size();++t)
+					pp+=leaves[t]->p;
 
-					//angles, leave as in the leaf
-					v.vote[3] = leaves[t]->mean.at<float>(3);
-					v.vote[4] = leaves[t]->mean.at<float>(4);
-					v.vote[5] = leaves[t]->mean.at<float>(5);
+				pp /= float(leaves.size());
 
-					v.trace = &(leaves[t]->trace);
-					v.conf = &(leaves[t]->p);
+				if( pp >= .9f ){
+
+					for(unsigned int t=0;t<leaves.size();++t)
+						if ( leaves[t]->trace < max_variance && leaves[t]->p >= prob_th )
+							sink( leaves[t], cx, cy, cz );
 
-					votes.push_back(v);
 				}
+
 			}
-			else{
+		} // end for x
 
-				int v_count = 0;
-				float pp = 0.f;
-				float var = 0;
+	} // end for y
 
-				vector< Vote > temp_votes;
+	delete [] channels;
 
-				//go through the results
-				for(unsigned int t=0;t<leaves.size();++t){
+}
 
-					//if ( leaves[t]->trace > max_variance || leaves[t]->p < prob_th )
-					//	continue;
 
-					pp+=leaves[t]->p;
-					var+=leaves[t]->trace;
+// The patch loop hands every accepted leaf to a sink, one for each vote format
+struct VoteVectorSink {
 
-					v_count++;
+	VoteVectorSink( std::vector< Vote >& v ) : votes(v) { }
 
-					Vote v;
+	void operator()( const leaf_data* leaf, float x, float y, float z ){
 
-					//add the 3D location under the patch center to the vote for the head center
-					v.vote[0] = leaves[t]->mean.at<float>(0) + rowX[roi.x + half_w];
-					v.vote[1] = leaves[t]->mean.at<float>(1) + rowY[roi.x + half_w];
-					v.vote[2] = leaves[t]->mean.at<float>(2) + rowZ[roi.x + half_w];
+		Vote v;
 
-					//angles, leave as in the leaf
-					v.vote[3] = leaves[t]->mean.at<float>(3);
-					v.vote[4] = leaves[t]->mean.at<float>(4);
-					v.vote[5] = leaves[t]->mean.at<float>(5);
+		//add the 3D location under the patch center to the vote for the head center
+		v.vote[0] = leaf->mean.at<float>(0) + x;
+		v.vote[1] = leaf->mean.at<float>(1) + y;
+		v.vote[2] = leaf->mean.at<float>(2) + z;
 
-					v.trace = &(leaves[t]->trace);
-					v.conf = &(leaves[t]->p);
+		//angles, leave as in the leaf
+		v.vote[3] = leaf->mean.at<float>(3);
+		v.vote[4] = leaf->mean.at<float>(4);
+		v.vote[5] = leaf->mean.at<float>(5);
 
-					temp_votes.push_back(v);
-				}
+		v.trace = &(leaf->trace);
+		v.conf = &(leaf->p);
 
-				pp /= float(leaves.size());
-				var /= float(leaves.size());
+		votes.push_back(v);
 
-				if( pp >= .9f ){ //&& var < max_variance ){ //v_count >= leaves.size()/2 ){
+	}
 
-					for(usint v=0;v<temp_votes.size();++v )
-						if ( *(temp_votes[v].trace) < max_variance && *(temp_votes[v].conf) >= prob_th )
-							votes.push_back( temp_votes[v] );
+	std::vector< Vote >& votes;
 
-				}
+};
 
-			}
-		} // end for x
+struct VoteSetSink {
 
-	} // end for y
+	VoteSetSink( VoteSet& v ) : votes(v) { }
 
-	delete [] channels;
+	void operator()( const leaf_data* leaf, float x, float y, float z ){
+
+		//the angles stay in the leaf
+		votes.push_back( leaf->mean.at<float>(0) + x,
+						 leaf->mean.at<float>(1) + y,
+						 leaf->mean.at<float>(2) + z,
+						 &leaf->mean.at<float>(3) );
+
+	}
+
+	VoteSet& votes;
+
+};
+
+void CRForestEstimator::do_regression( const Mat & im3D, int stride, float max_variance, float prob_th, std::vector< Vote >& votes, int trees ){
+
+	VoteVectorSink sink( votes );
+	regress_patches( im3D, stride, max_variance, prob_th, trees, sink );
 
 }
 
+void CRForestEstimator::do_regression( const Mat & im3D, int stride, float max_variance, float prob_th, VoteSet& votes, int trees ){
 
+	VoteSetSink sink( votes );
+	regress_patches( im3D, stride, max_variance, prob_th, trees, sink );
 
-void CRForestEstimator::do_clustering(const std::vector< Vote >& votes,
-										float larger_radius_ratio,
+}
+
+
+
+// Uniform 3D grid over a set of points (cluster means or votes). The cells are at least
+// as large as the search radius, so every point closer than the radius to a query lies
+// in one of the 27 cells around it.
+class PointGrid {
+
+public:
+
+	//result of the last neighbourhood query, one per querying thread
+	struct Query {
+
+		Query() : generation(-1) { }
+
+		std::vector< unsigned int > ids;
+		long generation;
+		int cx, cy, cz;
+
+	};
+
+	PointGrid() : m_generation(0) { }
+
+	void reset( float radius, unsigned int max_entries ){
+
+		//a bit larger than the radius, so rounding in the division can not miss a neighbour
+		m_inv_cell = 1.f/( radius*1.001f + 1e-3f );
+
+		unsigned int buckets = 16;
+		while( buckets < 4*max_entries )
+			buckets *= 2;
+		m_heads.assign( buckets, -1 );
+		m_entries.clear();
+		++m_generation;
+
+	}
+
+	void clear(){
+
+		m_heads.assign( m_heads.size(), -1 );
+		m_entries.clear();
+		++m_generation;
+
+	}
+
+	void insert( unsigned int id, const float* p ){
+
+		Entry e;
+		cell( p, e.cx, e.cy, e.cz );
+		e.id = id;
+
+		int& head = m_heads[ bucket( e.cx, e.cy, e.cz ) ];
+		e.next = head;
+		head = m_entries.size();
+		m_entries.push_back( e );
+		++m_generation;
+
+	}
+
+	//ids of the points in the neighbourhood of p, in increasing order
+	const std::vector< unsigned int >& candidates( const float* p, Query& q ) const {
+
+		int cx, cy, cz;
+		cell( p, cx, cy, cz );
+
+		//consecutive queries mostly fall into the same cell
+		if( q.generation == m_generation && cx == q.cx && cy == q.cy && cz == q.cz )
+			return q.ids;
+
+		q.ids.clear();
+		for(int dz=-1;dz<=1;++dz)
+			for(int dy=-1;dy<=1;++dy)
+				for(int dx=-1;dx<=1;++dx){
+
+					int i = m_heads[ bucket( cx+dx, cy+dy, cz+dz ) ];
+					for( ; i>=0; i=m_entries[i].next ){
+
+						const Entry& e = m_entries[i];
+						if( e.cx == cx+dx && e.cy == cy+dy && e.cz == cz+dz )
+							q.ids.push_back( e.id );
+
+					}
+				}
+
+		sort( q.ids.begin(), q.ids.end() );
+
+		q.generation = m_generation;
+		q.cx = cx; q.cy = cy; q.cz = cz;
+		return q.ids;
+
+	}
+
+private:
+
+	struct Entry {
+		int cx, cy, cz;
+		unsigned int id;
+		int next;
+	};
+
+	void cell( const float* p, int& cx, int& cy, int& cz ) const {
+
+		cx = (int)floor( p[0]*m_inv_cell );
+		cy = (int)floor( p[1]*m_inv_cell );
+		cz = (int)floor( p[2]*m_inv_cell );
+
+	}
+
+	unsigned int bucket( int cx, int cy, int cz ) const {
+
+		unsigned int h = (unsigned int)cx*73856093u ^ (unsigned int)cy*19349663u ^ (unsigned int)cz*83492791u;
+		return h & ( m_heads.size()-1 );
+
+	}
+
+	float m_inv_cell;
+	std::vector< int > m_heads;
+	std::vector< Entry > m_entries;
+
+	long m_generation; //changes whenever the points change
+
+};
+
+// A vote joins the first cluster (lowest index) whose mean is within the radius, the means
+// are refreshed every 10 votes. In grid mode only the clusters in the grid cells around the
+// vote are looked at, in linear mode all of them, both give the same clusters. The sums are
+// kept as running sums, which add up the members in the same order as re-summing them would.
+// With seeds, there is an empty cluster at each seed to begin with, clusters that stay empty
+// are removed at the end.
+void CRForestEstimator::cluster_votes( const VoteSet& votes,
+										float large_radius,
 										unsigned int max_clusters,
-										Vec<float,POSE_SIZE>& temp_mean,
-										std::vector< std::vector< const Vote* > >& temp_clusters,
-										std::vector< Vec<float,POSE_SIZE> >& cluster_means,
-										std::vector< std::vector< VoteIndex > >& cluster_votes_indeces ){
+										std::vector< std::vector< unsigned int > >& members,
+										std::vector< cv::Vec3f >& means,
+										std::vector< unsigned int >& mean_counts,
+										const std::vector< cv::Vec3f >* seeds,
+										std::vector< int >* seed_of ){
 
+	members.clear();
+	means.clear();
+	mean_counts.clear();
+	if( seed_of )
+		seed_of->clear();
 
-    //radius for clustering votes
-    float large_radius = AVG_FACE_DIAMETER2/(larger_radius_ratio*larger_radius_ratio);
+	bool use_grid = ( m_clustering_mode == CLUSTERING_GRID );
+
+	std::vector< Vec3f > sums;
+	std::vector< unsigned int > all_clusters;
 
-    //cluster using the head centers
-    for(unsigned int l=0;l<votes.size();++l){
+	PointGrid grid;
+	PointGrid::Query query;
+	grid.reset( sqrt( large_radius ), max_clusters );
 
-        bool found = false;
-        float best_dist = FLT_MAX;
-        unsigned int best_cluster = 0;
+	for(unsigned int k=0; seeds && k<seeds->size() && members.size()<max_clusters; ++k){
 
-		//for each cluster
-		for(unsigned int c=0; ( c<cluster_means.size() && found==false ); ++c){
+		members.push_back( std::vector< unsigned int >() );
+		means.push_back( (*seeds)[k] );
+		sums.push_back( Vec3f() );
+		mean_counts.push_back( 0 );
+
+		all_clusters.push_back( k );
+		grid.insert( k, &means[k][0] );
+
+	}
+
+	for(unsigned int l=0;l<votes.size();++l){
+
+		float v[3] = { votes.x[l], votes.y[l], votes.z[l] };
+		const std::vector< unsigned int >& candidates = use_grid ? grid.candidates( v, query ) : all_clusters;
+
+		bool found = false;
+		for(unsigned int k=0; k<candidates.size(); ++k){
+
+			unsigned int c = candidates[k];
 
 			float norm = 0;
 			for(int n=0;n<3;++n)
-			    norm += (votes[l].vote[n]-cluster_means[c][n])*(votes[l].vote[n]-cluster_means[c][n]);
+			    norm += (v[n]-means[c][n])*(v[n]-means[c][n]);
 
 			//is the offset smaller than the radius?
 			if( norm < large_radius ){
 
-				best_cluster = c;
-				found = true;
-
-				 //add (pointer to) vote to the closest cluster (well, actually, the first cluster found within the distance)
-				temp_clusters[best_cluster].push_back( &(votes[l]) );
+				members[c].push_back( l );
+				for(int n=0;n<3;++n)
+					sums[c][n] += v[n];
 
-				VoteIndex vi;
-				vi.trace = votes[l].trace;
-				vi.index = l;
-				cluster_votes_indeces[best_cluster].push_back(vi);
+				found = true;
+				break;
 
 			}
 
 		}
 
 		//create a new cluster
-        if( !found && temp_clusters.size() < max_clusters ){
+		if( !found && members.size() < max_clusters ){
 
-            vector< const Vote* > new_cluster;
-            new_cluster.push_back( &(votes[l]) );
-            temp_clusters.push_back( new_cluster );
+			members.push_back( std::vector< unsigned int >( 1, l ) );
+			means.push_back( Vec3f( v[0], v[1], v[2] ) );
+			sums.push_back( Vec3f( v[0], v[1], v[2] ) );
+			mean_counts.push_back( 0 );
 
-            Vec<float,POSE_SIZE> vote( votes[l].vote );
-            cluster_means.push_back( vote );
-
-            std::vector< VoteIndex > votes_index;
-			VoteIndex vi;
-			vi.trace = votes[l].trace;
-			vi.index = l;
-			votes_index.push_back(vi);
-			cluster_votes_indeces.push_back( votes_index );
-
-        }
+			all_clusters.push_back( means.size()-1 );
+			grid.insert( means.size()-1, v );
 
+		}
 
-        //update the means every 10 votes only
+		//update the means every 10 votes only
 		if ( l%10 == 0){
 
-			for(unsigned int c=0; c<cluster_means.size(); ++c){
+			grid.clear();
 
-				if ( temp_clusters[c].size() > 0 ){
+			for(unsigned int c=0; c<means.size(); ++c){
 
-					 //update cluster's mean
-					cluster_means[c] = 0;
-					for(unsigned int i=0;i < temp_clusters[c].size(); ++i)
-						((cluster_means[c])) = ((cluster_means[c])) + temp_clusters[c][i]->vote;
+				//seeds stay where they are until they get votes
+				if( members[c].size() > 0 ){
 
-					float div = float(MAX(1,temp_clusters[c].size()));
-					for(int n=0;n<POSE_SIZE;++n)
-						cluster_means[c][n] /= div;
+					float div = float(MAX(1,members[c].size()));
+					for(int n=0;n<3;++n)
+						means[c][n] = sums[c][n] / div;
+					mean_counts[c] = members[c].size();
 
 				}
 
+				grid.insert( c, &means[c][0] );
+
 			}
 
 		}
 
-    }
+	}
+
+	if( seeds ){
+
+		unsigned int kept = 0;
+		for(unsigned int c=0; c<members.size(); ++c){
+
+			if( members[c].empty() )
+				continue;
+
+			members[kept].swap( members[c] );
+			means[kept] = means[c];
+			mean_counts[kept] = mean_counts[c];
+			kept++;
+
+			if( seed_of )
+				seed_of->push_back( c < seeds->size() ? (int)c : -1 );
+
+		}
+
+		members.resize( kept );
+		means.resize( kept );
+		mean_counts.resize( kept );
+
+	}
+
+}
+
+
+void CRForestEstimator::do_clustering(const std::vector< Vote >& votes,
+										float larger_radius_ratio,
+										unsigned int max_clusters,
+										Vec<float,POSE_SIZE>& temp_mean,
+										std::vector< std::vector< const Vote* > >& temp_clusters,
+										std::vector< Vec<float,POSE_SIZE> >& cluster_means,
+										std::vector< std::vector< VoteIndex > >& cluster_votes_indeces ){
+
+
+    //radius for clustering votes
+    float large_radius = AVG_FACE_DIAMETER2/(larger_radius_ratio*larger_radius_ratio);
+
+	VoteSet vote_set;
+	vote_set.assign( votes );
+
+	std::vector< std::vector< unsigned int > > members;
+	std::vector< Vec3f > means;
+	std::vector< unsigned int > mean_counts;
+
+	cluster_votes( vote_set, large_radius, max_clusters, members, means, mean_counts );
+
+	temp_clusters.assign( members.size(), std::vector< const Vote* >() );
+	cluster_means.assign( members.size(), Vec<float,POSE_SIZE>() );
+	cluster_votes_indeces.assign( members.size(), std::vector< VoteIndex >() );
+
+	for(unsigned int c=0; c<members.size(); ++c){
+
+		for(unsigned int k=0; k<members[c].size(); ++k){
+
+			const Vote& vote = votes[ members[c][k] ];
+			temp_clusters[c].push_back( &vote );
+
+			VoteIndex vi;
+			vi.trace = vote.trace;
+			vi.index = members[c][k];
+			cluster_votes_indeces[c].push_back(vi);
+
+		}
+
+		//the full means as of the last update, over the votes the cluster had then
+		if( mean_counts[c] == 0 ){
+
+			cluster_means[c] = temp_clusters[c][0]->vote;
+
+		}
+		else{
+
+			for(unsigned int k=0; k<mean_counts[c]; ++k)
+				cluster_means[c] = cluster_means[c] + temp_clusters[c][k]->vote;
+
+			for(int n=0;n<POSE_SIZE;++n)
+				cluster_means[c][n] /= float(mean_counts[c]);
+
+		}
+
+	}
 
 }
 
@@ -340,30 +602,423 @@ void CRForestEstimator::estimate( const Mat & im3D,
 								   int max_no_faces
 								   ){
 
-
-    unsigned int max_clusters = 20;
-    int max_ms_iterations = 10;
-
     //the actual regression
     do_regression(im3D, stride, max_variance, prob_th, votes );
 
     if(verbose)
         cout << endl << "votes : " << votes.size() << endl;
 
-	vector< vector< const Vote* > > temp_clusters;
-	vector< Vec<float,POSE_SIZE> > cluster_means;
-	std::vector< std::vector< VoteIndex > > cluster_votes_indeces;
+	estimate_from_votes( votes,
+						 means,
+						 clusters,
+						 stride,
+						 larger_radius_ratio,
+						 smaller_radius_ratio,
+						 verbose,
+						 threshold,
+						 max_no_faces );
+
+}
+
+
+void CRForestEstimator::estimate( const Mat & im3D,
+								   std::vector< cv::Vec<float,POSE_SIZE> >& means,
+								   std::vector< std::vector< const Vote* > >& clusters,
+								   std::vector< Vote >& votes,
+								   const EstimationParams& params ){
+
+	do_regression( im3D, params.stride, params.max_variance, params.prob_th, votes, params.trees );
+
+	if(params.verbose)
+		cout << endl << "votes : " << votes.size() << endl;
+
+	estimate_from_votes( votes,
+						 means,
+						 clusters,
+						 params.stride,
+						 params.larger_radius_ratio,
+						 params.smaller_radius_ratio,
+						 params.verbose,
+						 params.threshold,
+						 params.max_no_faces,
+						 params.trees );
+
+}
+
+
+void CRForestEstimator::estimate( const Mat & im3D,
+								   std::vector< cv::Vec<float,POSE_SIZE> >& means,
+								   VoteClusters& clusters,
+								   VoteSet& votes,
+								   const EstimationParams& params ){
+
+	do_regression( im3D, params.stride, params.max_variance, params.prob_th, votes, params.trees );
+
+	if(params.verbose)
+		cout << endl << "votes : " << votes.size() << endl;
+
+	estimate_from_votes( votes,
+						 means,
+						 clusters,
+						 params.stride,
+						 params.larger_radius_ratio,
+						 params.smaller_radius_ratio,
+						 params.verbose,
+						 params.threshold,
+						 params.max_no_faces,
+						 params.trees );
+
+}
+
+
+// Query points a mean shift seed went through, so later seeds reaching one of them
+// can take over its result instead of iterating again.
+struct MeanShiftPath {
+
+	std::vector< Vec3f > points; //mean before each iteration
+	unsigned int end; //iterations it took in total
+	bool converged; //stopped because the mean did not move, not because of the iteration limit
+
+};
+
+// Mean shift of all clusters, shared by the tasks running it. Only the head centres
+// are shifted, the angles are averaged at the end for the accepted heads only.
+struct MeanShiftCluster {
+
+	std::vector< float > votes[3]; //x, y and z of the cluster's votes
+	PointGrid grid;
+	std::vector< Vec3f > starts; //one per seed in use, the other seeds of the cluster are skipped
+
+};
+
+struct MeanShiftSeed {
+
+	MeanShiftSeed() : finished(0) { }
+
+	Vec3f mean;
+	std::vector< unsigned int > members; //positions in the cluster of the votes in the final sub-cluster
+	MeanShiftPath path;
+	volatile long finished; //set once mean, members and path can be read by other seeds
+
+};
+
+struct MeanShiftJob {
+
+	const VoteSet* votes;
+	const std::vector< std::vector< unsigned int > >* clusters;
+	const std::vector< Vec3f >* cluster_means;
+	std::vector< MeanShiftCluster > ms_clusters;
+	std::vector< MeanShiftSeed > seeds; //seeds_per_cluster for each cluster
+	unsigned int seeds_per_cluster;
+	unsigned int max_iters;
+	float ms_radius;
+
+};
+
+static void run_tasks( ThreadPool* pool, unsigned int count, pool_task_fn fn, void* arg ){
+
+	if( pool )
+		pool->run( count, fn, arg );
+	else
+		for(unsigned int i=0;i<count;++i)
+			fn( i, arg );
+
+}
+
+static void prepare_mean_shift_cluster( unsigned int c, void* arg ){
+
+	MeanShiftJob& job = *(MeanShiftJob*)arg;
+	const VoteSet& votes = *job.votes;
+	const std::vector< unsigned int >& cluster = (*job.clusters)[c];
+	MeanShiftCluster& msc = job.ms_clusters[c];
+
+	for(int n=0;n<3;++n)
+		msc.votes[n].resize( cluster.size() );
+
+	msc.grid.reset( sqrt( job.ms_radius ), cluster.size() );
+	for(unsigned int idx=0; idx < cluster.size(); ++idx){
+
+		float v[3] = { votes.x[ cluster[idx] ], votes.y[ cluster[idx] ], votes.z[ cluster[idx] ] };
+
+		for(int n=0;n<3;++n)
+			msc.votes[n][idx] = v[n];
+		msc.grid.insert( idx, v );
+
+	}
+
+}
+
+static void run_mean_shift_seed( unsigned int i, void* arg ){
+
+	MeanShiftJob& job = *(MeanShiftJob*)arg;
+	unsigned int c = i / job.seeds_per_cluster;
+	unsigned int sc = i % job.seeds_per_cluster;
+	unsigned int max_iters = job.max_iters;
+
+	const MeanShiftCluster& msc = job.ms_clusters[c];
+	MeanShiftSeed& seed = job.seeds[i];
+	MeanShiftSeed* cluster_seeds = &job.seeds[ c*job.seeds_per_cluster ];
+
+	MeanShiftPath& path = seed.path;
+	path.points.clear();
+	path.end = max_iters;
+	path.converged = false;
+
+	if( sc >= msc.starts.size() ){
+		path.end = 0;
+		seed.members.clear();
+		atomic_store( &seed.finished, 1 );
+		return;
+	}
+
+	Vec3f sub_mean = msc.starts[sc];
+
+	PointGrid::Query query;
+	std::vector< unsigned int > members;
+
+	//now we have all the votes close to the seeding one inside the cluster, do MS
+	for(unsigned int it=0; it<max_iters; ++it){
+
+		//a seed that already finished went through the same point: the rest is the same
+		int same = -1;
+		for(unsigned int s=0; s<job.seeds_per_cluster && same<0; ++s){
+
+			if( s == sc || !atomic_load( &cluster_seeds[s].finished ) )
+				continue;
+
+			const MeanShiftPath& other = cluster_seeds[s].path;
+			for(unsigned int p=0; p<other.points.size(); ++p){
+
+				if( other.points[p][0] != sub_mean[0] || other.points[p][1] != sub_mean[1] || other.points[p][2] != sub_mean[2] )
+					continue;
+
+				//only if it would have stopped with the iterations left to this one
+				unsigned int left = other.end - p;
+				if( ( other.converged && left <= max_iters-it ) || left == max_iters-it ){
+					same = s;
+					path.end = it + left;
+					path.converged = other.converged;
+					break;
+				}
+
+			}
+
+		}
+
+		if( same >= 0 ){
+
+			sub_mean = cluster_seeds[ same ].mean;
+			seed.members = cluster_seeds[ same ].members;
+			break;
+
+		}
+
+		path.points.push_back( sub_mean );
+
+		Vec3f temp_sub_mean;
+		members.clear();
+
+		//only votes in the grid cells around the mean can be within the radius
+		const std::vector< unsigned int >& candidates = msc.grid.candidates( &sub_mean[0], query );
+
+		for(unsigned int k=0; k < candidates.size(); ++k){
+
+			unsigned int idx = candidates[k];
+
+			//compute distance
+			float norm = 0;
+			for(int n=0;n<3;++n)
+				norm += ( msc.votes[n][idx] - sub_mean[n] )*( msc.votes[n][idx] - sub_mean[n] );
+
+			//is it within the radius?
+			if( norm < job.ms_radius )
+				members.push_back( idx );
+
+		}
+
+		//candidates are in vote order, so the sums are the same as over the whole cluster
+		for(int n=0;n<3;++n){
+
+			const float* v = &msc.votes[n][0];
+			float sum = 0;
+			for(unsigned int k=0; k < members.size(); ++k)
+				sum += v[ members[k] ];
+			temp_sub_mean[n] = sum / (float)MAX(1,members.size());
+
+		}
+
+		//how much did the mean move?
+		float distance_to_previous_mean2 = 0;
+		for(int n=0;n<3;++n)
+			distance_to_previous_mean2 += (temp_sub_mean[n]-sub_mean[n])*(temp_sub_mean[n]-sub_mean[n]);
+
+		sub_mean = temp_sub_mean;
+
+		//update the cluster
+		seed.members.swap( members );
+
+		//stop iterating if did not move much
+		if( distance_to_previous_mean2 < 1  ){
+			path.end = it+1;
+			path.converged = true;
+			break;
+		}
+
+	}
+
+	seed.mean = sub_mean;
+	atomic_store( &seed.finished, 1 );
+
+}
+
+
+void CRForestEstimator::estimate_from_votes( const std::vector< Vote >& votes,
+											 std::vector< cv::Vec<float,POSE_SIZE> >& means, //output
+											 std::vector< std::vector< const Vote* > >& clusters,
+											 int stride,
+											 float larger_radius_ratio,
+											 float smaller_radius_ratio,
+											 bool verbose,
+											 int threshold,
+											 int max_no_faces,
+											 int trees
+											 ){
+
+	VoteSet vote_set;
+	vote_set.assign( votes );
+
+	VoteClusters heads;
+	estimate_from_votes( vote_set,
+						 means,
+						 heads,
+						 stride,
+						 larger_radius_ratio,
+						 smaller_radius_ratio,
+						 verbose,
+						 threshold,
+						 max_no_faces,
+						 trees );
+
+	for(unsigned int c=0; c<heads.size(); ++c){
+
+		vector< const Vote* > cluster( heads.size(c) );
+		for(unsigned int k=0; k<heads.size(c); ++k)
+			cluster[k] = &votes[ heads.cluster(c)[k] ];
+		clusters.push_back( cluster );
 
-	Vec<float,POSE_SIZE> temp_mean;
+	}
+
+}
+
+
+void CRForestEstimator::estimate_from_votes( const VoteSet& votes,
+											 std::vector< cv::Vec<float,POSE_SIZE> >& means, //output
+											 VoteClusters& clusters,
+											 int stride,
+											 float larger_radius_ratio,
+											 float smaller_radius_ratio,
+											 bool verbose,
+											 int threshold,
+											 int max_no_faces,
+											 int trees
+											 ){
+
+	std::vector< HeadPose > heads;
+	find_heads( votes,
+				heads,
+				&clusters,
+				stride,
+				larger_radius_ratio,
+				smaller_radius_ratio,
+				verbose,
+				threshold,
+				max_no_faces,
+				trees );
+
+	for(unsigned int h=0; h<heads.size(); ++h)
+		means.push_back( heads[h].pose );
+
+}
+
+
+void CRForestEstimator::estimate_poses( const Mat & im3D,
+										 std::vector< HeadPose >& heads,
+										 const EstimationParams& params,
+										 EstimationWorkspace* workspace ){
+
+	EstimationWorkspace local;
+	if( !workspace )
+		workspace = &local;
+
+	heads.clear();
+	workspace->votes.clear();
+
+	do_regression( im3D, params.stride, params.max_variance, params.prob_th, workspace->votes, params.trees );
+
+	if(params.verbose)
+		cout << endl << "votes : " << workspace->votes.size() << endl;
+
+	find_heads( workspace->votes,
+				heads,
+				0,
+				params.stride,
+				params.larger_radius_ratio,
+				params.smaller_radius_ratio,
+				params.verbose,
+				params.threshold,
+				params.max_no_faces,
+				params.trees,
+				workspace->warm_start ? &workspace->previous : 0,
+				&workspace->stats );
+
+	//no heads: the next frame starts from scratch
+	workspace->previous.clear();
+	if( workspace->warm_start )
+		for(unsigned int h=0; h<heads.size(); ++h)
+			workspace->previous.push_back( Vec3f( heads[h].pose[0], heads[h].pose[1], heads[h].pose[2] ) );
+
+}
+
+int CRForestEstimator::head_threshold( int threshold, int stride, int trees ) const {
+
+	return MAX( 1, cvRound((double)threshold*trees_used( trees )/(double)(stride*stride)) );
+
+}
+
+
+void CRForestEstimator::find_heads( const VoteSet& votes,
+									 std::vector< HeadPose >& heads,
+									 VoteClusters* clusters,
+									 int stride,
+									 float larger_radius_ratio,
+									 float smaller_radius_ratio,
+									 bool verbose,
+									 int threshold,
+									 int max_no_faces,
+									 int trees,
+									 const std::vector< cv::Vec3f >* previous,
+									 MeanShiftStats* stats
+									 ){
+
+    unsigned int max_clusters = 20;
+
+	vector< vector< unsigned int > > temp_clusters;
+	vector< Vec3f > cluster_means;
+	vector< unsigned int > mean_counts;
+	vector< int > seed_of;
+
+	if( previous && previous->empty() )
+		previous = 0;
 
 	//get head clusters from the votes
-	do_clustering( votes,
-					larger_radius_ratio,
-					max_clusters,
-					temp_mean,
-					temp_clusters,
-					cluster_means,
-					cluster_votes_indeces );
+	cluster_votes( votes,
+				   AVG_FACE_DIAMETER2/(larger_radius_ratio*larger_radius_ratio),
+				   max_clusters,
+				   temp_clusters,
+				   cluster_means,
+				   mean_counts,
+				   previous,
+				   &seed_of );
 
 	if(verbose){
 
@@ -385,111 +1040,89 @@ void CRForestEstimator::estimate( const Mat & im3D,
 
 	std::vector< ClusterIndex > c_index;
 
-	//std::vector< std::vector< const Vote* > > new_clusters; //after MS
-	vector< Vec<float,POSE_SIZE> > new_means;
-	//vector< ClusterIndex > c_index;
-
-	int count = 0;
 	float ms_radius = AVG_FACE_DIAMETER*AVG_FACE_DIAMETER/(smaller_radius_ratio*smaller_radius_ratio);
 
-	//threshold defining if the cluster belongs to a head: it depends on the stride and on the number of trees
-	int th = cvRound((double)threshold*crForest.size()/(double)(stride*stride));
+	//threshold defining if the cluster belongs to a head
+	int th = head_threshold( threshold, stride, trees );
 
-	//for each cluster
+	MeanShiftJob job;
+	job.votes = &votes;
+	job.clusters = &temp_clusters;
+	job.cluster_means = &cluster_means;
+	job.ms_clusters.resize( temp_clusters.size() );
+	job.seeds.resize( temp_clusters.size()*max_sub_clusters );
+	job.seeds_per_cluster = max_sub_clusters;
+	job.max_iters = max_iters;
+	job.ms_radius = ms_radius;
+
+	//draw the seeds serially, so they do not depend on the number of threads
 	for(unsigned int c=0;c<temp_clusters.size();++c){
 
+		std::vector< Vec3f >& starts = job.ms_clusters[c].starts;
+		starts.push_back( cluster_means[c] );
+
+		//a head of the previous frame: no random seeds, it is started from where the head was
+		if( previous && seed_of[c] >= 0 ){
+			starts.push_back( (*previous)[ seed_of[c] ] );
+			continue;
+		}
+
 		//find sub-clusters
 		cv::Mat_<int> cluster_inits;
 		cluster_inits.create( max_sub_clusters , 1 );
 		cvRNG.fill( cluster_inits, RNG::UNIFORM, Scalar(0), Scalar( temp_clusters[c].size() ) );
 
-		vector< Vec<float,POSE_SIZE> > sub_means( max_sub_clusters );
-		vector< vector< const Vote* > > sub_clusters( max_sub_clusters );
-		std::vector< ClusterIndex > c_sub_index;
-
-		//initialize clusters on random votes
-		for(unsigned int sc=0;sc<max_sub_clusters;++sc){
-
-			usint vote_idx = cluster_inits( sc );
-
-			sub_clusters[sc].clear();
-			if(sc==0)
-				sub_means[sc] = cluster_means[c];
-			else
-				sub_means[sc] = temp_clusters[c][ vote_idx ]->vote;
-
-			//now we have all the votes close to the seeding one inside the cluster, do MS
-			int count = 0;
-
-			//unsigned int num_sel_votes = joined_clusters[c].size();
-			vector< const Vote* > new_sub_cluster;
-			Vec<float,POSE_SIZE> temp_sub_mean;
-
-			for(unsigned int it=0; it<max_iters; ++it){
-
-				//count = 0;
-				temp_sub_mean = 0;
-				new_sub_cluster.clear();
-
-				//for each vote in the cluster
-				for(unsigned int idx=0; idx < temp_clusters[c].size(); ++idx){
-
-					//compute distance
-					float norm = 0;
-					for(int n=0;n<3;++n)
-						norm += ( temp_clusters[c][idx]->vote[n] - sub_means[sc][n] )*( temp_clusters[c][idx]->vote[n] - sub_means[sc][n] );
-						//norm += ( joined_clusters[c][idx].vote[n]-sub_means[sc][n] )*( votes[idx].vote[n]-sub_means[sc][n] );
+		for(unsigned int sc=1;sc<max_sub_clusters;++sc){
+			unsigned int idx = temp_clusters[c][ cluster_inits( sc ) ];
+			starts.push_back( Vec3f( votes.x[idx], votes.y[idx], votes.z[idx] ) );
+		}
 
-					//is it within the radius?
-					if( norm < ms_radius ){
+	}
 
-						//add the vote to the cluster
-						temp_sub_mean = temp_sub_mean + temp_clusters[c][idx]->vote;
-						//if(it == max_ms_iterations -1)
-						//new_sub_cluster[ idx ] = 1;
-						new_sub_cluster.push_back( temp_clusters[c][idx] );
-						//count++;
+	//all clusters and seeds are independent
+	run_tasks( m_pool, temp_clusters.size(), prepare_mean_shift_cluster, &job );
+	run_tasks( m_pool, job.seeds.size(), run_mean_shift_seed, &job );
 
-					}
+	if( stats ){
 
-				}
+		stats->frames++;
+		for(unsigned int c=0;c<temp_clusters.size();++c){
 
-				//update mean
-				for(int n=0;n<POSE_SIZE;++n)
-					temp_sub_mean[n] /= (float)MAX(1,new_sub_cluster.size());
+			stats->seeds += job.ms_clusters[c].starts.size();
+			if( previous && seed_of[c] >= 0 )
+				stats->warm_clusters++;
 
-				//how much did the mean move?
-				float distance_to_previous_mean2 = 0;
-				for(int n=0;n<3;++n)
-					distance_to_previous_mean2 += (temp_sub_mean[n]-sub_means[sc][n])*(temp_sub_mean[n]-sub_means[sc][n]);
-
-				sub_means[sc] = temp_sub_mean;
+		}
+		for(unsigned int i=0;i<job.seeds.size();++i)
+			stats->iterations += job.seeds[i].path.points.size();
 
-				//update the cluster
-				sub_clusters[sc] = new_sub_cluster;
+	}
 
-				//stop iterating if did not move much
-				if( distance_to_previous_mean2 < 1  )
-					break;
+	//for each cluster
+	for(unsigned int c=0;c<temp_clusters.size();++c){
 
-				count++;
+		std::vector< ClusterIndex > c_sub_index;
 
-			}
+		for(unsigned int sc=0;sc<job.ms_clusters[c].starts.size();++sc){
 
 			ClusterIndex ci;
 			ci.index = sc;
-			ci.val = new_sub_cluster.size();
+			ci.val = job.seeds[ c*max_sub_clusters + sc ].members.size();
 			c_sub_index.push_back(ci);
 
 		}
 
-
 		sort(c_sub_index.begin(), c_sub_index.end());
 	
 		int max_index = c_sub_index[c_sub_index.size()-1].index;
+		const MeanShiftSeed& best = job.seeds[ c*max_sub_clusters + max_index ];
 
-		temp_clusters[c] = sub_clusters[ max_index ];
-		cluster_means[c] = sub_means[ max_index ];
+		vector< unsigned int > sub_cluster( best.members.size() );
+		for(unsigned int k=0; k < sub_cluster.size(); ++k)
+			sub_cluster[k] = temp_clusters[c][ best.members[k] ];
+
+		temp_clusters[c].swap( sub_cluster );
+		cluster_means[c] = best.mean;
 
 
 		ClusterIndex ci;
@@ -514,30 +1147,43 @@ void CRForestEstimator::estimate( const Mat & im3D,
 	for( usint c = 0; c < MIN( temp_clusters.size() , max_no_faces ); ++c){
 
 		int max_index = c_index[c_index.size()-1-c].index;
+		const vector< unsigned int >& cluster = temp_clusters[max_index];
 
-		if( temp_clusters[max_index].size() < th )
+		if( cluster.size() < th )
 			break;
 
-		vector< const Vote* > cluster;
-		cluster_means[max_index] = 0;
+		//full pose, the angles are only read here
+		Vec<float,POSE_SIZE> mean;
 
 		//for each vote in the cluster
-		for(unsigned int k=0; k < temp_clusters[max_index].size(); k++ ){
+		for(unsigned int k=0; k < cluster.size(); k++ ){
 
-			cluster_means[max_index] = cluster_means[max_index] + temp_clusters[max_index][k]->vote;
-			cluster.push_back( temp_clusters[max_index][k] );
+			unsigned int idx = cluster[k];
+			mean[0] += votes.x[idx];
+			mean[1] += votes.y[idx];
+			mean[2] += votes.z[idx];
+			mean[3] += votes.angles[idx][0];
+			mean[4] += votes.angles[idx][1];
+			mean[5] += votes.angles[idx][2];
 
 		}
 
-		float div = (float)MAX(1,temp_clusters[max_index].size());
+		float div = (float)MAX(1,cluster.size());
 		for(int n=0;n<POSE_SIZE;++n)
-			cluster_means[max_index][n] /= div;
+			mean[n] /= div;
 
-		means.push_back( cluster_means[max_index] );
-		clusters.push_back( cluster );
+		HeadPose head;
+		head.pose = mean;
+		head.votes = cluster.size();
+		head.confidence = cluster.size()/(float)th;
+		heads.push_back( head );
+
+		if( clusters ){
+			clusters->indices.insert( clusters->indices.end(), cluster.begin(), cluster.end() );
+			clusters->end_cluster();
+		}
 
 	}
 
 
 }
-
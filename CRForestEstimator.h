@@ -5,6 +5,7 @@
 #endif
 
 #include "CRTree.h"
+#include "ThreadPool.h"
 #include <fstream>
 #include "opencv2/core/core.hpp"
 
@@ -26,16 +27,144 @@ struct VoteIndex {
 
 };
 
+//compact votes: the head centre of each vote, one array per coordinate, and a pointer to
+//its angles (pitch, yaw, roll) in the leaf, which are only read for the accepted heads
+struct VoteSet {
+
+	std::vector< float > x, y, z;
+	std::vector< const float* > angles;
+
+	unsigned int size() const { return x.size(); }
+
+	void clear(){ x.clear(); y.clear(); z.clear(); angles.clear(); }
+
+	void push_back( float vx, float vy, float vz, const float* a ){
+		x.push_back(vx); y.push_back(vy); z.push_back(vz); angles.push_back(a);
+	}
+
+	//view of full votes, which have to outlive the set
+	void assign( const std::vector< Vote >& votes ){
+		clear();
+		for(unsigned int i=0;i<votes.size();++i)
+			push_back( votes[i].vote[0], votes[i].vote[1], votes[i].vote[2], &votes[i].vote[3] );
+	}
+
+	cv::Vec<float,POSE_SIZE> pose( unsigned int i ) const {
+		return cv::Vec<float,POSE_SIZE>( x[i], y[i], z[i], angles[i][0], angles[i][1], angles[i][2] );
+	}
+
+};
+
+//clusters as ranges of one flat array of vote indices
+struct VoteClusters {
+
+	VoteClusters() : begin(1, 0) { }
+
+	std::vector< unsigned int > indices; //votes of all clusters, one cluster after the other
+	std::vector< unsigned int > begin; //cluster c is indices[ begin[c] ] ... indices[ begin[c+1]-1 ]
+
+	unsigned int size() const { return begin.size()-1; }
+	unsigned int size( unsigned int c ) const { return begin[c+1]-begin[c]; }
+	const unsigned int* cluster( unsigned int c ) const { return indices.empty() ? 0 : &indices[0] + begin[c]; }
+
+	void clear(){ indices.clear(); begin.assign(1, 0); }
+
+	//the indices pushed since the last call form a new cluster
+	void end_cluster(){ begin.push_back( indices.size() ); }
+
+};
+
+//result of estimate_poses()
+struct HeadPose {
+
+	cv::Vec<float,POSE_SIZE> pose; //x,y,z,pitch,yaw,roll
+	unsigned int votes; //size of the head's cluster
+	float confidence; //votes relative to the head threshold, >= 1
+
+};
+
+//mean shift work of estimate_poses() calls, summed up over frames
+struct MeanShiftStats {
+
+	MeanShiftStats() : frames(0), seeds(0), iterations(0), warm_clusters(0) { }
+
+	long frames;
+	long seeds; //mean shift runs started
+	long iterations; //of all seeds, without the ones taken over from other seeds
+	long warm_clusters; //clusters started from a head of the previous frame
+
+};
+
+//buffers reused by estimate_poses() across frames, one per thread (and one per stream with warm_start)
+struct EstimationWorkspace {
+
+	EstimationWorkspace() : warm_start(false) { }
+
+	VoteSet votes;
+
+	//temporal mode: clustering and mean shift start from the heads of the previous frame,
+	//random seeds are only drawn for new clusters. Without heads it is the same as a single frame
+	bool warm_start;
+	std::vector< cv::Vec3f > previous; //head centres of the previous frame
+
+	MeanShiftStats stats;
+
+};
+
+//all parameters of estimate(), defaults as in estimate()
+struct EstimationParams {
+
+	EstimationParams() :
+		stride(5),
+		max_variance(1000),
+		prob_th(1.0f),
+		larger_radius_ratio(1.0f),
+		smaller_radius_ratio(6.0f),
+		verbose(false),
+		threshold(400),
+		max_no_faces(2),
+		trees(0) { }
+
+	int stride;
+	float max_variance;
+	float prob_th;
+	float larger_radius_ratio;
+	float smaller_radius_ratio;
+	bool verbose;
+	int threshold;
+	int max_no_faces;
+	int trees; //no. of trees used, 0 = all of the forest. The threshold is scaled to them
+
+};
+
 class CRForestEstimator {
 
 public:
 
-	CRForestEstimator(){ m_avg_votes = true; };
+	//how do_clustering finds the cluster of a vote, both give the same clusters
+	enum ClusteringMode {
+		CLUSTERING_LINEAR, //compare against every cluster mean, re-sum all members to update the means
+		CLUSTERING_GRID //only look at the cluster means in the grid cells around the vote, keep running sums
+	};
+
+	CRForestEstimator(){ m_avg_votes = true; m_clustering_mode = CLUSTERING_GRID; m_pool = 0; };
 	~CRForestEstimator();
 
 	bool load_forest(const std::string& path, unsigned int ntrees = 0  );
 
-	void do_regression(const cv::Mat & im3D, int stride, float max_variance,  float prob_th, std::vector< Vote >& votes );
+	//threads used inside one estimate() call (mean shift), 1 = serial, the default.
+	//Results do not depend on it. Do not call while estimating.
+	void set_num_threads( unsigned int threads );
+	unsigned int num_threads() const { return m_pool ? m_pool->workers()+1 : 1; }
+
+	unsigned int num_trees() const { return crForest.size(); }
+
+	//trees: only the first trees of the forest are used, 0 = all
+	void do_regression(const cv::Mat & im3D, int stride, float max_variance,  float prob_th, std::vector< Vote >& votes, int trees = 0 );
+
+	void do_regression(const cv::Mat & im3D, int stride, float max_variance,  float prob_th, VoteSet& votes, int trees = 0 );
+
+	//the outputs are expected to be empty
 
 	void do_clustering(const std::vector< Vote >& votes,
 						float larger_radius_ratio,
@@ -59,13 +188,96 @@ public:
 					   int threshold = 400, //head threshold
 					   int max_no_faces = 2);
 
+	void estimate( const cv::Mat & im3D,
+					   std::vector< cv::Vec<float,POSE_SIZE> >& means,
+					   std::vector< std::vector< const Vote* > >& clusters,
+					   std::vector< Vote >& votes,
+					   const EstimationParams& params );
+
+	//poses only: the votes stay in the workspace and no clusters are built.
+	//heads is cleared first, they are sorted by decreasing no. of votes
+	void estimate_poses( const cv::Mat & im3D,
+					   std::vector< HeadPose >& heads,
+					   const EstimationParams& params,
+					   EstimationWorkspace* workspace = 0 );
+
+	//same with the compact vote format, votes and clusters are appended to
+	void estimate( const cv::Mat & im3D,
+					   std::vector< cv::Vec<float,POSE_SIZE> >& means,
+					   VoteClusters& clusters, //votes of the heads in means
+					   VoteSet& votes,
+					   const EstimationParams& params );
+
+	//second half of estimate(): clusters the votes returned by do_regression and runs mean shift on them,
+	//so that regression and clustering can run on different threads/frames
+	void estimate_from_votes( const std::vector< Vote >& votes, //input: votes returned by do_regression
+					   std::vector< cv::Vec<float,POSE_SIZE> >& means, //output: heads' centers and orientations (x,y,z,pitch,yaw,roll)
+					   std::vector< std::vector< const Vote* > >& clusters, //all clusters
+					   int stride = 5, //stride used for the regression
+					   float larger_radius_ratio = 1.0, //for clustering heads
+					   float smaller_radius_ratio = 6.0, //for mean shift
+					   bool verbose = false, //print out more info
+					   int threshold = 400, //head threshold
+					   int max_no_faces = 2,
+					   int trees = 0); //trees used for the regression, 0 = all
+
+	void estimate_from_votes( const VoteSet& votes,
+					   std::vector< cv::Vec<float,POSE_SIZE> >& means,
+					   VoteClusters& clusters,
+					   int stride = 5,
+					   float larger_radius_ratio = 1.0,
+					   float smaller_radius_ratio = 6.0,
+					   bool verbose = false,
+					   int threshold = 400,
+					   int max_no_faces = 2,
+					   int trees = 0);
+
+	//no. of votes a cluster needs to be a head for the given head threshold: it depends on the stride
+	//and on the number of trees. HeadPose::confidence is relative to it
+	int head_threshold( int threshold, int stride, int trees = 0 ) const;
+
 	bool m_avg_votes;
+	ClusteringMode m_clustering_mode;
 
 private:
 
+	//clustering and mean shift, fills clusters if not null
+	//previous: head centres to start from (temporal mode), stats: added to if not null
+	void find_heads( const VoteSet& votes,
+					   std::vector< HeadPose >& heads,
+					   VoteClusters* clusters,
+					   int stride,
+					   float larger_radius_ratio,
+					   float smaller_radius_ratio,
+					   bool verbose,
+					   int threshold,
+					   int max_no_faces,
+					   int trees,
+					   const std::vector< cv::Vec3f >* previous = 0,
+					   MeanShiftStats* stats = 0 );
+
+	//sends all patches down the trees, sink( leaf, x, y, z ) gets each accepted leaf and the patch centre
+	template< class Sink >
+	void regress_patches(const cv::Mat & im3D, int stride, float max_variance,  float prob_th, int trees, Sink& sink );
+
+	//no. of trees actually used for a trees parameter
+	unsigned int trees_used( int trees ) const { return trees > 0 && trees < (int)crForest.size() ? trees : crForest.size(); }
+
+	//clusters the head centres, mean_counts[c] = no. of votes means[c] was last computed from (0: the first vote)
+	void cluster_votes(const VoteSet& votes,
+						float large_radius,
+						unsigned int max_clusters,
+						std::vector< std::vector< unsigned int > >& members,
+						std::vector< cv::Vec3f >& means,
+						std::vector< unsigned int >& mean_counts,
+						const std::vector< cv::Vec3f >* seeds = 0, //initial cluster centres
+						std::vector< int >* seed_of = 0); //seed each cluster started from, -1 if none
+
 	
 	std::vector< CRTree* > crForest;
 
+	ThreadPool* m_pool; //shared by all concurrent estimate() calls
+
 };
 
 
@@ -0,0 +1,526 @@
+#include "DepthIO.h"
+#include "CRTree.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#ifndef S_ISDIR
+#define S_ISDIR(m) (((m) & S_IFMT) == S_IFDIR)
+#endif
+#endif
+
+using namespace std;
+using namespace cv;
+
+MappedFile::MappedFile() : m_data(0), m_size(0), m_mapped(false) { }
+
+MappedFile::~MappedFile(){
+
+	close();
+
+}
+
+bool MappedFile::open( const char* fname ){
+
+	close();
+
+#ifndef _WIN32
+	int fd = ::open( fname, O_RDONLY );
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat( fd, &st ) == 0 && st.st_size > 0 ){
+
+		void* p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if( p != MAP_FAILED ){
+
+			m_data = (const char*)p;
+			m_size = st.st_size;
+			m_mapped = true;
+
+		}
+
+	}
+
+	::close( fd );
+	if( m_mapped )
+		return true;
+#endif
+
+	//read it instead
+	FILE* pFile = fopen( fname, "rb" );
+	if( !pFile )
+		return false;
+
+	fseek( pFile, 0, SEEK_END );
+	long size = ftell( pFile );
+	fseek( pFile, 0, SEEK_SET );
+
+	m_buffer.resize( MAX( 0L, size ) );
+	bool success = ( size >= 0 ) && ( fread( m_buffer.empty() ? NULL : &m_buffer[0], 1, m_buffer.size(), pFile ) == m_buffer.size() );
+	fclose( pFile );
+
+	m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+	m_size = m_buffer.size();
+	return success;
+
+}
+
+void MappedFile::close(){
+
+#ifndef _WIN32
+	if( m_mapped )
+		munmap( (void*)m_data, m_size );
+#endif
+
+	m_data = NULL;
+	m_size = 0;
+	m_mapped = false;
+	m_buffer.clear();
+
+}
+
+bool depthImageSize( const void* data, size_t size, int& width, int& height ){
+
+	int header[2];
+	if( size < sizeof(header) )
+		return false;
+
+	memcpy( header, data, sizeof(header) );
+	width = header[0];
+	height = header[1];
+
+	//sanity limit, so that width*height cannot overflow
+	return width > 0 && height > 0 && width <= 32768 && height <= 32768;
+
+}
+
+// Walks the runs of an encoded image, checking each of them against the image and data size:
+// sink.zeros( p, n ) and sink.values( p, src, n ) get the runs starting at pixel p.
+template< class Sink >
+static bool decodeRuns( const void* data, size_t size, int width, int height, Sink& sink ){
+
+	int w, h;
+	if( !depthImageSize( data, size, w, h ) || w != width || h != height )
+		return false;
+
+	const char* bytes = (const char*)data;
+	size_t total = (size_t)width*height;
+	size_t offset = 2*sizeof(int);
+	size_t p = 0;
+
+	while( p < total ){
+
+		int run[2]; //no. of zero pixels, no. of non-zero pixels
+		if( size - offset < sizeof(run) )
+			return false;
+
+		memcpy( run, bytes + offset, sizeof(run) );
+		offset += sizeof(run);
+
+		if( run[0] < 0 || run[1] < 0 ||
+			(size_t)run[0] + (size_t)run[1] > total - p ||
+			(size_t)run[1]*sizeof(int16_t) > size - offset )
+			return false;
+
+		sink.zeros( p, run[0] );
+		p += run[0];
+
+		sink.values( p, bytes + offset, run[1] );
+		p += run[1];
+		offset += run[1]*sizeof(int16_t);
+
+	}
+
+	return true;
+
+}
+
+struct DepthSink {
+
+	int16_t* depth;
+
+	void zeros( size_t p, size_t n ){ memset( depth + p, 0, n*sizeof(int16_t) ); }
+	void values( size_t p, const char* src, size_t n ){ memcpy( depth + p, src, n*sizeof(int16_t) ); }
+
+};
+
+// same computation as depthTo3D(), pixel by pixel
+struct Depth3DSink {
+
+	float* xyz; //3 per pixel
+	int width;
+	const float* K;
+	int max_z;
+	int valid_pixels;
+
+	void zeros( size_t p, size_t n ){ memset( xyz + 3*p, 0, 3*n*sizeof(float) ); }
+
+	void values( size_t p, const char* src, size_t n ){
+
+		int x = p % width;
+		int y = p / width;
+
+		for(size_t i=0; i<n; ++i){
+
+			int16_t depth;
+			memcpy( &depth, src + i*sizeof(int16_t), sizeof(int16_t) );
+			float d = (float)depth;
+
+			float* v = xyz + 3*(p+i);
+			if ( d < max_z && d > 0 ){
+
+				valid_pixels++;
+
+				v[0] = d * (float(x) - K[2])/K[0];
+				v[1] = d * (float(y) - K[5])/K[4];
+				v[2] = d;
+
+			}
+			else{
+
+				v[0] = v[1] = v[2] = 0;
+			}
+
+			if( ++x == width ){
+				x = 0;
+				y++;
+			}
+
+		}
+
+	}
+
+};
+
+bool decodeDepthImage( const void* data, size_t size, int16_t* depth, int width, int height ){
+
+	DepthSink sink;
+	sink.depth = depth;
+	return decodeRuns( data, size, width, height, sink );
+
+}
+
+int decodeDepthTo3D( const void* data, size_t size, Mat& img3D, const float* depth_intrinsic, int max_z ){
+
+	int width, height;
+	if( !depthImageSize( data, size, width, height ) )
+		return -1;
+
+	img3D.create( height, width, CV_32FC3 );
+	if( !img3D.isContinuous() ){
+		img3D.release();
+		img3D.create( height, width, CV_32FC3 );
+	}
+
+	Depth3DSink sink;
+	sink.xyz = img3D.ptr<float>(0);
+	sink.width = width;
+	sink.K = depth_intrinsic;
+	sink.max_z = max_z;
+	sink.valid_pixels = 0;
+
+	if( !decodeRuns( data, size, width, height, sink ) )
+		return -1;
+
+	return sink.valid_pixels;
+
+}
+
+static void append( std::vector< char >& data, const void* src, size_t n ){
+
+	data.insert( data.end(), (const char*)src, (const char*)src + n );
+
+}
+
+void encodeDepthImage( const int16_t* depth, int width, int height, std::vector< char >& data ){
+
+	data.clear();
+
+	int header[2] = { width, height };
+	append( data, header, sizeof(header) );
+
+	size_t total = (size_t)MAX(0,width)*MAX(0,height);
+	size_t p = 0;
+
+	while( p < total ){
+
+		int run[2];
+
+		size_t start = p;
+		while( p < total && depth[p] == 0 )
+			p++;
+		run[0] = p - start;
+
+		start = p;
+		while( p < total && depth[p] != 0 )
+			p++;
+		run[1] = p - start;
+
+		append( data, run, sizeof(run) );
+		append( data, depth + start, run[1]*sizeof(int16_t) );
+
+	}
+
+}
+
+bool loadDepthImageCompressed( Mat& depthImg, const char* fname ){
+
+	MappedFile file;
+	if( !file.open( fname ) ){
+		cerr << "could not open file " << fname << endl;
+		return false;
+	}
+
+	int width, height;
+	if( !depthImageSize( file.data(), file.size(), width, height ) ){
+		cerr << "not a depth image: " << fname << endl;
+		return false;
+	}
+
+	depthImg.create( height, width, CV_16SC1 );
+	if( !depthImg.isContinuous() ){
+		depthImg.release();
+		depthImg.create( height, width, CV_16SC1 );
+	}
+
+	if( !decodeDepthImage( file.data(), file.size(), depthImg.ptr<int16_t>(0), width, height ) ){
+		cerr << "corrupt depth image " << fname << endl;
+		return false;
+	}
+
+	return true;
+}
+
+int loadDepthTo3D( const char* fname, Mat& img3D, const float* depth_intrinsic, int max_z ){
+
+	MappedFile file;
+	if( !file.open( fname ) ){
+		cerr << "could not open file " << fname << endl;
+		return -1;
+	}
+
+	int valid_pixels = decodeDepthTo3D( file.data(), file.size(), img3D, depth_intrinsic, max_z );
+	if( valid_pixels < 0 )
+		cerr << "corrupt depth image " << fname << endl;
+
+	return valid_pixels;
+
+}
+
+bool saveDepthImageCompressed( const Mat& depthImg, const char* fname ){
+
+	if( depthImg.type() != CV_16SC1 )
+		return false;
+
+	Mat depth = depthImg.isContinuous() ? depthImg : depthImg.clone();
+
+	std::vector< char > data;
+	encodeDepthImage( depth.ptr<int16_t>(0), depth.cols, depth.rows, data );
+
+	FILE* pFile = fopen( fname, "wb" );
+	if( !pFile ){
+		cerr << "could not write file " << fname << endl;
+		return false;
+	}
+
+	bool success = ( fwrite( &data[0], 1, data.size(), pFile ) == data.size() );
+	success &= ( fclose( pFile ) == 0 );
+	return success;
+
+}
+
+bool loadDepthCalibration( const std::string& fname, float* depth_intrinsic ){
+
+	ifstream is(fname.c_str());
+	if (!is)
+		return false;
+
+	//read intrinsics only
+	for(int i =0; i<9; ++i)	is >> depth_intrinsic[i];
+	return !is.fail();
+
+}
+
+std::string depthCalibrationFile( const std::string& depth_fname ){
+
+	//should be in the same directory as the depth image!
+	string cal_filename = depth_fname.substr(0,depth_fname.find_last_of("/")+1);
+	cal_filename += "depth.cal";
+	return cal_filename;
+
+}
+
+std::string groundTruthFile( const std::string& depth_fname ){
+
+	string pose_filename(depth_fname.substr(0,depth_fname.find_last_of('_')));
+	pose_filename += "_pose.bin";
+	return pose_filename;
+
+}
+
+bool loadGroundTruth( const std::string& fname, float* pose ){
+
+	FILE* pFile = fopen(fname.c_str(), "rb");
+	if(!pFile)
+		return false;
+
+	bool have_gt = ( fread( pose, sizeof(float), POSE_SIZE, pFile) == POSE_SIZE );
+	fclose(pFile);
+	return have_gt;
+
+}
+
+int depthTo3D( const Mat& depthImg, Mat& img3D, const float* depth_intrinsic, int max_z ){
+
+	img3D.create( depthImg.rows, depthImg.cols, CV_32FC3 );
+
+	int valid_pixels = 0;
+
+	//get 3D from depth
+	for(int y = 0; y < img3D.rows; y++)
+	{
+		Vec3f* img3Di = img3D.ptr<Vec3f>(y);
+		const int16_t* depthImgi = depthImg.ptr<int16_t>(y);
+
+		for(int x = 0; x < img3D.cols; x++){
+
+			float d = (float)depthImgi[x];
+
+			if ( d < max_z && d > 0 ){
+
+				valid_pixels++;
+
+				img3Di[x][0] = d * (float(x) - depth_intrinsic[2])/depth_intrinsic[0];
+				img3Di[x][1] = d * (float(y) - depth_intrinsic[5])/depth_intrinsic[4];
+				img3Di[x][2] = d;
+
+			}
+			else{
+
+				img3Di[x] = 0;
+			}
+
+		}
+	}
+
+	return valid_pixels;
+
+}
+
+static bool endsWith( const std::string& s, const std::string& suffix ){
+
+	return s.size() >= suffix.size() && s.compare( s.size()-suffix.size(), suffix.size(), suffix ) == 0;
+
+}
+
+static void collectDirectory( const std::string& dir, std::vector< std::string >& files ){
+
+	std::vector< std::string > entries;
+
+#ifndef _WIN32
+	DIR* d = opendir( dir.c_str() );
+	if(!d)
+		return;
+
+	struct dirent* e;
+	while( (e = readdir(d)) != NULL ){
+
+		std::string name = e->d_name;
+		if( name == "." || name == ".." )
+			continue;
+		entries.push_back( name );
+
+	}
+	closedir(d);
+#else
+	WIN32_FIND_DATAA found;
+	HANDLE h = FindFirstFileA( (dir + "/*").c_str(), &found );
+	if( h == INVALID_HANDLE_VALUE )
+		return;
+
+	do{
+
+		std::string name = found.cFileName;
+		if( name == "." || name == ".." )
+			continue;
+		entries.push_back( name );
+
+	} while( FindNextFileA( h, &found ) );
+	FindClose( h );
+#endif
+
+	//sorted, so that results come out in the same order on every run
+	sort( entries.begin(), entries.end() );
+
+	for(unsigned int i=0;i<entries.size();++i){
+
+		std::string full = dir + "/" + entries[i];
+		struct stat st;
+		if( stat( full.c_str(), &st ) != 0 )
+			continue;
+
+		if( S_ISDIR( st.st_mode ) )
+			collectDirectory( full, files );
+		else if( endsWith( entries[i], "_depth.bin" ) )
+			files.push_back( full );
+
+	}
+
+}
+
+bool collectDepthFiles( const std::string& path, std::vector< std::string >& files ){
+
+	struct stat st;
+	if( stat( path.c_str(), &st ) != 0 ){
+		cerr << "could not find " << path << endl;
+		return false;
+	}
+
+	if( S_ISDIR( st.st_mode ) ){
+
+		std::string dir = path;
+		while( dir.size() > 1 && ( dir[dir.size()-1] == '/' || dir[dir.size()-1] == '\\' ) )
+			dir.erase( dir.size()-1 );
+		collectDirectory( dir, files );
+		return true;
+
+	}
+
+	if( endsWith( path, "_depth.bin" ) ){
+
+		files.push_back( path );
+		return true;
+
+	}
+
+	//list of files, one per line
+	ifstream is( path.c_str() );
+	string line;
+	while( getline( is, line ) ){
+
+		while( !line.empty() && ( line[line.size()-1] == '\r' || line[line.size()-1] == ' ' ) )
+			line.erase( line.size()-1 );
+		if( !line.empty() && line[0] != '#' )
+			files.push_back( line );
+
+	}
+	return true;
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#ifndef DepthIO_H
+#define DepthIO_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "opencv2/core/core.hpp"
+
+// Run-length compressed depth images (*_depth.bin): int width, int height, then pairs of
+// runs until all pixels are covered: int no. of zero pixels, int no. of non-zero pixels
+// followed by their depth as int16. All values in the machine's byte order.
+
+// read-only view of a whole file, memory mapped where possible
+class MappedFile {
+
+public:
+
+	MappedFile();
+	~MappedFile();
+
+	bool open( const char* fname );
+	void close();
+
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+
+	const char* m_data;
+	size_t m_size;
+	bool m_mapped;
+	std::vector< char > m_buffer; //file contents if it could not be mapped
+
+	MappedFile( const MappedFile& );
+	MappedFile& operator=( const MappedFile& );
+
+};
+
+// reads the image size of an encoded depth image, false if the header is not valid
+bool depthImageSize( const void* data, size_t size, int& width, int& height );
+
+// decodes into a width*height buffer of the caller, returns false (leaving the buffer
+// partly written) if the size does not match or the runs do not fit the image or the data
+bool decodeDepthImage( const void* data, size_t size, int16_t* depth, int width, int height );
+
+// decodes straight into the estimator's input, same as decoding followed by depthTo3D().
+// Returns the number of valid pixels, -1 if the data is not valid
+int decodeDepthTo3D( const void* data, size_t size, cv::Mat& img3D, const float* depth_intrinsic, int max_z );
+
+// encodes a width*height depth image, data is replaced
+void encodeDepthImage( const int16_t* depth, int width, int height, std::vector< char >& data );
+
+// reads a run-length compressed depth image (*_depth.bin) into a CV_16SC1 image
+bool loadDepthImageCompressed( cv::Mat& depthImg, const char* fname );
+
+// reads a *_depth.bin file straight into the estimator's input, see decodeDepthTo3D()
+int loadDepthTo3D( const char* fname, cv::Mat& img3D, const float* depth_intrinsic, int max_z );
+
+// writes a CV_16SC1 image as *_depth.bin
+bool saveDepthImageCompressed( const cv::Mat& depthImg, const char* fname );
+
+// reads the 3x3 intrinsic matrix (row major) from a depth.cal file
+bool loadDepthCalibration( const std::string& fname, float* depth_intrinsic );
+
+// depth.cal file belonging to a depth image (expected in the same folder)
+std::string depthCalibrationFile( const std::string& depth_fname );
+
+// *_pose.bin ground truth file belonging to a depth image
+std::string groundTruthFile( const std::string& depth_fname );
+
+// reads POSE_SIZE floats of ground truth, returns false if the file does not exist
+bool loadGroundTruth( const std::string& fname, float* pose );
+
+// back-projects a CV_16SC1 depth image into a CV_32FC3 image (x,y,z for each pixel),
+// pixels further away than max_z or without depth are set to 0. Returns the number of valid pixels.
+int depthTo3D( const cv::Mat& depthImg, cv::Mat& img3D, const float* depth_intrinsic, int max_z );
+
+// collects all *_depth.bin files below a directory (recursively, sorted), a single depth file,
+// or the files listed in a text file (one per line)
+bool collectDepthFiles( const std::string& path, std::vector< std::string >& files );
+
+#endif
@@ -0,0 +1,294 @@
+#include "DepthRecording.h"
+
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+static const char RECORDING_MAGIC[4] = { 'H', 'P', 'D', 'R' };
+static const char INDEX_MAGIC[4] = { 'H', 'P', 'D', 'I' };
+static const int RECORDING_VERSION = 1;
+
+static const size_t HEADER_SIZE = 4 + 3*sizeof(int);
+static const size_t FRAME_HEADER_SIZE = sizeof(double) + sizeof(int);
+static const size_t INDEX_ENTRY_SIZE = sizeof(double) + sizeof(int64_t);
+static const size_t TRAILER_SIZE = sizeof(int64_t) + sizeof(int) + 4;
+
+// cuts the file off at size, for the next write to continue there
+static bool truncateFile( FILE* file, int64_t size ){
+
+	if( fflush( file ) != 0 )
+		return false;
+
+#ifndef _WIN32
+	return ftruncate( fileno( file ), (off_t)size ) == 0 && fseeko( file, (off_t)size, SEEK_SET ) == 0;
+#else
+	return _chsize_s( _fileno( file ), size ) == 0 && _fseeki64( file, size, SEEK_SET ) == 0;
+#endif
+
+}
+
+DepthRecorder::DepthRecorder() : m_file(NULL), m_width(0), m_height(0), m_position(0) { }
+
+DepthRecorder::~DepthRecorder(){
+
+	close();
+
+}
+
+bool DepthRecorder::open( const char* fname, int width, int height ){
+
+	close();
+
+	m_file = fopen( fname, "wb" );
+	if( !m_file ){
+		cerr << "could not write file " << fname << endl;
+		return false;
+	}
+
+	m_width = width;
+	m_height = height;
+	m_position = 0;
+	m_timestamps.clear();
+	m_positions.clear();
+
+	int header[3] = { RECORDING_VERSION, width, height };
+	bool success = ( fwrite( RECORDING_MAGIC, 1, 4, m_file ) == 4 ) &&
+				   ( fwrite( header, sizeof(int), 3, m_file ) == 3 );
+	m_position = HEADER_SIZE;
+
+	if( !success ){
+		fclose( m_file );
+		m_file = NULL;
+	}
+	return success;
+
+}
+
+bool DepthRecorder::write( const Mat& depth, double timestamp ){
+
+	if( !m_file || depth.rows != m_height || depth.cols != m_width || depth.elemSize() != sizeof(int16_t) )
+		return false;
+
+	const Mat* src = &depth;
+	if( !depth.isContinuous() ){
+		depth.copyTo( m_continuous );
+		src = &m_continuous;
+	}
+
+	//the 16 bits are stored as they are, unsigned depth comes back unchanged
+	encodeDepthImage( (const int16_t*)src->data, m_width, m_height, m_buffer );
+
+	int size = m_buffer.size();
+	bool success = ( fwrite( &timestamp, sizeof(double), 1, m_file ) == 1 ) &&
+				   ( fwrite( &size, sizeof(int), 1, m_file ) == 1 ) &&
+				   ( fwrite( &m_buffer[0], 1, size, m_file ) == (size_t)size );
+
+	if( !success ){
+
+		//drop what was written of the frame and stop, the index then still matches the file
+		cerr << "could not write the recording, stopped after " << frames() << " frames" << endl;
+		if( !truncateFile( m_file, m_position ) ){
+			fclose( m_file );
+			m_file = NULL;
+			return false;
+		}
+		close();
+		return false;
+
+	}
+
+	m_timestamps.push_back( timestamp );
+	m_positions.push_back( m_position );
+	m_position += FRAME_HEADER_SIZE + size;
+
+	return true;
+
+}
+
+bool DepthRecorder::close(){
+
+	if( !m_file )
+		return true;
+
+	int64_t index_position = m_position;
+	bool success = true;
+
+	for(unsigned int i=0; i<m_timestamps.size() && success; ++i){
+
+		success &= ( fwrite( &m_timestamps[i], sizeof(double), 1, m_file ) == 1 );
+		success &= ( fwrite( &m_positions[i], sizeof(int64_t), 1, m_file ) == 1 );
+
+	}
+
+	int frames = m_timestamps.size();
+	success &= ( fwrite( &index_position, sizeof(int64_t), 1, m_file ) == 1 );
+	success &= ( fwrite( &frames, sizeof(int), 1, m_file ) == 1 );
+	success &= ( fwrite( INDEX_MAGIC, 1, 4, m_file ) == 4 );
+
+	success &= ( fclose( m_file ) == 0 );
+	m_file = NULL;
+
+	return success;
+
+}
+
+
+DepthRecording::DepthRecording() : m_width(0), m_height(0), m_indexed(false) { }
+
+bool DepthRecording::open( const char* fname ){
+
+	close();
+
+	if( !m_file.open( fname ) ){
+		cerr << "could not open file " << fname << endl;
+		return false;
+	}
+
+	const char* data = m_file.data();
+	int header[3];
+
+	if( m_file.size() < HEADER_SIZE || memcmp( data, RECORDING_MAGIC, 4 ) != 0 ){
+		cerr << "not a depth recording: " << fname << endl;
+		close();
+		return false;
+	}
+
+	memcpy( header, data + 4, sizeof(header) );
+	if( header[0] != RECORDING_VERSION || header[1] <= 0 || header[2] <= 0 ){
+		cerr << "unsupported depth recording: " << fname << endl;
+		close();
+		return false;
+	}
+
+	m_width = header[1];
+	m_height = header[2];
+
+	m_indexed = read_index();
+	if( !m_indexed ){
+		cerr << "no index in " << fname << ", searching the frames" << endl;
+		scan_frames();
+	}
+
+	return true;
+
+}
+
+void DepthRecording::close(){
+
+	m_file.close();
+	m_width = m_height = 0;
+	m_indexed = false;
+	m_timestamps.clear();
+	m_positions.clear();
+
+}
+
+bool DepthRecording::read_index(){
+
+	size_t size = m_file.size();
+	const char* data = m_file.data();
+
+	if( size < HEADER_SIZE + TRAILER_SIZE )
+		return false;
+
+	const char* trailer = data + size - TRAILER_SIZE;
+	if( memcmp( trailer + sizeof(int64_t) + sizeof(int), INDEX_MAGIC, 4 ) != 0 )
+		return false;
+
+	int64_t index_position;
+	int frames;
+	memcpy( &index_position, trailer, sizeof(int64_t) );
+	memcpy( &frames, trailer + sizeof(int64_t), sizeof(int) );
+
+	if( frames < 0 || index_position < (int64_t)HEADER_SIZE ||
+		(uint64_t)index_position + (uint64_t)frames*INDEX_ENTRY_SIZE != size - TRAILER_SIZE )
+		return false;
+
+	m_timestamps.resize( frames );
+	m_positions.resize( frames );
+
+	const char* entry = data + index_position;
+	for(int i=0; i<frames; ++i, entry += INDEX_ENTRY_SIZE){
+
+		memcpy( &m_timestamps[i], entry, sizeof(double) );
+		memcpy( &m_positions[i], entry + sizeof(double), sizeof(int64_t) );
+
+		if( m_positions[i] < (int64_t)HEADER_SIZE || m_positions[i] + FRAME_HEADER_SIZE > (uint64_t)index_position ){
+			m_timestamps.clear();
+			m_positions.clear();
+			return false;
+		}
+
+	}
+
+	return true;
+
+}
+
+void DepthRecording::scan_frames(){
+
+	size_t size = m_file.size();
+	const char* data = m_file.data();
+	size_t position = HEADER_SIZE;
+
+	//up to the first frame that was not written completely
+	while( size - position >= FRAME_HEADER_SIZE ){
+
+		double timestamp;
+		int frame_size;
+		memcpy( &timestamp, data + position, sizeof(double) );
+		memcpy( &frame_size, data + position + sizeof(double), sizeof(int) );
+
+		if( frame_size < 0 || (size_t)frame_size > size - position - FRAME_HEADER_SIZE )
+			break;
+
+		m_timestamps.push_back( timestamp );
+		m_positions.push_back( position );
+		position += FRAME_HEADER_SIZE + frame_size;
+
+	}
+
+}
+
+double DepthRecording::duration() const {
+
+	return m_timestamps.empty() ? 0 : m_timestamps.back() - m_timestamps.front();
+
+}
+
+unsigned int DepthRecording::find( double timestamp ) const {
+
+	return lower_bound( m_timestamps.begin(), m_timestamps.end(), timestamp ) - m_timestamps.begin();
+
+}
+
+bool DepthRecording::read( unsigned int frame, Mat& depth ) const {
+
+	if( frame >= m_positions.size() )
+		return false;
+
+	const char* record = m_file.data() + m_positions[frame];
+	int frame_size;
+	memcpy( &frame_size, record + sizeof(double), sizeof(int) );
+
+	if( frame_size < 0 || (uint64_t)m_positions[frame] + FRAME_HEADER_SIZE + frame_size > m_file.size() )
+		return false;
+
+	depth.create( m_height, m_width, CV_16UC1 );
+	if( !depth.isContinuous() ){
+		depth.release();
+		depth.create( m_height, m_width, CV_16UC1 );
+	}
+
+	return decodeDepthImage( record + FRAME_HEADER_SIZE, frame_size, (int16_t*)depth.data, m_width, m_height );
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#ifndef DepthRecording_H
+#define DepthRecording_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "DepthIO.h"
+
+// Depth streams with timestamps in one seekable file. Each frame is stored in the
+// run-length format of the *_depth.bin files, an index at the end of the file gives
+// the timestamp and position of every frame:
+//
+//   header:  "HPDR", int version, int width, int height
+//   frames:  double timestamp (s), int size, size bytes in *_depth.bin format
+//   index:   double timestamp, int64 position of the frame, for each frame
+//   trailer: int64 position of the index, int no. of frames, "HPDI"
+//
+// A recording that was not closed (no index) can still be read, the frames are found
+// by walking through the file.
+
+// writes a recording, frame by frame
+class DepthRecorder {
+
+public:
+
+	DepthRecorder();
+	~DepthRecorder();
+
+	bool open( const char* fname, int width, int height );
+
+	//depth: width x height, CV_16UC1 or CV_16SC1. If writing fails the recording is
+	//closed with the frames written so far
+	bool write( const cv::Mat& depth, double timestamp );
+
+	//writes the index, also done by the destructor
+	bool close();
+
+	bool is_open() const { return m_file != NULL; }
+	unsigned int frames() const { return m_timestamps.size(); }
+	int64_t bytes() const { return m_position; }
+
+private:
+
+	FILE* m_file;
+	int m_width;
+	int m_height;
+	int64_t m_position; //bytes written so far
+
+	std::vector< double > m_timestamps;
+	std::vector< int64_t > m_positions;
+	std::vector< char > m_buffer; //encoded frame
+	cv::Mat m_continuous; //copy of non-continuous input
+
+	DepthRecorder( const DepthRecorder& );
+	DepthRecorder& operator=( const DepthRecorder& );
+
+};
+
+// reads a recording, frames can be read in any order
+class DepthRecording {
+
+public:
+
+	DepthRecording();
+
+	bool open( const char* fname );
+	void close();
+
+	unsigned int frames() const { return m_timestamps.size(); }
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+	double timestamp( unsigned int frame ) const { return m_timestamps[frame]; }
+
+	//time between the first and the last frame
+	double duration() const;
+
+	//first frame at or after timestamp, frames() if there is none
+	unsigned int find( double timestamp ) const;
+
+	//decodes a frame into a CV_16UC1 image
+	bool read( unsigned int frame, cv::Mat& depth ) const;
+
+	//false if the index was missing and the frames had to be searched
+	bool indexed() const { return m_indexed; }
+
+private:
+
+	bool read_index();
+	void scan_frames();
+
+	MappedFile m_file;
+	int m_width;
+	int m_height;
+	bool m_indexed;
+
+	std::vector< double > m_timestamps;
+	std::vector< int64_t > m_positions;
+
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "HeadTracker.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+static bool by_id( const TrackedHead& a, const TrackedHead& b ){ return a.id < b.id; }
+
+static float centre_distance2( const Vec<float,POSE_SIZE>& a, const Vec<float,POSE_SIZE>& b ){
+
+	float d = 0;
+	for(int n=0;n<3;++n)
+		d += (a[n]-b[n])*(a[n]-b[n]);
+	return d;
+
+}
+
+HeadTracker::HeadTracker( CRForestEstimator* estimator,
+						  const EstimationParams& params,
+						  const TrackerParams& tparams ){
+
+	m_estimator = estimator;
+	m_params = params;
+	m_tparams = tparams;
+
+	m_frames = 0;
+	m_full_detections = 0;
+	m_failed_verifications = 0;
+
+	reset();
+
+}
+
+void HeadTracker::reset(){
+
+	m_heads.clear();
+	m_next_id = 0;
+	m_last_time = 0;
+	m_dt = 0;
+	m_since_detection = 0;
+	m_force_detection = true;
+
+}
+
+const std::vector< TrackedHead >& HeadTracker::update( const Mat& im3D, double timestamp ){
+
+	m_dt = m_frames > 0 ? MAX( 0.0, timestamp - m_last_time ) : 0.0;
+	m_last_time = timestamp;
+	m_frames++;
+
+	//constant velocity prediction
+	for(unsigned int h=0;h<m_heads.size();++h)
+		for(int n=0;n<POSE_SIZE;++n)
+			m_heads[h].pose[n] += m_heads[h].velocity[n]*(float)m_dt;
+
+	bool full = m_force_detection ||
+				m_heads.empty() ||
+				++m_since_detection >= m_tparams.detect_every;
+
+	if( !full ){
+
+		//all heads have to be confirmed, otherwise the whole frame is searched again
+		m_verified.resize( m_heads.size() );
+		for(unsigned int h=0; h<m_heads.size() && !full; ++h){
+
+			if( !verify( im3D, m_heads[h], m_verified[h] ) ){
+				m_failed_verifications++;
+				full = true;
+			}
+
+		}
+
+		if( !full )
+			for(unsigned int h=0;h<m_heads.size();++h)
+				measured( m_heads[h], m_verified[h], m_dt );
+
+	}
+
+	if( full )
+		detect( im3D );
+
+	return m_heads;
+
+}
+
+bool HeadTracker::verify( const Mat& im3D, const TrackedHead& head, HeadPose& found ){
+
+	if( head.predicted || head.pose[2] <= 0 )
+		return false;
+
+	//window around the projection of the predicted head centre
+	float z = head.pose[2];
+	int u = cvRound( head.pose[0]*m_tparams.fx/z + m_tparams.cx );
+	int v = cvRound( head.pose[1]*m_tparams.fy/z + m_tparams.cy );
+	int half_w = cvRound( m_tparams.roi_margin*AVG_FACE_DIAMETER*m_tparams.fx/z );
+	int half_h = cvRound( m_tparams.roi_margin*AVG_FACE_DIAMETER*m_tparams.fy/z );
+
+	int x0 = MAX( 0, u-half_w ), x1 = MIN( im3D.cols, u+half_w );
+	int y0 = MAX( 0, v-half_h ), y1 = MIN( im3D.rows, v+half_h );
+	if( x1 <= x0 || y1 <= y0 )
+		return false;
+
+	EstimationParams params = m_params;
+	params.max_no_faces = 1;
+
+	m_estimator->estimate_poses( im3D( Rect( x0, y0, x1-x0, y1-y0 ) ), m_found, params, &m_workspace );
+
+	if( m_found.empty() ||
+		m_found[0].confidence < m_tparams.min_confidence ||
+		centre_distance2( m_found[0].pose, head.pose ) > m_tparams.match_distance*m_tparams.match_distance )
+		return false;
+
+	found = m_found[0];
+	return true;
+
+}
+
+void HeadTracker::measured( TrackedHead& head, const HeadPose& found, double dt ){
+
+	//head.pose holds the prediction, so this is the prediction error
+	if( dt > 0 ){
+
+		float s = m_tparams.velocity_smoothing;
+		for(int n=0;n<POSE_SIZE;++n)
+			head.velocity[n] += (1.f-s)*( found.pose[n] - head.pose[n] )/(float)dt;
+
+	}
+
+	head.pose = found.pose;
+	head.votes = found.votes;
+	head.confidence = found.confidence;
+	head.predicted = false;
+	head.missed = 0;
+
+}
+
+void HeadTracker::detect( const Mat& im3D ){
+
+	m_full_detections++;
+	m_since_detection = 0;
+	m_force_detection = false;
+
+	EstimationParams params = m_params;
+	params.max_no_faces = m_tparams.max_heads;
+
+	m_estimator->estimate_poses( im3D, m_found, params, &m_workspace );
+
+	//greedy assignment, closest pairs first
+	float max_d2 = m_tparams.match_distance*m_tparams.match_distance;
+	vector< bool > head_used( m_heads.size(), false );
+	vector< bool > found_used( m_found.size(), false );
+
+	while(true){
+
+		int best_h = -1, best_f = -1;
+		float best_d2 = max_d2;
+
+		for(unsigned int h=0;h<m_heads.size();++h){
+			if( head_used[h] )
+				continue;
+			for(unsigned int f=0;f<m_found.size();++f){
+
+				if( found_used[f] )
+					continue;
+
+				float d2 = centre_distance2( m_heads[h].pose, m_found[f].pose );
+				if( d2 <= best_d2 ){
+					best_d2 = d2;
+					best_h = h;
+					best_f = f;
+				}
+
+			}
+		}
+
+		if( best_h < 0 )
+			break;
+
+		measured( m_heads[best_h], m_found[best_f], m_dt );
+		head_used[best_h] = true;
+		found_used[best_f] = true;
+
+	}
+
+	//heads not seen keep their prediction for a few frames
+	vector< TrackedHead > kept;
+	for(unsigned int h=0;h<m_heads.size();++h){
+
+		if( !head_used[h] ){
+			m_heads[h].predicted = true;
+			if( ++m_heads[h].missed > m_tparams.max_missed )
+				continue;
+		}
+		kept.push_back( m_heads[h] );
+
+	}
+
+	//new heads, the found ones are sorted by decreasing votes
+	for(unsigned int f=0; f<m_found.size() && (int)kept.size() < m_tparams.max_heads; ++f){
+
+		if( found_used[f] )
+			continue;
+
+		TrackedHead head;
+		head.id = m_next_id++;
+		head.pose = m_found[f].pose;
+		head.velocity = Vec<float,POSE_SIZE>();
+		head.votes = m_found[f].votes;
+		head.confidence = m_found[f].confidence;
+		head.predicted = false;
+		head.missed = 0;
+		kept.push_back( head );
+
+	}
+
+	sort( kept.begin(), kept.end(), by_id );
+	m_heads.swap( kept );
+
+	//an extrapolated head has to be found again by a full detection
+	for(unsigned int h=0;h<m_heads.size();++h)
+		if( m_heads[h].predicted )
+			m_force_detection = true;
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#ifndef HeadTracker_H
+#define HeadTracker_H
+
+#include <vector>
+#include "CRForestEstimator.h"
+
+struct TrackedHead {
+
+	int id; //stays the same as long as the head is tracked
+	cv::Vec<float,POSE_SIZE> pose; //x,y,z,pitch,yaw,roll
+	cv::Vec<float,POSE_SIZE> velocity; //per second
+	unsigned int votes;
+	float confidence; //as in HeadPose
+	bool predicted; //not seen in this frame, pose is extrapolated
+	int missed; //frames in a row the head was not seen
+
+};
+
+struct TrackerParams {
+
+	TrackerParams() :
+		detect_every(10),
+		min_confidence(1.5f),
+		match_distance(150.f),
+		roi_margin(1.2f),
+		max_missed(5),
+		max_heads(4),
+		velocity_smoothing(0.5f),
+		fx(571.26f), fy(571.26f), cx(320.f), cy(240.f) { }
+
+	int detect_every; //full detection at least every n frames, 1 = on every frame
+	float min_confidence; //full detection as soon as a head is verified with less
+	float match_distance; //mm, max distance between predicted and measured head centre
+	float roi_margin; //half size of the verification window, in face diameters
+	int max_missed; //frames a head is extrapolated before it is dropped
+	int max_heads;
+	float velocity_smoothing; //0 = last measured velocity only, towards 1 = smoother
+
+	//depth camera intrinsics, to find the image window around a predicted head (demo defaults)
+	float fx, fy, cx, cy;
+
+};
+
+// Tracks heads over frames with stable ids and a constant velocity model. The forest runs
+// on the whole frame only every detect_every frames, on the other frames every head is
+// just verified in a small window around its predicted position. A failed verification
+// or a drop in confidence brings the full detection forward.
+class HeadTracker {
+
+public:
+
+	HeadTracker( CRForestEstimator* estimator,
+				 const EstimationParams& params,
+				 const TrackerParams& tparams = TrackerParams() );
+
+	//timestamp in seconds, returns the heads sorted by id
+	const std::vector< TrackedHead >& update( const cv::Mat& im3D, double timestamp );
+
+	const std::vector< TrackedHead >& heads() const { return m_heads; }
+
+	void reset();
+	void force_detection(){ m_force_detection = true; }
+
+	void set_params( const EstimationParams& params ){ m_params = params; }
+	void set_tracker_params( const TrackerParams& tparams ){ m_tparams = tparams; }
+
+	long frames() const { return m_frames; }
+	long full_detections() const { return m_full_detections; }
+	long skipped_detections() const { return m_frames - m_full_detections; }
+	long failed_verifications() const { return m_failed_verifications; }
+
+private:
+
+	//estimates the head in a window around its predicted pose
+	bool verify( const cv::Mat& im3D, const TrackedHead& head, HeadPose& found );
+
+	void detect( const cv::Mat& im3D );
+	void measured( TrackedHead& head, const HeadPose& found, double dt );
+
+	CRForestEstimator* m_estimator;
+	EstimationParams m_params;
+	TrackerParams m_tparams;
+
+	std::vector< TrackedHead > m_heads;
+	int m_next_id;
+
+	double m_last_time;
+	double m_dt;
+	int m_since_detection;
+	bool m_force_detection;
+
+	long m_frames;
+	long m_full_detections;
+	long m_failed_verifications;
+
+	EstimationWorkspace m_workspace;
+	std::vector< HeadPose > m_found;
+	std::vector< HeadPose > m_verified;
+
+};
+
+#endif
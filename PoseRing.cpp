@@ -0,0 +1,305 @@
+#include "PoseRing.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+
+using namespace std;
+
+static std::string shm_name( const char* name ){
+
+	//POSIX wants exactly one leading slash
+	return name[0] == '/' ? std::string( name ) : "/" + std::string( name );
+
+}
+
+static size_t ring_size( unsigned int capacity ){
+
+	return sizeof(PoseRingHeader) + capacity*sizeof(PoseRingSlot);
+
+}
+
+PoseRing::PoseRing() : m_header(0), m_slots(0), m_size(0) { }
+
+PoseRing::~PoseRing(){
+
+	close();
+
+}
+
+double PoseRing::now(){
+
+#ifndef _WIN32
+	timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec + 1e-9*t.tv_nsec;
+#else
+	return 0;
+#endif
+
+}
+
+bool PoseRing::create( const char* name, unsigned int capacity ){
+
+	close();
+
+#ifndef _WIN32
+	if( capacity == 0 )
+		return false;
+
+	m_name = shm_name( name );
+	m_size = ring_size( capacity );
+
+	//a ring left behind by a writer that crashed is replaced
+	shm_unlink( m_name.c_str() );
+
+	int fd = shm_open( m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644 );
+	if( fd < 0 ){
+		cerr << "could not create shared memory " << m_name << endl;
+		return false;
+	}
+
+	void* p = MAP_FAILED;
+	if( ftruncate( fd, m_size ) == 0 )
+		p = mmap( NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	::close( fd );
+
+	if( p == MAP_FAILED ){
+		cerr << "could not map shared memory " << m_name << endl;
+		shm_unlink( m_name.c_str() );
+		return false;
+	}
+
+	//new shared memory is zeroed, so all slots start with sequence 0 (never written)
+	m_header = (PoseRingHeader*)p;
+	m_slots = (PoseRingSlot*)( (char*)p + sizeof(PoseRingHeader) );
+
+	m_header->version = POSE_RING_VERSION;
+	m_header->capacity = capacity;
+	m_header->record_size = sizeof(PoseRecord);
+	m_header->written = 0;
+	m_header->last_frame = -1;
+	m_header->closed = 0;
+
+	//readers check the magic last
+	atomic_fence();
+	memcpy( m_header->magic, POSE_RING_MAGIC, 4 );
+
+	return true;
+#else
+	cerr << "shared memory output is not supported on this platform" << endl;
+	return false;
+#endif
+
+}
+
+void PoseRing::close(){
+
+	if( !m_header )
+		return;
+
+#ifndef _WIN32
+	atomic_store( &m_header->closed, 1 );
+	munmap( m_header, m_size );
+	shm_unlink( m_name.c_str() );
+#endif
+
+	m_header = 0;
+	m_slots = 0;
+
+}
+
+void PoseRing::write_frame( long frame, const PoseRecord* heads, int count ){
+
+	if( !m_header )
+		return;
+
+	double timestamp = now();
+	long n = m_header->written;
+
+	for(int i=0;i<count;++i, ++n){
+
+		PoseRingSlot& slot = m_slots[ n % m_header->capacity ];
+
+		//odd while the record changes, the fence keeps the record writes behind it
+		atomic_store( &slot.seq, 2*n+1 );
+		atomic_fence();
+
+		slot.record = heads[i];
+		slot.record.frame = frame;
+		slot.record.timestamp = timestamp;
+		slot.record.heads = count;
+
+		atomic_store( &slot.seq, 2*n+2 );
+
+	}
+
+	//whole frames become visible at once
+	atomic_store( &m_header->written, n );
+	atomic_store( &m_header->last_frame, frame );
+
+}
+
+
+PoseRingReader::PoseRingReader() : m_header(0), m_slots(0), m_size(0), m_next(0), m_lost(0), m_frame(-1) { }
+
+PoseRingReader::~PoseRingReader(){
+
+	close();
+
+}
+
+bool PoseRingReader::open( const char* name ){
+
+	close();
+
+#ifndef _WIN32
+	std::string path = shm_name( name );
+
+	int fd = shm_open( path.c_str(), O_RDONLY, 0 );
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	void* p = MAP_FAILED;
+	if( fstat( fd, &st ) == 0 && (size_t)st.st_size >= sizeof(PoseRingHeader) )
+		p = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	::close( fd );
+
+	if( p == MAP_FAILED )
+		return false;
+
+	const PoseRingHeader* header = (const PoseRingHeader*)p;
+	atomic_fence();
+
+	if( memcmp( header->magic, POSE_RING_MAGIC, 4 ) != 0 || header->version != POSE_RING_VERSION ||
+		header->record_size != (int32_t)sizeof(PoseRecord) || header->capacity <= 0 ||
+		ring_size( header->capacity ) > (size_t)st.st_size ){
+
+		cerr << "not a pose ring or a different version: " << path << endl;
+		munmap( p, st.st_size );
+		return false;
+	}
+
+	m_header = header;
+	m_slots = (const PoseRingSlot*)( (const char*)p + sizeof(PoseRingHeader) );
+	m_size = st.st_size;
+	m_next = atomic_load( &m_header->written );
+	m_frame = atomic_load( &m_header->last_frame );
+	m_lost = 0;
+
+	return true;
+#else
+	return false;
+#endif
+
+}
+
+void PoseRingReader::close(){
+
+	if( !m_header )
+		return;
+
+#ifndef _WIN32
+	munmap( (void*)m_header, m_size );
+#endif
+
+	m_header = 0;
+	m_slots = 0;
+
+}
+
+bool PoseRingReader::read_slot( long n, PoseRecord& record ) const {
+
+	const PoseRingSlot& slot = m_slots[ n % m_header->capacity ];
+	long complete = 2*n+2;
+
+	if( atomic_load( &slot.seq ) != complete )
+		return false;
+
+	memcpy( &record, (const void*)&slot.record, sizeof(PoseRecord) );
+
+	//the copy is only valid if the writer did not start on the slot meanwhile
+	atomic_fence();
+	return atomic_load( &slot.seq ) == complete;
+
+}
+
+bool PoseRingReader::poll( PoseRecord& record ){
+
+	if( !m_header )
+		return false;
+
+	long capacity = m_header->capacity;
+
+	for(;;){
+
+		long written = atomic_load( &m_header->written );
+		if( m_next >= written )
+			return false;
+
+		//a full ring behind, the oldest records are gone
+		if( written - m_next > capacity ){
+			m_lost += written - capacity - m_next;
+			m_next = written - capacity;
+		}
+
+		if( read_slot( m_next, record ) ){
+			m_next++;
+			return true;
+		}
+
+		//overwritten while it was copied
+		m_lost++;
+		m_next++;
+
+	}
+
+}
+
+bool PoseRingReader::latest( std::vector< PoseRecord >& heads ){
+
+	heads.clear();
+	if( !m_header )
+		return false;
+
+	//the records of last_frame are all counted in written once it is set
+	long frame = atomic_load( &m_header->last_frame );
+	long written = atomic_load( &m_header->written );
+
+	if( frame == m_frame )
+		return false;
+
+	m_frame = frame;
+	m_next = written;
+
+	//backwards from the newest record, a newer frame may have been appended meanwhile
+	PoseRecord record;
+	long oldest = max( 0L, written - (long)m_header->capacity );
+
+	for(long n=written-1; n>=oldest; --n){
+
+		if( !read_slot( n, record ) || record.frame < frame )
+			break;
+
+		if( record.frame == frame ){
+			heads.push_back( record );
+			if( (int)heads.size() == record.heads )
+				break;
+		}
+
+	}
+
+	reverse( heads.begin(), heads.end() );
+	return true;
+
+}
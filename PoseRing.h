@@ -0,0 +1,129 @@
+#pragma once
+
+#ifndef PoseRing_H
+#define PoseRing_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Atomic.h"
+
+// Head poses for consumers on the same machine, through POSIX shared memory: one writer
+// appends a fixed-layout record per head to a ring, any number of readers poll it without
+// locks or system calls. Each slot carries a sequence number (odd while it is written), so
+// a reader that falls a full ring behind notices the overwritten records and skips them.
+// Readers only depend on this file, PoseRing.cpp and Atomic.h, not on OpenCV.
+
+#define POSE_RING_MAGIC "HPSR"
+#define POSE_RING_VERSION 1
+
+// one head of one frame
+struct PoseRecord {
+
+	int64_t frame; //frame number of the writer
+	double timestamp; //seconds, PoseRing::now() of the writer when the frame was written
+	int32_t id; //user id, the position in the frame without tracking
+	int32_t heads; //no. of heads in this frame
+	float pose[6]; //x,y,z (mm), pitch,yaw,roll (degrees)
+	float confidence; //votes relative to the head threshold, >= 1
+
+};
+
+// shared layout, the writer and the readers have to be built for the same architecture
+struct PoseRingHeader {
+
+	char magic[4];
+	int32_t version;
+	int32_t capacity; //records
+	int32_t record_size;
+	volatile long written; //records written so far, record n is in slot n % capacity
+	volatile long last_frame; //last frame written completely, also frames without heads (-1 = none yet)
+	volatile long closed; //set when the writer goes away
+	char padding[24];
+
+};
+
+struct PoseRingSlot {
+
+	volatile long seq; //2n+1 while record n is written, 2n+2 when it is complete
+	PoseRecord record;
+
+};
+
+// writer side, creates the shared memory
+class PoseRing {
+
+public:
+
+	PoseRing();
+	~PoseRing();
+
+	//name: shared memory object, e.g. "/head_pose"
+	bool create( const char* name, unsigned int capacity = 1024 );
+
+	//removes the shared memory, readers that have it open see closed()
+	void close();
+
+	bool is_open() const { return m_header != 0; }
+
+	//appends one record per head (frame, timestamp and heads are filled in)
+	void write_frame( long frame, const PoseRecord* heads, int count );
+
+	//monotonic clock shared by all processes, seconds
+	static double now();
+
+private:
+
+	PoseRingHeader* m_header;
+	PoseRingSlot* m_slots;
+	size_t m_size;
+	std::string m_name;
+
+	PoseRing( const PoseRing& );
+	PoseRing& operator=( const PoseRing& );
+
+};
+
+// reader side, any number per ring
+class PoseRingReader {
+
+public:
+
+	PoseRingReader();
+	~PoseRingReader();
+
+	//only records written after opening are read
+	bool open( const char* name );
+	void close();
+	bool is_open() const { return m_header != 0; }
+
+	//next record not read yet, false if there is none
+	bool poll( PoseRecord& record );
+
+	//all heads of the newest frame, skipping everything older. Empty if that frame had no heads.
+	//false if no frame was completed since the last call
+	bool latest( std::vector< PoseRecord >& heads );
+
+	long last_frame() const { return atomic_load( &m_header->last_frame ); }
+	bool closed() const { return atomic_load( &m_header->closed ) != 0; }
+
+	//records overwritten before they were read
+	long lost() const { return m_lost; }
+
+private:
+
+	bool read_slot( long n, PoseRecord& record ) const;
+
+	const PoseRingHeader* m_header;
+	const PoseRingSlot* m_slots;
+	size_t m_size;
+	long m_next; //next record to read
+	long m_lost;
+	long m_frame; //last frame returned by latest()
+
+	PoseRingReader( const PoseRingReader& );
+	PoseRingReader& operator=( const PoseRingReader& );
+
+};
+
+#endif
@@ -0,0 +1,478 @@
+#include "PoseServer.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#endif
+
+using namespace std;
+
+PoseServer::PoseServer() : m_listen_fd(-1), m_epoll_fd(-1), m_wake_fd(-1), m_max_pending(0), m_queue(64), m_running(false){
+
+	m_stop = 0;
+	m_subscribers = m_published = m_sent = m_skipped = m_dropped = m_truncated = 0;
+
+}
+
+PoseServer::~PoseServer(){
+
+	stop();
+
+}
+
+double PoseServer::now(){
+
+	timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec + 1e-9*t.tv_nsec;
+
+}
+
+#ifdef __linux__
+
+static void wake( int eventfd ){
+
+	uint64_t one = 1;
+	ssize_t r = write( eventfd, &one, sizeof(one) );
+	(void)r;
+
+}
+
+bool PoseServer::start( const char* address, unsigned int max_pending ){
+
+	if( m_running )
+		return false;
+
+	m_max_pending = max_pending;
+	m_unix_path.clear();
+
+	//a port: TCP on the loopback interface, host:port: TCP on that interface, anything else is a socket path
+	const char* colon = strrchr( address, ':' );
+	const char* port = colon ? colon+1 : address;
+	bool tcp = port[0] != 0 && strspn( port, "0123456789" ) == strlen( port );
+
+	if( tcp ){
+
+		//only local subscribers unless an interface is given, e.g. 0.0.0.0:7300 for all of them
+		string host = colon ? string( address, colon ) : string( "127.0.0.1" );
+
+		addrinfo hints, *found = 0;
+		memset( &hints, 0, sizeof(hints) );
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		if( getaddrinfo( host.c_str(), port, &hints, &found ) != 0 ){
+			cerr << "could not resolve " << host << endl;
+			return false;
+		}
+
+		m_listen_fd = socket( found->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		int on = 1;
+		setsockopt( m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+
+		bool bound = m_listen_fd >= 0 && ::bind( m_listen_fd, found->ai_addr, found->ai_addrlen ) == 0;
+		freeaddrinfo( found );
+
+		if( !bound ){
+			cerr << "could not listen on " << host << ":" << port << ": " << strerror( errno ) << endl;
+			stop();
+			return false;
+		}
+
+	}
+	else{
+
+		sockaddr_un sa;
+		memset( &sa, 0, sizeof(sa) );
+		sa.sun_family = AF_UNIX;
+		if( strlen( address ) >= sizeof(sa.sun_path) ){
+			cerr << "socket path too long: " << address << endl;
+			return false;
+		}
+		strcpy( sa.sun_path, address );
+
+		//left behind by a server that was not stopped
+		unlink( address );
+
+		m_listen_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+		if( m_listen_fd < 0 || ::bind( m_listen_fd, (sockaddr*)&sa, sizeof(sa) ) != 0 ){
+			cerr << "could not listen on " << address << ": " << strerror( errno ) << endl;
+			stop();
+			return false;
+		}
+		m_unix_path = address;
+
+	}
+
+	m_epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+	m_wake_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+	epoll_event ev;
+	memset( &ev, 0, sizeof(ev) );
+	bool ok = listen( m_listen_fd, 16 ) == 0 && m_epoll_fd >= 0 && m_wake_fd >= 0;
+
+	ev.events = EPOLLIN;
+	ev.data.fd = m_listen_fd;
+	ok = ok && epoll_ctl( m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &ev ) == 0;
+	ev.data.fd = m_wake_fd;
+	ok = ok && epoll_ctl( m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev ) == 0;
+
+	if( !ok ){
+		cerr << "could not start the pose server: " << strerror( errno ) << endl;
+		stop();
+		return false;
+	}
+
+	m_queue.reset( 64 );
+	m_stop = 0;
+
+	if( pthread_create( &m_thread, NULL, server_thread, this ) ){
+		printf("pthread_create failed for the pose server\n");
+		stop();
+		return false;
+	}
+
+	m_running = true;
+	return true;
+
+}
+
+void PoseServer::stop(){
+
+	if( m_running ){
+
+		atomic_store( &m_stop, 1 );
+		wake( m_wake_fd );
+		pthread_join( m_thread, NULL );
+		m_running = false;
+
+	}
+
+	for(unsigned int fd=0;fd<m_clients.size();++fd)
+		if( m_clients[fd] )
+			drop( fd );
+
+	if( m_listen_fd >= 0 )
+		close( m_listen_fd );
+	if( m_epoll_fd >= 0 )
+		close( m_epoll_fd );
+	if( m_wake_fd >= 0 )
+		close( m_wake_fd );
+	m_listen_fd = m_epoll_fd = m_wake_fd = -1;
+
+	if( !m_unix_path.empty() ){
+		unlink( m_unix_path.c_str() );
+		m_unix_path.clear();
+	}
+
+}
+
+bool PoseServer::publish( long frame, const PoseStreamHead* heads, int count ){
+
+	if( !m_running )
+		return true;
+
+	Frame f;
+	f.frame = frame;
+	f.timestamp = now();
+	f.count = max( 0, min( count, POSE_STREAM_MAX_HEADS ) );
+	if( f.count < count )
+		atomic_fetch_add( &m_truncated, count - f.count );
+	if( f.count > 0 )
+		memcpy( f.heads, heads, f.count*sizeof(PoseStreamHead) );
+
+	if( !m_queue.push( f ) ){
+		atomic_fetch_add( &m_dropped, 1 );
+		return false;
+	}
+
+	atomic_fetch_add( &m_published, 1 );
+
+	//the eventfd counter can't overflow here, so this never blocks
+	wake( m_wake_fd );
+	return true;
+
+}
+
+void* PoseServer::server_thread( void* arg ){
+
+	((PoseServer*)arg)->run();
+	return NULL;
+
+}
+
+void PoseServer::run(){
+
+	const int MAX_EVENTS = 64;
+	epoll_event events[MAX_EVENTS];
+	Frame frame;
+
+	while( !atomic_load( &m_stop ) ){
+
+		int n = epoll_wait( m_epoll_fd, events, MAX_EVENTS, 1000 );
+		if( n < 0 && errno != EINTR )
+			break;
+
+		for(int i=0;i<n;++i){
+
+			int fd = events[i].data.fd;
+
+			if( fd == m_listen_fd )
+				accept_subscribers();
+			else if( fd == m_wake_fd ){
+
+				uint64_t count;
+				ssize_t r = read( m_wake_fd, &count, sizeof(count) );
+				(void)r;
+				while( m_queue.pop( frame ) )
+					send_frame( frame );
+
+			}
+			else if( fd < (int)m_clients.size() && m_clients[fd] ){
+
+				Subscriber& s = *m_clients[fd];
+				if( events[i].events & ( EPOLLERR | EPOLLHUP ) )
+					drop( fd );
+				else{
+					if( events[i].events & EPOLLIN )
+						read_commands( s );
+					//read_commands drops a subscriber that hung up
+					if( m_clients[fd] && ( events[i].events & EPOLLOUT ) && !flush( s ) )
+						drop( fd );
+				}
+
+			}
+
+		}
+
+	}
+
+}
+
+void PoseServer::accept_subscribers(){
+
+	for(;;){
+
+		int fd = accept4( m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+		if( fd < 0 )
+			return;
+
+		//records are small, send them right away
+		int on = 1;
+		setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+
+		Subscriber* s = new Subscriber();
+		s->fd = fd;
+		s->offset = 0;
+		s->writing = false;
+		s->every = 1;
+		s->seen = 0;
+		s->min_interval = 0;
+		s->last_sent = 0;
+		s->skipped = 0;
+
+		epoll_event ev;
+		memset( &ev, 0, sizeof(ev) );
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		if( epoll_ctl( m_epoll_fd, EPOLL_CTL_ADD, fd, &ev ) != 0 ){
+			close( fd );
+			delete s;
+			continue;
+		}
+
+		if( (int)m_clients.size() <= fd )
+			m_clients.resize( fd+1, 0 );
+		m_clients[fd] = s;
+		atomic_fetch_add( &m_subscribers, 1 );
+
+	}
+
+}
+
+void PoseServer::read_commands( Subscriber& s ){
+
+	char buffer[256];
+	int fd = s.fd;
+
+	for(;;){
+
+		ssize_t n = recv( fd, buffer, sizeof(buffer), 0 );
+		if( n == 0 || ( n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) ){
+			drop( fd );
+			return;
+		}
+		if( n < 0 )
+			return;
+
+		s.command.append( buffer, n );
+
+		size_t end;
+		while( ( end = s.command.find( '\n' ) ) != std::string::npos ){
+
+			std::string line = s.command.substr( 0, end );
+			s.command.erase( 0, end+1 );
+
+			char name[16];
+			double value;
+			if( sscanf( line.c_str(), "%15s %lf", name, &value ) == 2 ){
+
+				if( strcmp( name, "every" ) == 0 )
+					s.every = max( 1, (int)value );
+				else if( strcmp( name, "rate" ) == 0 )
+					s.min_interval = value > 0 ? 1.0/value : 0;
+
+			}
+
+		}
+
+		//nobody sends commands this long
+		if( s.command.size() > 1024 ){
+			drop( fd );
+			return;
+		}
+
+	}
+
+}
+
+void PoseServer::send_frame( const Frame& frame ){
+
+	size_t size = sizeof(PoseStreamHeader) + frame.count*sizeof(PoseStreamHead);
+	m_record.resize( size );
+
+	PoseStreamHeader header;
+	memcpy( header.magic, POSE_STREAM_MAGIC, 4 );
+	header.size = size;
+	header.frame = frame.frame;
+	header.timestamp = frame.timestamp;
+	header.heads = frame.count;
+	header.skipped = 0;
+	if( frame.count > 0 )
+		memcpy( &m_record[0] + sizeof(header), frame.heads, frame.count*sizeof(PoseStreamHead) );
+
+	for(unsigned int fd=0;fd<m_clients.size();++fd){
+
+		Subscriber* s = m_clients[fd];
+		if( !s )
+			continue;
+
+		//decimation
+		bool wanted = ( s->seen++ % s->every == 0 ) && ( frame.timestamp - s->last_sent >= s->min_interval );
+		if( !wanted )
+			continue;
+
+		//backpressure: the subscriber is still busy with older frames
+		if( s->pending.size() - s->offset + size > m_max_pending ){
+			s->skipped++;
+			atomic_fetch_add( &m_skipped, 1 );
+			continue;
+		}
+
+		header.skipped = s->skipped;
+		memcpy( &m_record[0], &header, sizeof(header) );
+
+		s->pending.append( &m_record[0], size );
+		s->last_sent = frame.timestamp;
+		s->skipped = 0;
+		atomic_fetch_add( &m_sent, 1 );
+
+		if( !s->writing && !flush( *s ) )
+			drop( fd );
+
+	}
+
+}
+
+bool PoseServer::flush( Subscriber& s ){
+
+	while( s.offset < s.pending.size() ){
+
+		ssize_t n = send( s.fd, s.pending.data() + s.offset, s.pending.size() - s.offset, MSG_NOSIGNAL | MSG_DONTWAIT );
+		if( n < 0 ){
+
+			if( errno == EINTR )
+				continue;
+			if( errno != EAGAIN && errno != EWOULDBLOCK )
+				return false;
+
+			//socket buffer full, continue when it has room again
+			watch( s, true );
+			return true;
+
+		}
+		s.offset += n;
+
+	}
+
+	s.pending.clear();
+	s.offset = 0;
+	watch( s, false );
+	return true;
+
+}
+
+void PoseServer::watch( Subscriber& s, bool writing ){
+
+	if( s.writing == writing )
+		return;
+
+	epoll_event ev;
+	memset( &ev, 0, sizeof(ev) );
+	ev.events = EPOLLIN | ( writing ? (uint32_t)EPOLLOUT : 0u );
+	ev.data.fd = s.fd;
+	epoll_ctl( m_epoll_fd, EPOLL_CTL_MOD, s.fd, &ev );
+	s.writing = writing;
+
+}
+
+void PoseServer::drop( int fd ){
+
+	epoll_ctl( m_epoll_fd, EPOLL_CTL_DEL, fd, NULL );
+	close( fd );
+	delete m_clients[fd];
+	m_clients[fd] = 0;
+	atomic_fetch_add( &m_subscribers, -1 );
+
+}
+
+#else
+
+bool PoseServer::start( const char*, unsigned int ){
+
+	cerr << "the pose server needs epoll (Linux)" << endl;
+	return false;
+
+}
+
+void PoseServer::stop(){ }
+
+bool PoseServer::publish( long, const PoseStreamHead*, int ){ return true; }
+
+void* PoseServer::server_thread( void* ){ return NULL; }
+
+#endif
+
+void PoseServer::print_stats( std::ostream& os ) const {
+
+	os << "pose server: " << subscribers() << " subscribers, " << published() << " frames published, "
+	   << sent() << " records sent, " << skipped() << " skipped for slow subscribers, "
+	   << dropped() << " frames dropped, " << truncated() << " heads over the limit of "
+	   << POSE_STREAM_MAX_HEADS << " not sent" << endl;
+
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#ifndef PoseServer_H
+#define PoseServer_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <pthread.h>
+#include "BoundedQueue.h"
+
+// Streams the poses of every frame to any number of subscribers over TCP or a Unix domain
+// socket. One thread serves all connections with epoll and non-blocking sockets; the
+// estimation thread only hands frames over through a lock-free queue. A subscriber that
+// reads too slowly has frames skipped instead of holding anything up.
+//
+// Each frame is sent as a PoseStreamHeader followed by heads x PoseStreamHead, in the byte
+// order of the server. Subscribers can send text lines to thin out their stream:
+//   every <n>   only every n-th frame
+//   rate <hz>   at most hz frames per second (0 = all)
+
+#define POSE_STREAM_MAGIC "HPSF"
+#define POSE_STREAM_MAX_HEADS 32 //per frame, the rest is counted in truncated()
+
+struct PoseStreamHeader {
+
+	char magic[4];
+	uint32_t size; //bytes of the record, header included
+	int64_t frame; //frame number of the estimator
+	double timestamp; //seconds, PoseServer::now() when the frame was published
+	int32_t heads;
+	int32_t skipped; //frames this subscriber missed since its last record because it was too slow
+
+};
+
+struct PoseStreamHead {
+
+	int32_t id; //user id, the position in the frame without tracking
+	float pose[6]; //x,y,z (mm), pitch,yaw,roll (degrees)
+	float confidence; //votes relative to the head threshold, >= 1
+
+};
+
+class PoseServer {
+
+public:
+
+	PoseServer();
+	~PoseServer();
+
+	//address: a port number (TCP, loopback only), host:port (TCP on the interface of host,
+	//0.0.0.0:port for all of them) or the path of a Unix domain socket.
+	//max_pending: bytes queued per subscriber before its frames are skipped
+	bool start( const char* address, unsigned int max_pending = 65536 );
+	void stop();
+	bool running() const { return m_running; }
+
+	//estimation thread, never blocks. Returns false if the server fell behind and the frame was dropped
+	bool publish( long frame, const PoseStreamHead* heads, int count );
+
+	unsigned int subscribers() const { return (unsigned int)atomic_load( &m_subscribers ); }
+	long published() const { return atomic_load( &m_published ); } //frames handed to the server
+	long sent() const { return atomic_load( &m_sent ); } //records queued for all subscribers together
+	long skipped() const { return atomic_load( &m_skipped ); } //records not sent to slow subscribers
+	long dropped() const { return atomic_load( &m_dropped ); } //frames that found the queue full
+	long truncated() const { return atomic_load( &m_truncated ); } //heads beyond POSE_STREAM_MAX_HEADS not sent
+
+	void print_stats( std::ostream& os ) const;
+
+	//monotonic clock, seconds
+	static double now();
+
+private:
+
+	struct Frame {
+
+		long frame;
+		double timestamp;
+		int count;
+		PoseStreamHead heads[POSE_STREAM_MAX_HEADS];
+
+	};
+
+	struct Subscriber {
+
+		int fd;
+		std::string pending; //bytes not sent yet, starting at offset
+		size_t offset;
+		bool writing; //waiting for EPOLLOUT
+		std::string command; //partial command line
+		int every; //frame decimation
+		long seen; //frames since connecting
+		double min_interval; //seconds between frames
+		double last_sent;
+		int skipped;
+
+	};
+
+	static void* server_thread( void* arg );
+	void run();
+
+	void accept_subscribers();
+	void read_commands( Subscriber& s );
+	void send_frame( const Frame& frame );
+	bool flush( Subscriber& s );
+	void watch( Subscriber& s, bool writing );
+	void drop( int fd );
+
+	int m_listen_fd;
+	int m_epoll_fd;
+	int m_wake_fd; //eventfd, written by publish() and stop()
+	std::string m_unix_path;
+	unsigned int m_max_pending;
+
+	BoundedQueue< Frame > m_queue;
+	std::vector< Subscriber* > m_clients; //indexed by fd, server thread only
+	std::vector< char > m_record;
+
+	pthread_t m_thread;
+	bool m_running;
+
+	volatile long m_stop;
+	volatile long m_subscribers, m_published, m_sent, m_skipped, m_dropped, m_truncated;
+
+	PoseServer( const PoseServer& );
+	PoseServer& operator=( const PoseServer& );
+
+};
+
+#endif
@@ -0,0 +1,383 @@
+#include "StreamEstimator.h"
+#include "DepthIO.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+using namespace cv;
+
+StreamEstimator::StreamEstimator( CRForestEstimator* estimator,
+								  const EstimationParams& params,
+								  unsigned int threads ){
+
+	m_estimator = estimator;
+	m_params = params;
+	m_threads = MAX( 1, threads );
+
+	m_callback = 0;
+	m_user = 0;
+	m_next = 0;
+	m_stop = true;
+
+	pthread_mutex_init( &m_mutex, NULL );
+	pthread_cond_init( &m_job_cond, NULL );
+	pthread_cond_init( &m_idle_cond, NULL );
+
+}
+
+StreamEstimator::~StreamEstimator(){
+
+	stop();
+
+	for(unsigned int i=0;i<m_streams.size();++i)
+		delete m_streams[i];
+
+	pthread_cond_destroy( &m_job_cond );
+	pthread_cond_destroy( &m_idle_cond );
+	pthread_mutex_destroy( &m_mutex );
+
+}
+
+int StreamEstimator::add_stream( const std::string& name ){
+
+	Stream* stream = new Stream();
+	stream->name = name;
+	stream->next_frame = 0;
+	stream->pending = 0;
+	stream->busy = false;
+
+	for(int i=0;i<3;++i)
+		stream->free.push_back( &stream->jobs[i] );
+
+	pthread_mutex_lock( &m_mutex );
+
+	//first slot of a removed stream
+	unsigned int index = 0;
+	while( index < m_streams.size() && m_streams[index] )
+		index++;
+
+	if( index < m_streams.size() )
+		m_streams[index] = stream;
+	else
+		m_streams.push_back( stream );
+
+	pthread_mutex_unlock( &m_mutex );
+
+	return (int)index;
+
+}
+
+void StreamEstimator::remove_stream( int stream ){
+
+	pthread_mutex_lock( &m_mutex );
+
+	if( stream < 0 || stream >= (int)m_streams.size() || !m_streams[stream] ){
+		pthread_mutex_unlock( &m_mutex );
+		return;
+	}
+
+	Stream* s = m_streams[stream];
+
+	//no worker picks it up anymore, one on it finishes its frame
+	m_streams[stream] = 0;
+	while( s->busy )
+		pthread_cond_wait( &m_idle_cond, &m_mutex );
+
+	pthread_mutex_unlock( &m_mutex );
+
+	delete s;
+
+}
+
+unsigned int StreamEstimator::streams(){
+
+	pthread_mutex_lock( &m_mutex );
+	unsigned int n = (unsigned int)m_streams.size();
+	pthread_mutex_unlock( &m_mutex );
+	return n;
+
+}
+
+std::string StreamEstimator::name( int stream ){
+
+	pthread_mutex_lock( &m_mutex );
+	std::string n = m_streams[stream] ? m_streams[stream]->name : std::string();
+	pthread_mutex_unlock( &m_mutex );
+	return n;
+
+}
+
+bool StreamEstimator::start(){
+
+	if( !m_workers.empty() )
+		return true;
+
+	m_stop = false;
+
+	for(unsigned int t=0;t<m_threads;++t){
+
+		pthread_t thread;
+		if( pthread_create( &thread, NULL, worker_thread, this ) != 0 ){
+			printf("pthread_create failed\n");
+			stop();
+			return false;
+		}
+		m_workers.push_back( thread );
+
+	}
+
+	return true;
+
+}
+
+void StreamEstimator::stop(){
+
+	pthread_mutex_lock( &m_mutex );
+	m_stop = true;
+	pthread_cond_broadcast( &m_job_cond );
+	pthread_mutex_unlock( &m_mutex );
+
+	for(unsigned int t=0;t<m_workers.size();++t)
+		pthread_join( m_workers[t], NULL );
+	m_workers.clear();
+
+	//frames still waiting will never be processed
+	pthread_mutex_lock( &m_mutex );
+	for(unsigned int s=0;s<m_streams.size();++s){
+
+		Stream* stream = m_streams[s];
+		if( stream && stream->pending ){
+			stream->free.push_back( stream->pending );
+			stream->pending = 0;
+			stream->stats.dropped++;
+		}
+
+	}
+	pthread_mutex_unlock( &m_mutex );
+
+}
+
+void StreamEstimator::set_callback( stream_result_fn fn, void* user ){
+
+	pthread_mutex_lock( &m_mutex );
+	m_callback = fn;
+	m_user = user;
+	pthread_mutex_unlock( &m_mutex );
+
+}
+
+long StreamEstimator::push_depth( int stream, const Mat& depth, const float* depth_intrinsic, int max_z, double timestamp ){
+
+	int64 push_tick = getTickCount();
+
+	pthread_mutex_lock( &m_mutex );
+
+	if( m_stop || stream < 0 || stream >= (int)m_streams.size() || !m_streams[stream] ){
+		pthread_mutex_unlock( &m_mutex );
+		return -1;
+	}
+
+	Stream* s = m_streams[stream];
+	s->stats.pushed++;
+
+	Job* job = 0;
+	if( !s->free.empty() ){
+
+		job = s->free.back();
+		s->free.pop_back();
+
+	}
+	else if( s->pending ){
+
+		//reuse the waiting frame
+		job = s->pending;
+		s->pending = 0;
+		s->stats.dropped++;
+
+	}
+	else{
+
+		//only happens with several threads pushing to the same stream
+		s->stats.dropped++;
+		pthread_mutex_unlock( &m_mutex );
+		return -1;
+
+	}
+
+	long frame = s->next_frame++;
+	job->frame = frame;
+	job->timestamp = timestamp;
+	job->push_tick = push_tick;
+
+	pthread_mutex_unlock( &m_mutex );
+
+	//copy outside the lock, the buffers are reused so this does not allocate
+	depth.copyTo( job->depth );
+	memcpy( job->depth_intrinsic, depth_intrinsic, sizeof(job->depth_intrinsic) );
+	job->max_z = max_z;
+
+	pthread_mutex_lock( &m_mutex );
+
+	//latest frame wins, unless a concurrent push was newer
+	if( s->pending && s->pending->frame > frame ){
+		s->free.push_back( job );
+		s->stats.dropped++;
+	}
+	else{
+		if( s->pending ){
+			s->free.push_back( s->pending );
+			s->stats.dropped++;
+		}
+		s->pending = job;
+		pthread_cond_signal( &m_job_cond );
+	}
+
+	pthread_mutex_unlock( &m_mutex );
+	return frame;
+
+}
+
+int StreamEstimator::next_stream(){
+
+	unsigned int n = (unsigned int)m_streams.size();
+
+	for(unsigned int k=0;k<n;++k){
+
+		unsigned int s = (m_next+k)%n;
+		if( m_streams[s] && m_streams[s]->pending && !m_streams[s]->busy ){
+			m_next = (s+1)%n;
+			return (int)s;
+		}
+
+	}
+
+	return -1;
+
+}
+
+void* StreamEstimator::worker_thread( void* arg ){
+
+	((StreamEstimator*)arg)->worker();
+	return NULL;
+
+}
+
+void StreamEstimator::worker(){
+
+	//kept across frames so their memory is reused
+	Mat im3D;
+	std::vector< HeadPose > heads;
+	AsyncResult result;
+
+	while(true){
+
+		pthread_mutex_lock( &m_mutex );
+
+		int index;
+		while( ( index = next_stream() ) < 0 && !m_stop )
+			pthread_cond_wait( &m_job_cond, &m_mutex );
+
+		if( m_stop ){
+			pthread_mutex_unlock( &m_mutex );
+			break;
+		}
+
+		Stream* stream = m_streams[index];
+		Job* job = stream->pending;
+		stream->pending = 0;
+		stream->busy = true;
+
+		stream_result_fn callback = m_callback;
+		void* user = m_user;
+
+		pthread_mutex_unlock( &m_mutex );
+
+		int64 t0 = getTickCount();
+
+		depthTo3D( job->depth, im3D, job->depth_intrinsic, job->max_z );
+		m_estimator->estimate_poses( im3D, heads, m_params, &stream->workspace );
+
+		result.means.clear();
+		result.cluster_sizes.clear();
+		for(unsigned int h=0;h<heads.size();++h){
+			result.means.push_back( heads[h].pose );
+			result.cluster_sizes.push_back( heads[h].votes );
+		}
+
+		int64 t1 = getTickCount();
+
+		result.frame = job->frame;
+		result.timestamp = job->timestamp;
+		result.params = m_params;
+		result.estimate_ms = 1000.0*(t1-t0)/getTickFrequency();
+		result.latency_ms = 1000.0*(t1-job->push_tick)/getTickFrequency();
+
+		//still busy, so the next frame of the stream cannot overtake this one
+		if( callback )
+			callback( index, result, user );
+
+		pthread_mutex_lock( &m_mutex );
+
+		stream->free.push_back( job );
+		stream->busy = false;
+		pthread_cond_broadcast( &m_idle_cond );
+
+		StreamStats& st = stream->stats;
+		st.processed++;
+		st.latency_ms += result.latency_ms;
+		st.max_latency_ms = MAX( st.max_latency_ms, result.latency_ms );
+		st.wait_ms += result.latency_ms - result.estimate_ms;
+		st.estimate_ms += result.estimate_ms;
+
+		//a frame of the stream may have come in meanwhile
+		if( stream->pending )
+			pthread_cond_signal( &m_job_cond );
+
+		pthread_mutex_unlock( &m_mutex );
+
+	}
+
+}
+
+StreamStats StreamEstimator::stats( int stream, bool reset ){
+
+	pthread_mutex_lock( &m_mutex );
+	StreamStats s;
+	if( m_streams[stream] ){
+		s = m_streams[stream]->stats;
+		if( reset )
+			m_streams[stream]->stats = StreamStats();
+	}
+	pthread_mutex_unlock( &m_mutex );
+	return s;
+
+}
+
+void StreamEstimator::print_stats( std::ostream& os, bool reset ){
+
+	os << "stream                frames  dropped  avg ms   max ms  wait ms  est. ms" << endl;
+
+	unsigned int n = streams();
+	for(unsigned int i=0;i<n;++i){
+
+		std::string stream_name = name( i );
+		StreamStats st = stats( i, reset );
+		if( stream_name.empty() )
+			continue;
+		long frames = MAX( 1, st.processed );
+
+		char line[200];
+		sprintf( line, "  %-18s %8ld %8ld %8.2f %8.2f %8.2f %8.2f",
+				 stream_name.c_str(),
+				 st.processed,
+				 st.dropped,
+				 st.latency_ms/frames,
+				 st.max_latency_ms,
+				 st.wait_ms/frames,
+				 st.estimate_ms/frames );
+		os << line << endl;
+
+	}
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#ifndef StreamEstimator_H
+#define StreamEstimator_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <pthread.h>
+#include "AsyncEstimator.h"
+
+//per stream, since the last reset
+struct StreamStats {
+
+	StreamStats() : pushed(0), processed(0), dropped(0), latency_ms(0), max_latency_ms(0), wait_ms(0), estimate_ms(0) { }
+
+	long pushed;
+	long processed;
+	long dropped; //replaced by a newer frame of the stream before a worker got to it
+	double latency_ms; //push() until the result was ready, summed over the processed frames
+	double max_latency_ms;
+	double wait_ms; //part of the latency spent waiting for a worker, summed
+	double estimate_ms; //summed
+
+};
+
+//called on a worker thread, for each stream never concurrently and always with increasing frame numbers
+typedef void (*stream_result_fn)( int stream, const AsyncResult& result, void* user );
+
+// Estimation for several depth streams with one forest and one set of worker threads.
+// Each stream keeps only its newest frame waiting and has at most one frame being
+// estimated, so its results stay in order and a fast stream cannot crowd out the others:
+// free workers take the waiting frames round robin, starting after the stream served last.
+class StreamEstimator {
+
+public:
+
+	StreamEstimator( CRForestEstimator* estimator, const EstimationParams& params, unsigned int threads = 1 );
+	~StreamEstimator();
+
+	//streams can also be added while running, returns the stream number.
+	//The numbers of removed streams are given out again
+	int add_stream( const std::string& name );
+	//drops its waiting frame and returns once no worker is on it, so no callback for the stream
+	//follows. Nothing may push to the stream anymore
+	void remove_stream( int stream );
+	unsigned int streams(); //stream numbers are below this, removed ones included
+	std::string name( int stream ); //empty for a removed stream
+
+	bool start();
+	void stop();
+
+	void set_callback( stream_result_fn fn, void* user = 0 );
+
+	//copies a CV_16SC1 depth image in mm, the worker back-projects it with depthTo3D().
+	//Returns the frame number within the stream, -1 if it was dropped right away
+	long push_depth( int stream, const cv::Mat& depth, const float* depth_intrinsic, int max_z, double timestamp );
+
+	StreamStats stats( int stream, bool reset = false );
+
+	//one line per stream
+	void print_stats( std::ostream& os, bool reset = false );
+
+private:
+
+	struct Job {
+
+		long frame;
+		double timestamp;
+		int64 push_tick;
+		cv::Mat depth;
+		float depth_intrinsic[9];
+		int max_z;
+
+	};
+
+	struct Stream {
+
+		std::string name;
+		long next_frame;
+		Job jobs[3]; //the waiting frame, the one being estimated and one being copied in by push_depth()
+		Job* pending; //waiting for a worker, 0 if none
+		std::vector< Job* > free;
+		bool busy; //a worker is on a frame of the stream
+		EstimationWorkspace workspace; //only used by the worker on the stream
+		StreamStats stats;
+
+	};
+
+	static void* worker_thread( void* arg );
+	void worker();
+
+	//next stream with a waiting frame and no busy worker, -1 if there is none. Called with m_mutex locked
+	int next_stream();
+
+	CRForestEstimator* m_estimator;
+	EstimationParams m_params;
+	unsigned int m_threads;
+
+	stream_result_fn m_callback;
+	void* m_user;
+
+	std::vector< Stream* > m_streams; //0 for a removed stream
+	unsigned int m_next; //stream the round robin continues with
+
+	std::vector< pthread_t > m_workers;
+	bool m_stop;
+
+	pthread_mutex_t m_mutex; //streams, stats
+	pthread_cond_t m_job_cond;
+	pthread_cond_t m_idle_cond; //a worker finished a frame
+
+	StreamEstimator( const StreamEstimator& );
+	StreamEstimator& operator=( const StreamEstimator& );
+
+};
+
+#endif
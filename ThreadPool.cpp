@@ -0,0 +1,123 @@
+#include "ThreadPool.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+ThreadPool::ThreadPool( unsigned int workers ){
+
+	m_stop = false;
+
+	pthread_mutex_init( &m_mutex, NULL );
+	pthread_cond_init( &m_task_cond, NULL );
+	pthread_cond_init( &m_done_cond, NULL );
+
+	for(unsigned int t=0;t<workers;++t){
+
+		pthread_t thread;
+		if( pthread_create( &thread, NULL, worker_thread, this ) != 0 ){
+			printf("pthread_create failed, using %u worker threads\n", t);
+			break;
+		}
+		m_threads.push_back( thread );
+
+	}
+
+}
+
+ThreadPool::~ThreadPool(){
+
+	pthread_mutex_lock( &m_mutex );
+	m_stop = true;
+	pthread_cond_broadcast( &m_task_cond );
+	pthread_mutex_unlock( &m_mutex );
+
+	for(unsigned int t=0;t<m_threads.size();++t)
+		pthread_join( m_threads[t], NULL );
+
+	pthread_cond_destroy( &m_done_cond );
+	pthread_cond_destroy( &m_task_cond );
+	pthread_mutex_destroy( &m_mutex );
+
+}
+
+void* ThreadPool::worker_thread( void* arg ){
+
+	((ThreadPool*)arg)->worker();
+	return NULL;
+
+}
+
+void ThreadPool::worker(){
+
+	pthread_mutex_lock( &m_mutex );
+
+	while(true){
+
+		while( m_batches.empty() && !m_stop )
+			pthread_cond_wait( &m_task_cond, &m_mutex );
+
+		if( m_stop )
+			break;
+
+		//oldest call first
+		run_task( m_batches.front() );
+
+	}
+
+	pthread_mutex_unlock( &m_mutex );
+
+}
+
+void ThreadPool::run_task( Batch* batch ){
+
+	unsigned int index = batch->next++;
+	if( batch->next == batch->count )
+		m_batches.erase( std::find( m_batches.begin(), m_batches.end(), batch ) );
+
+	pthread_mutex_unlock( &m_mutex );
+
+	batch->fn( index, batch->arg );
+
+	pthread_mutex_lock( &m_mutex );
+
+	if( ++batch->done == batch->count )
+		pthread_cond_broadcast( &m_done_cond );
+
+}
+
+void ThreadPool::run( unsigned int count, pool_task_fn fn, void* arg ){
+
+	if( count == 0 )
+		return;
+
+	//nothing to share
+	if( m_threads.empty() || count == 1 ){
+
+		for(unsigned int i=0;i<count;++i)
+			fn( i, arg );
+		return;
+
+	}
+
+	Batch batch;
+	batch.fn = fn;
+	batch.arg = arg;
+	batch.count = count;
+	batch.next = 0;
+	batch.done = 0;
+
+	pthread_mutex_lock( &m_mutex );
+
+	m_batches.push_back( &batch );
+	pthread_cond_broadcast( &m_task_cond );
+
+	//help with our own tasks
+	while( batch.next < batch.count )
+		run_task( &batch );
+
+	while( batch.done < batch.count )
+		pthread_cond_wait( &m_done_cond, &m_mutex );
+
+	pthread_mutex_unlock( &m_mutex );
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef ThreadPool_H
+#define ThreadPool_H
+
+#include <vector>
+#include <pthread.h>
+
+//runs task number index of a ThreadPool::run() call
+typedef void (*pool_task_fn)( unsigned int index, void* arg );
+
+// Fixed set of worker threads for fork/join loops. run() can be called from several
+// threads at the same time (e.g. one estimate() per frame), the calling thread works
+// on its own tasks too, so a pool with 0 workers simply runs everything serially.
+class ThreadPool {
+
+public:
+
+	ThreadPool( unsigned int workers );
+	~ThreadPool();
+
+	//calls fn(i, arg) for i in [0,count) and returns when all calls have returned
+	void run( unsigned int count, pool_task_fn fn, void* arg );
+
+	unsigned int workers() const { return m_threads.size(); }
+
+private:
+
+	struct Batch {
+
+		pool_task_fn fn;
+		void* arg;
+		unsigned int count;
+		unsigned int next; //next task to hand out
+		unsigned int done;
+
+	};
+
+	static void* worker_thread( void* arg );
+	void worker();
+
+	//runs one task of batch, called and returns with m_mutex locked
+	void run_task( Batch* batch );
+
+	std::vector< pthread_t > m_threads;
+	std::vector< Batch* > m_batches; //with tasks left to hand out
+	bool m_stop;
+
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_task_cond;
+	pthread_cond_t m_done_cond;
+
+	ThreadPool( const ThreadPool& );
+	ThreadPool& operator=( const ThreadPool& );
+
+};
+
+#endif
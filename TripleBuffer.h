@@ -0,0 +1,143 @@
+#pragma once
+
+#ifndef TripleBuffer_H
+#define TripleBuffer_H
+
+#include <pthread.h>
+#include <sys/time.h>
+#include "Atomic.h"
+
+// Lock-free handoff of the newest item from one producer to one consumer. The producer
+// fills back() and publishes it, the consumer takes the newest published item with
+// update() and reads it as front(). The producer never waits: items published before the
+// consumer got to them are overwritten and counted. The consumer can sleep until there
+// is a new item with wait_update(), only then a mutex/condition is involved.
+template< class T >
+class TripleBuffer {
+
+public:
+
+	TripleBuffer(){
+
+		m_back = 0;
+		m_shared = 1;
+		m_front = 2;
+		m_published = 0;
+		m_overwritten = 0;
+		m_waiters = 0;
+		for(int i=0;i<3;++i)
+			m_seq[i] = -1;
+		pthread_mutex_init( &m_mutex, NULL );
+		pthread_cond_init( &m_cond, NULL );
+
+	}
+
+	~TripleBuffer(){
+
+		pthread_cond_destroy( &m_cond );
+		pthread_mutex_destroy( &m_mutex );
+
+	}
+
+	//not thread safe, to allocate the items before the producer starts
+	T& slot( int i ){ return m_items[i]; }
+
+	//producer side: the item to fill next
+	T& back(){ return m_items[m_back]; }
+
+	//producer side: makes back() the newest item and returns its sequence number (0, 1, ...)
+	long publish(){
+
+		long seq = m_published;
+		m_seq[m_back] = seq;
+
+		//the item and its number are written before the exchange makes them visible
+		long old = atomic_exchange( &m_shared, m_back | FRESH );
+		m_back = old & INDEX;
+
+		if( old & FRESH )
+			atomic_fetch_add( &m_overwritten, 1 );
+
+		atomic_store( &m_published, seq+1 );
+
+		//the exchange is a full barrier, so either a waiter is counted here or it sees the item
+		if( atomic_load( &m_waiters ) ){
+			pthread_mutex_lock( &m_mutex );
+			pthread_cond_broadcast( &m_cond );
+			pthread_mutex_unlock( &m_mutex );
+		}
+
+		return seq;
+
+	}
+
+	//consumer side: takes the newest item if there is one it has not seen, false otherwise
+	bool update(){
+
+		if( !( atomic_load( &m_shared ) & FRESH ) )
+			return false;
+
+		m_front = atomic_exchange( &m_shared, m_front ) & INDEX;
+		return true;
+
+	}
+
+	//consumer side: update(), sleeping up to timeout_ms for a new item if there is none
+	bool wait_update( int timeout_ms ){
+
+		if( update() )
+			return true;
+
+		timeval now;
+		gettimeofday( &now, NULL );
+		timespec until;
+		long long ns = (long long)now.tv_usec*1000 + (long long)timeout_ms*1000000;
+		until.tv_sec = now.tv_sec + ns/1000000000;
+		until.tv_nsec = ns%1000000000;
+
+		pthread_mutex_lock( &m_mutex );
+		atomic_fetch_add( &m_waiters, 1 );
+
+		while( !( atomic_load( &m_shared ) & FRESH ) )
+			if( pthread_cond_timedwait( &m_cond, &m_mutex, &until ) != 0 )
+				break;
+
+		atomic_fetch_add( &m_waiters, -1 );
+		pthread_mutex_unlock( &m_mutex );
+
+		return update();
+
+	}
+
+	//consumer side: the item taken by the last update(), valid until the next one
+	const T& front() const { return m_items[m_front]; }
+	T& front(){ return m_items[m_front]; }
+	long front_seq() const { return m_seq[m_front]; } //-1 before the first item
+
+	long published() const { return atomic_load( &m_published ); }
+	long overwritten() const { return atomic_load( &m_overwritten ); } //published but never taken
+
+private:
+
+	enum { INDEX = 3, FRESH = 4 };
+
+	T m_items[3];
+	long m_seq[3]; //sequence number of each item, written with it
+
+	long m_back; //producer only
+	long m_front; //consumer only
+	volatile long m_shared; //index of the third item, FRESH if it was published and not taken yet
+
+	volatile long m_published;
+	volatile long m_overwritten;
+
+	volatile long m_waiters; //consumers sleeping in wait_update()
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond;
+
+	TripleBuffer( const TripleBuffer& );
+	TripleBuffer& operator=( const TripleBuffer& );
+
+};
+
+#endif
@@ -0,0 +1,114 @@
+/*
+// Offline batch estimation: loads the forest once and runs it over whole
+// directory trees (or lists) of *_depth.bin frames, using all cores.
+*/
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CRForestEstimator.h"
+#include "BatchEstimator.h"
+#include "DepthIO.h"
+
+using namespace std;
+using namespace cv;
+
+//one line per frame: file, no. of heads, then votes x y z pitch yaw roll for each head
+void write_result( const BatchResult& result, void* user ){
+
+	FILE* out = (FILE*)user;
+
+	if( !result.ok ){
+		fprintf( out, "%s -1\n", result.filename.c_str() );
+		return;
+	}
+
+	fprintf( out, "%s %d", result.filename.c_str(), (int)result.means.size() );
+	for(unsigned int i=0;i<result.means.size();++i){
+
+		fprintf( out, " %u", result.cluster_sizes[i] );
+		for(int n=0;n<POSE_SIZE;++n)
+			fprintf( out, " %g", result.means[i][n] );
+
+	}
+	fprintf( out, "\n" );
+
+}
+
+int main(int argc, char* argv[])
+{
+
+	if( argc < 4 ){
+
+		cout << "usage: ./head_pose_batch config_file output_file <depth dir | file list | depth file>... [-t threads] [-f max_faces]" << endl;
+		cout << "       output_file - writes to stdout" << endl;
+		exit(-1);
+	}
+
+	string treepath;
+	int ntrees = 0;
+	int max_z = 0;
+	EstimationParams params;
+	unsigned int threads = 0;
+
+	if( !loadEstimatorConfig( argv[1], treepath, ntrees, max_z, params ) )
+		exit(-1);
+
+	vector< string > files;
+	for(int i=3;i<argc;++i){
+
+		if( strcmp(argv[i], "-t") == 0 && i+1 < argc )
+			threads = atoi(argv[++i]);
+		else if( strcmp(argv[i], "-f") == 0 && i+1 < argc )
+			params.max_no_faces = atoi(argv[++i]);
+		else if( !collectDepthFiles( argv[i], files ) )
+			exit(-1);
+
+	}
+
+	if( files.empty() ){
+		cerr << "no *_depth.bin files found" << endl;
+		exit(-1);
+	}
+
+	CRForestEstimator estimator;
+	if( !estimator.load_forest(treepath.c_str(), ntrees) ){
+
+		cerr << "could not read forest!" << endl;
+		exit(-1);
+	}
+
+	FILE* out = stdout;
+	if( strcmp(argv[2], "-") != 0 ){
+
+		out = fopen( argv[2], "w" );
+		if(!out){
+			cerr << "could not open " << argv[2] << endl;
+			exit(-1);
+		}
+	}
+
+	if( threads == 0 )
+		threads = BatchEstimator::default_threads();
+	fprintf( stderr, "processing %u frames on %u threads\n", (unsigned int)files.size(), threads );
+
+	BatchEstimator batch( &estimator, params, max_z );
+	BatchStats stats = batch.run( files, threads, write_result, out );
+
+	if( out != stdout )
+		fclose( out );
+
+	fprintf( stderr, "frames:      %u (%u failed)\n", stats.frames, stats.failed );
+	fprintf( stderr, "heads:       %u\n", stats.heads );
+	fprintf( stderr, "time:        %.2f s\n", stats.seconds );
+	fprintf( stderr, "throughput:  %.2f frames/s\n", stats.fps() );
+	if( stats.frames > 0 )
+		fprintf( stderr, "per frame:   %.2f ms decoding, %.2f ms estimation (thread time)\n",
+				 stats.decode_ms/stats.frames, stats.estimate_ms/stats.frames );
+
+	return stats.failed == stats.frames ? -1 : 0;
+
+}
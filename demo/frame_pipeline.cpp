@@ -0,0 +1,224 @@
+#include "frame_pipeline.hpp"
+
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace std;
+
+FramePipeline::FramePipeline(){
+
+	m_stop = 0;
+	m_reordered = 0;
+	m_next_seq = 0;
+	m_last_seq = -1;
+	m_running = false;
+
+}
+
+FramePipeline::~FramePipeline(){
+
+	stop();
+
+	for(unsigned int i=0;i<m_stages.size();++i)
+		delete m_stages[i];
+	for(unsigned int i=0;i<m_queues.size();++i)
+		delete m_queues[i];
+	for(unsigned int i=0;i<m_frames.size();++i)
+		delete m_frames[i];
+
+}
+
+void FramePipeline::add_stage( const std::string& name, pipeline_stage_fn fn, void* user ){
+
+	if( m_running )
+		return;
+
+	Stage* s = new Stage();
+	s->name = name;
+	s->fn = fn;
+	s->user = user;
+	s->in = 0;
+	s->out = 0;
+	s->frames = s->total_us = s->max_us = s->wait_us = 0;
+	s->owner = this;
+	s->index = m_stages.size();
+	m_stages.push_back( s );
+
+}
+
+bool FramePipeline::start( unsigned int depth ){
+
+	if( m_running || m_stages.empty() )
+		return false;
+
+	depth = MAX( 1, depth );
+
+	for(unsigned int i=0;i<m_queues.size();++i)
+		delete m_queues[i];
+	m_queues.clear();
+
+	//every queue can hold all frames, so pushing never blocks
+	for(unsigned int i=0;i<m_stages.size();++i)
+		m_queues.push_back( new BoundedQueue< PipelineFrame* >( depth ) );
+
+	while( m_frames.size() < depth )
+		m_frames.push_back( new PipelineFrame() );
+
+	for(unsigned int i=0;i<depth;++i)
+		m_queues[0]->push( m_frames[i] );
+
+	for(unsigned int i=0;i<m_stages.size();++i){
+
+		m_stages[i]->in = m_queues[i];
+		m_stages[i]->out = m_queues[ (i+1) % m_queues.size() ];
+
+	}
+
+	m_stop = 0;
+	m_last_seq = -1;
+
+	for(unsigned int i=0;i<m_stages.size();++i){
+
+		if( pthread_create( &m_stages[i]->thread, NULL, stage_thread, m_stages[i] ) ){
+
+			printf("pthread_create failed for stage %s\n", m_stages[i]->name.c_str());
+			atomic_store( &m_stop, 1 );
+			for(unsigned int q=0;q<m_queues.size();++q)
+				m_queues[q]->wake();
+			for(unsigned int j=0;j<i;++j)
+				pthread_join( m_stages[j]->thread, NULL );
+			return false;
+
+		}
+
+	}
+
+	m_running = true;
+	return true;
+
+}
+
+void FramePipeline::stop(){
+
+	if( !m_running )
+		return;
+
+	atomic_store( &m_stop, 1 );
+	for(unsigned int i=0;i<m_queues.size();++i)
+		m_queues[i]->wake();
+
+	for(unsigned int i=0;i<m_stages.size();++i)
+		pthread_join( m_stages[i]->thread, NULL );
+
+	m_running = false;
+
+}
+
+void* FramePipeline::stage_thread( void* arg ){
+
+	Stage* stage = (Stage*)arg;
+	stage->owner->run_stage( *stage );
+	return NULL;
+
+}
+
+void FramePipeline::run_stage( Stage& stage ){
+
+	bool first = ( stage.index == 0 );
+	bool last = ( stage.index == m_stages.size()-1 );
+	double us_per_tick = 1e6 / cv::getTickFrequency();
+
+	PipelineFrame* frame = 0;
+
+	while( !atomic_load( &m_stop ) ){
+
+		int64 t0 = cv::getTickCount();
+
+		if( !stage.in->pop_wait( frame, &m_stop ) )
+			break;
+
+		int64 t1 = cv::getTickCount();
+
+		if( first ){
+
+			frame->valid = true;
+
+			//the source stage is polled until it delivers a frame
+			while( !stage.fn( *frame, stage.user ) ){
+
+				if( atomic_load( &m_stop ) )
+					return;
+				usleep( 1000 );
+				t1 = cv::getTickCount();
+
+			}
+
+			frame->seq = m_next_seq++;
+			frame->capture_tick = cv::getTickCount();
+
+		}
+		else if( frame->valid ){
+
+			frame->valid = stage.fn( *frame, stage.user );
+
+		}
+
+		int64 t2 = cv::getTickCount();
+
+		if( last ){
+
+			if( frame->seq <= m_last_seq )
+				atomic_fetch_add( &m_reordered, 1 );
+			m_last_seq = frame->seq;
+
+		}
+
+		long busy = long( (t2-t1)*us_per_tick );
+		atomic_fetch_add( &stage.frames, 1 );
+		atomic_fetch_add( &stage.total_us, busy );
+		atomic_fetch_add( &stage.wait_us, long( (t1-t0)*us_per_tick ) );
+		if( busy > atomic_load( &stage.max_us ) )
+			atomic_store( &stage.max_us, busy );
+
+		//can not fail, every queue has room for all frames
+		stage.out->push( frame );
+		frame = 0;
+
+	}
+
+}
+
+PipelineStageStats FramePipeline::stage_stats( unsigned int stage ) const {
+
+	PipelineStageStats st;
+	const Stage* s = m_stages[stage];
+	st.frames = atomic_load( &s->frames );
+	st.total_us = atomic_load( &s->total_us );
+	st.max_us = atomic_load( &s->max_us );
+	st.wait_us = atomic_load( &s->wait_us );
+	return st;
+
+}
+
+void FramePipeline::print_stats( std::ostream& os ) const {
+
+	os << "pipeline stage        frames   avg ms   max ms  wait ms" << endl;
+
+	for(unsigned int i=0;i<m_stages.size();++i){
+
+		PipelineStageStats st = stage_stats( i );
+		char line[200];
+		sprintf( line, "  %-18s %8ld %8.2f %8.2f %8.2f",
+				 m_stages[i]->name.c_str(),
+				 st.frames,
+				 st.frames ? 0.001*st.total_us/st.frames : 0.0,
+				 0.001*st.max_us,
+				 st.frames ? 0.001*st.wait_us/st.frames : 0.0 );
+		os << line << endl;
+
+	}
+
+	if( reordered() )
+		os << "  frames out of order: " << reordered() << endl;
+
+}
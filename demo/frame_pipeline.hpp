@@ -0,0 +1,103 @@
+#ifndef _FRAME_PIPELINE_H_
+#define _FRAME_PIPELINE_H_
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <pthread.h>
+
+#include "../CRForestEstimator.h"
+#include "../BoundedQueue.h"
+
+// one frame travelling through the pipeline, frames are recycled once the last stage is done
+struct PipelineFrame {
+
+	long seq; //frame number, assigned by the pipeline before the first stage
+	int64 capture_tick; //cv::getTickCount() when the first stage finished
+	bool valid; //cleared by a stage that rejects the frame, later stages skip it
+
+	cv::Mat depth; //raw depth from the sensor
+	cv::Mat im3D; //back-projected 3D image
+	VoteSet votes;
+	std::vector< cv::Vec<float,POSE_SIZE> > means;
+	VoteClusters clusters;
+	EstimationParams params; //taken with the frame, used by all stages
+
+};
+
+// a stage returns false if it has nothing to do for this frame.
+// For the first stage this means "no new frame yet" and it is called again,
+// for all other stages the frame is marked invalid and only passed on to be recycled.
+typedef bool (*pipeline_stage_fn)( PipelineFrame& frame, void* user );
+
+struct PipelineStageStats {
+
+	long frames; //frames processed by the stage
+	long total_us; //accumulated processing time
+	long max_us;
+	long wait_us; //time spent waiting for input
+
+};
+
+// Runs each stage on its own thread, consecutive stages are connected by bounded
+// lock-free queues. Every stage handles frames strictly in FIFO order, so the last
+// stage sees the frames in the order the first stage produced them.
+class FramePipeline {
+
+public:
+
+	FramePipeline();
+	~FramePipeline();
+
+	void add_stage( const std::string& name, pipeline_stage_fn fn, void* user = 0 );
+
+	//depth = number of frames in flight
+	bool start( unsigned int depth );
+	void stop();
+	bool running() const { return m_running; }
+
+	unsigned int stages() const { return (unsigned int)m_stages.size(); }
+	PipelineStageStats stage_stats( unsigned int stage ) const;
+	void print_stats( std::ostream& os ) const;
+
+	//frames that reached the last stage out of order, always 0 unless something is broken
+	long reordered() const { return atomic_load( &m_reordered ); }
+
+private:
+
+	struct Stage {
+
+		std::string name;
+		pipeline_stage_fn fn;
+		void* user;
+
+		BoundedQueue< PipelineFrame* >* in;
+		BoundedQueue< PipelineFrame* >* out;
+
+		volatile long frames, total_us, max_us, wait_us;
+
+		FramePipeline* owner;
+		unsigned int index;
+		pthread_t thread;
+
+	};
+
+	static void* stage_thread( void* arg );
+	void run_stage( Stage& stage );
+
+	std::vector< Stage* > m_stages;
+	std::vector< BoundedQueue< PipelineFrame* >* > m_queues; //m_queues[i] feeds stage i, m_queues[0] holds free frames
+	std::vector< PipelineFrame* > m_frames;
+
+	volatile long m_stop;
+	volatile long m_reordered;
+	long m_next_seq;
+	long m_last_seq;
+	bool m_running;
+
+	FramePipeline( const FramePipeline& );
+	FramePipeline& operator=( const FramePipeline& );
+
+};
+
+#endif
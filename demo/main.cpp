@@ -21,15 +21,23 @@
 #include <algorithm>
 #include <iostream>
 #include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 #include "freeglut.h"
 
 
 #ifdef LIBLO
 // OSC added by Matthias Kronlachner
 #include <lo/lo.h> // OSC
+#include "osc_sender.hpp"
 char *ADDRESS = "127.0.0.1";
 char *PORT = "7120";
-lo_address addr;
+OscSender g_osc; //sends the poses from its own thread
 #define OUTPUT_BUFFER_SIZE 1024*16
 char osc_buffer[OUTPUT_BUFFER_SIZE];
 char tmp[50]; //Temp buffer for OSC address pattern
@@ -48,11 +56,16 @@ char tmp[50]; //Temp buffer for OSC address pattern
 #endif
 #ifdef USE_LIBFREENECT
 #include "libfreenect.h"
-#include <pthread.h>
 #endif
 
 #include "../CRForestEstimator.h"
+#include "../HeadTracker.h"
+#include "../DepthRecording.h"
+#include "../PoseRing.h"
+#include "../PoseServer.h"
+#include "../TripleBuffer.h"
 #include "gl_camera.hpp"
+#include "frame_pipeline.hpp"
 
 bool show_visual = TRUE;
 bool send_osc = TRUE;
@@ -72,13 +85,13 @@ int g_p_height;
 //maximum distance form the sensor - used to segment the person
 int g_max_z = 0;
 //head threshold - to classify a cluster of votes as a head
-int g_th = 300;
+volatile long g_th = 300;
 //threshold for the probability of a patch to belong to a head
 float g_prob_th = 1.0f;
 //threshold on the variance of the leaves
 float g_maxv = 400.f;
 //stride (how densely to sample test patches - increase for higher speed)
-int g_stride = 10;
+volatile long g_stride = 10;
 //radius used for clustering votes into possible heads
 float g_larger_radius_ratio = 1.f;
 //radius used for mean shift
@@ -96,6 +109,25 @@ int g_im_w = 640;
 int g_im_h = 480;
 //kinect's frame rate
 int g_fps = 30;
+//number of frames in flight when running headless as a pipeline (0 = run the stages serially)
+int g_pipeline_depth = 0;
+//capture -> ingest -> regression -> clustering -> output, each stage on its own thread
+FramePipeline g_pipeline;
+//run the full detection only every n frames and track the heads in between (0 = off)
+int g_track_every = 0;
+HeadTracker* g_tracker = 0;
+std::vector< int > g_ids; //tracked head ids, same order as g_means
+//depth frames of the sensor are written to the recorder, a replayed recording replaces the sensor
+DepthRecorder* g_recorder = 0;
+DepthRecording* g_replay = 0;
+bool g_replay_fast = false; //as fast as possible instead of in real time
+unsigned int g_replay_frame = 0; //next frame
+unsigned int g_replay_skipped = 0; //frames missed in real time because the estimation was too slow
+double g_replay_start = 0;
+//poses for local consumers through shared memory, in addition to OSC
+PoseRing* g_pose_ring = 0;
+//binary pose stream for any number of subscribers over TCP or a Unix domain socket
+PoseServer* g_pose_server = 0;
 
 #ifdef USE_OPENNI
 	XnUInt64 g_focal_length;
@@ -113,7 +145,8 @@ int g_fps = 30;
 #endif
 
 #ifdef USE_LIBFREENECT
-	uint16_t *depth_mid, *depth_front;
+	//depth maps from the capture thread, libfreenect writes straight into the back buffer
+	TripleBuffer< cv::Mat > g_kinect_depth;
 	freenect_context *f_ctx;
 	freenect_device *f_dev;
 	int freenect_angle = 0;
@@ -121,40 +154,70 @@ int g_fps = 30;
 
 	volatile int die = 0;
 	pthread_t freenect_thread;
-	pthread_mutex_t gl_backbuf_mutex = PTHREAD_MUTEX_INITIALIZER;
-	pthread_cond_t gl_frame_cond = PTHREAD_COND_INITIALIZER;
-	int got_depth = 0;
 #endif
 
-bool kill = false;
+//ends the main loops: 'q', SIGINT/SIGTERM or the end of a replay
+volatile long g_quit = 0;
 
 bool g_first_rigid = true;
-bool g_show_votes = false;
+cv::Vec3f g_scene_center; //centre and extent of the first scene, to place the camera
+float g_scene_radius = 0;
+volatile long g_show_votes = 0; //stride, threshold and this are changed by key() on the viewer thread
 bool g_draw_triangles = false;
 bool g_draw = true;
 
 //for interactive visualization
 gl_camera g_camera;
 
+//what the viewer draws of one estimated frame. Filled by the estimation thread and not
+//changed anymore once it is published
+struct ViewFrame {
+
+	long frame;
+	cv::Mat cloud; //every g_view_step-th point of the 3D image in both directions
+	std::vector< cv::Vec<float,POSE_SIZE> > means;
+	std::vector< cv::Vec3f > votes; //only with the votes shown
+	std::vector< std::vector< cv::Vec3f > > clusters;
+	bool has_scene;
+	cv::Vec3f scene_center;
+	float scene_radius;
+
+};
+
+//with the visualization, the estimation runs on its own thread and the viewer draws the
+//newest frame at up to g_view_fps frames a second, frames it has no time for are skipped
+TripleBuffer< ViewFrame > g_view;
+pthread_t g_estimation_thread;
+bool g_estimating = false;
+int g_view_step = 2;
+double g_view_fps = 30;
+double g_last_draw = 0;
+long g_view_drawn = 0;
+int64 g_estimation_t0 = 0;
+bool g_view_placed = false; //camera set from the first scene
+//vertex arrays of the frame last drawn, rebuilt for new frames only
+long g_mesh_frame = -1;
+bool g_mesh_triangles = false;
+std::vector< cv::Vec3f > g_mesh_vertices, g_mesh_normals;
+
 std::vector< cv::Vec<float,POSE_SIZE> > g_means; //outputs
 std::vector< std::vector< const Vote* > > g_clusters; //full clusters of votes
 std::vector< Vote > g_votes; //all votes returned by the forest
+std::vector< HeadPose > g_heads; //poses only, when the votes are not drawn
+std::vector< float > g_confidence; //same order as g_means
+EstimationWorkspace g_workspace;
 
 math_vector_3f g_face_curr_dir, g_face_dir(0,0,-1);
 
 #ifdef USE_LIBFREENECT
 void depth_cb(freenect_device *dev, void *v_depth, uint32_t timestamp)
 {
-	int i;
-	uint16_t *depth = (uint16_t*)v_depth;
-	
-	pthread_mutex_lock(&gl_backbuf_mutex);
-	for (i=0; i<640*480; i++) {		
-		depth_mid[i] = depth[i];
-	}
-	got_depth++;
-	pthread_cond_signal(&gl_frame_cond);
-	pthread_mutex_unlock(&gl_backbuf_mutex);
+	//v_depth is the back buffer set below, unless libfreenect used its own
+	if( v_depth != g_kinect_depth.back().data )
+		memcpy( g_kinect_depth.back().data, v_depth, 640*480*sizeof(uint16_t) );
+
+	g_kinect_depth.publish();
+	freenect_set_depth_buffer( dev, g_kinect_depth.back().data );
 }
 
 void *freenect_threadfunc(void *arg)
@@ -165,6 +228,7 @@ void *freenect_threadfunc(void *arg)
 	freenect_set_depth_callback(f_dev, depth_cb);
 	
 	freenect_set_depth_mode(f_dev, freenect_find_depth_mode(FREENECT_RESOLUTION_MEDIUM, FREENECT_DEPTH_MM));
+	freenect_set_depth_buffer(f_dev, g_kinect_depth.back().data);
 	
 	freenect_start_depth(f_dev);
 	
@@ -173,6 +237,8 @@ void *freenect_threadfunc(void *arg)
 	}
 	
 	printf("\nshutting down streams...\n");
+	printf("%ld depth frames, %ld overwritten before they were read\n",
+		g_kinect_depth.published(), g_kinect_depth.overwritten());
 	
 	freenect_stop_depth(f_dev);
 	
@@ -182,8 +248,43 @@ void *freenect_threadfunc(void *arg)
 	printf("-- done!\n");
 	return NULL;
 }
+
+void stop_kinect(){
+
+	die = 1;
+	pthread_join( freenect_thread, NULL );
+}
 #endif
 
+void on_signal( int ){
+
+	atomic_store( &g_quit, 1 );
+}
+
+// CPU time of the process so far, all threads, in seconds
+double cpu_seconds(){
+
+#ifndef _WIN32
+	rusage usage;
+	getrusage( RUSAGE_SELF, &usage );
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6*( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec );
+#else
+	FILETIME created, exited, kernel, user;
+	GetProcessTimes( GetCurrentProcess(), &created, &exited, &kernel, &user );
+	return 1e-7*( ( (ULONGLONG)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime ) +
+				  ( (ULONGLONG)user.dwHighDateTime << 32 | user.dwLowDateTime ) );
+#endif
+}
+
+// CPU time per processed frame and the share of one core, since cpu0/t0
+void print_cpu_usage( long frames, double cpu0, int64 t0 ){
+
+	double cpu = cpu_seconds() - cpu0;
+	double seconds = (getTickCount()-t0)/getTickFrequency();
+	printf("cpu: %.2f ms per frame, %.0f%% of a core (%ld frames in %.1f s)\n",
+		   frames ? 1000*cpu/frames : 0.0, seconds > 0 ? 100*cpu/seconds : 0.0, frames, seconds);
+}
+
 void drawCylinder( const math_vector_3f& p1, const math_vector_3f& p2 , float radius, GLUquadric *quadric)
 {
 	math_vector_3f d = p2 - p1;
@@ -213,6 +314,13 @@ void drawCylinder( const math_vector_3f& p1, const math_vector_3f& p2 , float ra
 
 bool initialize(){
 
+	if( g_replay ){
+
+		g_im3D.create(g_im_h,g_im_w,CV_32FC3);
+		g_imD.create(g_im_h,g_im_w,CV_16UC1);
+		return true;
+	}
+
 	std::cout << "initializing kinect... " << endl;
 
 #ifdef USE_MS_SKD
@@ -287,8 +395,8 @@ bool initialize(){
 #endif
 
 #ifdef USE_LIBFREENECT
-  depth_mid = (uint16_t*)malloc(640*480*2);
-  depth_front = (uint16_t*)malloc(640*480*2);
+	for(int i=0;i<3;++i)
+		g_kinect_depth.slot(i).create(480,640,CV_16UC1);
 
 	if (freenect_init(&f_ctx, NULL) < 0) {
 		printf("freenect_init() failed\n");
@@ -320,6 +428,7 @@ bool initialize(){
 		freenect_shutdown(f_ctx);
 		return false;
 	}
+	atexit( stop_kinect );
 	freenect_raw_tilt_state state;
 	freenect_get_tilt_status(&state);
 	
@@ -338,6 +447,7 @@ void loadConfig(const char* filename) {
 
 	ifstream in(filename);
 	string dummy;
+	long stride = g_stride, th = g_th;
 
 	if(in.is_open()) {
 
@@ -359,13 +469,15 @@ void loadConfig(const char* filename) {
 		in >> g_smaller_radius_ratio;
 
 		in >> dummy;
-		in >> g_stride;
+		in >> stride;
+		g_stride = stride;
 
 		in >> dummy;
 		in >> g_max_z;
 
 		in >> dummy;
-		in >> g_th;
+		in >> th;
+		g_th = th;
 
 
 	} else {
@@ -387,7 +499,10 @@ void loadConfig(const char* filename) {
 }
 
 
-bool read_data( ){
+// copies the newest depth map of the sensor into depth, returns false if there is no new frame
+bool grab_sensor_depth( Mat& depth ){
+
+	depth.create(g_im_h,g_im_w,CV_16UC1);
 
 #ifdef USE_MS_SKD
 
@@ -420,7 +535,7 @@ bool read_data( ){
 			pTexture->LockRect( 0, &LockedRect, NULL, 0 );
 			if ( 0 != LockedRect.Pitch )
 			{
-				g_imD.setTo(0);
+				depth.setTo(0);
 
 				DWORD frameWidth, frameHeight;
 				NuiImageResolutionToSize( imageFrame.eResolution, frameWidth, frameHeight );
@@ -435,13 +550,13 @@ bool read_data( ){
 				int pixel = 0;
 				while ( pBufferRun < pBufferEnd )
 				{
-					USHORT depth     = *pBufferRun;
-					USHORT realDepth = NuiDepthPixelToDepth(depth);
+					USHORT depth_px  = *pBufferRun;
+					USHORT realDepth = NuiDepthPixelToDepth(depth_px);
          
 					int x = pixel%640;
 					int y = floor(float(pixel)/640.f);
 					
-					g_imD.at<int16_t>(y,x) = realDepth;
+					depth.at<int16_t>(y,x) = realDepth;
 
 					++pBufferRun;
 					++pixel;
@@ -470,40 +585,87 @@ bool read_data( ){
 	// Take current depth map
 	g_DepthGenerator.GetMetaData(g_depthMD);
 
+	memcpy( depth.data, g_depthMD.Data(), g_im_w*g_im_h*sizeof(uint16_t) );
+
 #endif
 #ifdef USE_LIBFREENECT
 	
-	uint16_t *tmp;
-	
-	if (got_depth) {
-		tmp = depth_front;
-		depth_front = depth_mid;
-		depth_mid = tmp;
-		got_depth = 0;
-	} else {
-		return false; //?? 
-	}
+	//newest frame of the capture thread, frames it published meanwhile are skipped.
+	//Sleeps until there is one, the timeout only lets the callers look at g_quit
+	if( !g_kinect_depth.wait_update( 100 ) )
+		return false;
+
+	g_kinect_depth.front().copyTo( depth );
 #endif
 
+	return true;
+}
+
+// next frame of the recording. In real time it behaves like the sensor: waits for the
+// frame to be due and skips the frames that went by while the last one was processed
+bool replay_depth( Mat& depth ){
+
+	if( g_replay_frame >= g_replay->frames() ){
+		atomic_store( &g_quit, 1 ); //the headless loops end with the recording
+		return false;
+	}
+
+	double now = getTickCount()/getTickFrequency();
+	if( g_replay_frame == 0 )
+		g_replay_start = now;
+
+	if( !g_replay_fast ){
+
+		double t = g_replay->timestamp(0) + ( now - g_replay_start );
+		double due = g_replay->timestamp( g_replay_frame );
+
+		if( due > t )
+			usleep( (useconds_t)( (due-t)*1e6 ) );
+		else
+			while( g_replay_frame+1 < g_replay->frames() && g_replay->timestamp( g_replay_frame+1 ) <= t ){
+				g_replay_frame++;
+				g_replay_skipped++;
+			}
+	}
+
+	return g_replay->read( g_replay_frame++, depth );
+}
+
+// depth from the sensor or the replayed recording, recorded if --record is on
+bool grab_depth( Mat& depth ){
+
+	bool ok = g_replay ? replay_depth( depth ) : grab_sensor_depth( depth );
+
+	if( ok && g_recorder )
+		g_recorder->write( depth, getTickCount()/getTickFrequency() );
+
+	return ok;
+}
+
+void close_recording(){
+
+	if( g_recorder && g_recorder->is_open() ){
+		printf("recorded %u frames\n", g_recorder->frames());
+		g_recorder->close();
+	}
+}
+
+// generates the 3D image from a depth map, returns the number of valid pixels
+int depth_to_3d( const Mat& depth, Mat& im3D ){
+
+	im3D.create(depth.rows,depth.cols,CV_32FC3);
+
 	int valid_pixels = 0;
 	float d = 0.f;
 	
-	int ii = 0;
-	//generate 3D image
-	for(int y = 0; y < g_im3D.rows; y++)
+	for(int y = 0; y < im3D.rows; y++)
 	{
-		Vec3f* Mi = g_im3D.ptr<Vec3f>(y);
-		for(int x = 0; x < g_im3D.cols; x++){
+		Vec3f* Mi = im3D.ptr<Vec3f>(y);
+		const uint16_t* Di = depth.ptr<uint16_t>(y);
 
-#ifdef USE_MS_SKD
-			d = float( g_imD.at<int16_t>(y,x) );
-#endif
-#ifdef USE_OPENNI
-			d = (float)g_depthMD(x,y);
-#endif
-#ifdef USE_LIBFREENECT
-			d = (float)depth_mid[ii++];
-#endif
+		for(int x = 0; x < im3D.cols; x++){
+
+			d = (float)Di[x];
 			
 			if ( d < g_max_z && d > 0 ){
 
@@ -520,8 +682,19 @@ bool read_data( ){
 		}
 	}
 
+	return valid_pixels;
+}
+
+bool read_data( ){
+
+	if( !grab_depth( g_imD ) )
+		return false;
+
+	//generate 3D image
+	int valid_pixels = depth_to_3d( g_imD, g_im3D );
+
 	//this part is to set the camera position, depending on what's in the scene
-	if (g_first_rigid ) {
+	if (g_first_rigid && show_visual ) {
 
 		if( valid_pixels > 10000){ //wait for something to be in the image
 
@@ -557,8 +730,9 @@ bool read_data( ){
 				}
 			}
 
-			g_camera.resetview( math_vector_3f(gravity[0],gravity[1],gravity[2]), maxDist );
-			g_camera.rotate_180();
+			//the viewer places its camera with it, on its own thread
+			g_scene_center = gravity;
+			g_scene_radius = maxDist;
 			g_first_rigid = false;
 		}
 	}
@@ -566,48 +740,177 @@ bool read_data( ){
 	return true;
 }
 
+// hands the poses to the OSC sender thread, which sends one bundle per frame,
+// and writes them to the shared memory ring
+//ids = user id of each pose, output order if null
+void send_poses( const std::vector< cv::Vec<float,POSE_SIZE> >& means,
+				 const std::vector< float >& confidence,
+				 const std::vector< int >* ids = 0 ){
+
+	// OSC by Matthias Kronlachner
+	#ifdef LIBLO
+	if (send_osc)
+		g_osc.send( means, ids );
+	#endif
+
+	if( g_pose_ring ){
+
+		static std::vector< PoseRecord > records;
+		records.resize( means.size() );
+
+		for(unsigned int i=0;i<means.size();++i){
+
+			records[i].id = ids ? (*ids)[i] : i;
+			for(int n=0;n<6;++n)
+				records[i].pose[n] = means[i][n];
+			records[i].confidence = confidence[i];
+
+		}
+
+		g_pose_ring->write_frame( g_frame_no, records.empty() ? 0 : &records[0], records.size() );
+	}
+
+	//every frame, also without heads, so subscribers know the estimator is alive
+	if( g_pose_server ){
+
+		//all of them, the server counts those beyond its limit
+		static std::vector< PoseStreamHead > heads;
+		heads.resize( means.size() );
+
+		for(unsigned int i=0;i<means.size();++i){
+
+			heads[i].id = ids ? (*ids)[i] : i;
+			for(int n=0;n<6;++n)
+				heads[i].pose[n] = means[i][n];
+			heads[i].confidence = confidence[i];
+
+		}
+
+		g_pose_server->publish( g_frame_no, heads.empty() ? 0 : &heads[0], heads.size() );
+	}
+
+}
+
+void stop_pose_server(){
+
+	if( g_pose_server && g_pose_server->running() ){
+		g_pose_server->stop();
+		g_pose_server->print_stats( cout );
+	}
+}
+
+void close_pose_ring(){
+
+	if( g_pose_ring )
+		g_pose_ring->close();
+}
+
+void stop_osc(){
+
+	#ifdef LIBLO
+	if( g_osc.running() ){
+		g_osc.stop();
+		g_osc.print_stats( cout );
+	}
+	#endif
+}
+
+// console output of the headless mode
+void print_poses( const std::vector< cv::Vec<float,POSE_SIZE> >& means ){
+
+	if(means.size()>0){
+	
+		cout << means.size() << " " << flush;
+
+		for(uint v=0;v<6;v++)
+			cout << means[0][v] << " ";
+		cout << endl;
+	}
+
+}
+
+EstimationParams estimation_params(){
+
+	EstimationParams params;
+	params.stride = atomic_load( &g_stride );
+	params.max_variance = g_maxv;
+	params.prob_th = g_prob_th;
+	params.larger_radius_ratio = g_larger_radius_ratio;
+	params.smaller_radius_ratio = g_smaller_radius_ratio;
+	params.threshold = atomic_load( &g_th );
+	return params;
+
+}
+
 bool process() {
 
 	if( read_data() ){
 
 		g_means.clear();
+		g_confidence.clear();
 		g_votes.clear();
 		g_clusters.clear();
 
+		//one snapshot of what the viewer thread may change, for the whole frame
+		EstimationParams params = estimation_params();
+		bool show_votes = atomic_load( &g_show_votes ) != 0;
+
 		//do the actual estimation
-		g_Estimate->estimate( 	g_im3D,
+		if( show_votes ){
+
+			g_Estimate->estimate( 	g_im3D,
 									g_means,
 									g_clusters,
 									g_votes,
-									g_stride,
-									g_maxv,
-									g_prob_th,
-									g_larger_radius_ratio,
-									g_smaller_radius_ratio,
+									params.stride,
+									params.max_variance,
+									params.prob_th,
+									params.larger_radius_ratio,
+									params.smaller_radius_ratio,
 									false,
-									g_th
+									params.threshold
 								);
 
-		// OSC by Matthias Kronlachner
-		#ifdef LIBLO
-		if (send_osc)
-		{
-			for(unsigned int i=0;i<g_means.size();++i) {
-
-				float x = g_means[i][0];
-				float y = g_means[i][1];
-				float z = g_means[i][2];		
-				float pitch = g_means[i][3];
-				float yaw = g_means[i][4];
-				float roll = g_means[i][5];
-			
-				//cout << "user: " << i << "pitch: " << pitch << " yaw: " << yaw << " roll: " << roll << endl;
+			float th = (float)g_Estimate->head_threshold( params.threshold, params.stride );
+			for(unsigned int i=0;i<g_clusters.size();++i)
+				g_confidence.push_back( g_clusters[i].size()/th );
+		}
+		else if( g_tracker ){
+
+			//full detection only every g_track_every frames
+			g_tracker->set_params( params );
+			const std::vector< TrackedHead >& heads = g_tracker->update( g_im3D, getTickCount()/getTickFrequency() );
 
-				lo_send(addr,"/head_pose", "fffffff", (float)i, x, y, z, pitch, yaw, roll);
-				
+			g_ids.clear();
+			for(unsigned int i=0;i<heads.size();++i){
+				g_means.push_back( heads[i].pose );
+				g_confidence.push_back( heads[i].confidence );
+				g_ids.push_back( heads[i].id );
 			}
+
+			if( !show_visual && g_tracker->frames()%300 == 0 )
+				printf("tracker: %ld frames, %ld full detections, %ld skipped, %ld failed verifications\n",
+					   g_tracker->frames(), g_tracker->full_detections(),
+					   g_tracker->skipped_detections(), g_tracker->failed_verifications() );
+		}
+		else{
+
+			//the votes are not drawn, only the poses are needed
+			g_Estimate->estimate_poses( g_im3D, g_heads, params, &g_workspace );
+
+			for(unsigned int i=0;i<g_heads.size();++i){
+				g_means.push_back( g_heads[i].pose );
+				g_confidence.push_back( g_heads[i].confidence );
+			}
+
+			const MeanShiftStats& stats = g_workspace.stats;
+			if( !show_visual && g_workspace.warm_start && stats.frames%300 == 0 )
+				printf("mean shift: %ld frames, %.1f seeds and %.1f iterations per frame, %ld warm started clusters\n",
+					   stats.frames, stats.seeds/(float)stats.frames,
+					   stats.iterations/(float)stats.frames, stats.warm_clusters );
 		}
-		#endif
+
+		send_poses( g_means, g_confidence, ( g_tracker && !show_votes ) ? &g_ids : 0 );
 
 		//if(g_means.size()>0)
 		//	cout << g_means[0][0] << " " << g_means[0][1] << " " << g_means[0][2] << endl;
@@ -618,6 +921,122 @@ bool process() {
 
 }
 
+// pipeline stages for the headless mode, same work as process() split over threads
+bool stage_capture( PipelineFrame& frame, void* ){
+
+	frame.params = estimation_params();
+	return grab_depth( frame.depth );
+}
+
+bool stage_ingest( PipelineFrame& frame, void* ){
+
+	depth_to_3d( frame.depth, frame.im3D );
+	return true;
+}
+
+bool stage_regression( PipelineFrame& frame, void* ){
+
+	frame.votes.clear();
+	const EstimationParams& p = frame.params;
+	g_Estimate->do_regression( frame.im3D, p.stride, p.max_variance, p.prob_th, frame.votes );
+	return true;
+}
+
+bool stage_clustering( PipelineFrame& frame, void* ){
+
+	frame.means.clear();
+	frame.clusters.clear();
+	g_Estimate->estimate_from_votes( frame.votes,
+									 frame.means,
+									 frame.clusters,
+									 frame.params.stride,
+									 frame.params.larger_radius_ratio,
+									 frame.params.smaller_radius_ratio,
+									 false,
+									 frame.params.threshold );
+	return true;
+}
+
+bool stage_output( PipelineFrame& frame, void* ){
+
+	static std::vector< float > confidence;
+	confidence.resize( frame.means.size() );
+	float th = (float)g_Estimate->head_threshold( frame.params.threshold, frame.params.stride );
+	for(unsigned int i=0;i<frame.means.size();++i)
+		confidence[i] = frame.clusters.size(i)/th;
+
+	send_poses( frame.means, confidence );
+	print_poses( frame.means );
+	g_frame_no++;
+	return true;
+}
+
+// hands what the viewer needs of the last processed frame over to it
+void publish_view(){
+
+	ViewFrame& view = g_view.back();
+	view.frame = g_frame_no;
+
+	int step = MAX( 1, g_view_step );
+	view.cloud.create( (g_im3D.rows+step-1)/step, (g_im3D.cols+step-1)/step, CV_32FC3 );
+	for(int y=0;y<view.cloud.rows;++y){
+
+		const Vec3f* Mi = g_im3D.ptr<Vec3f>(y*step);
+		Vec3f* Vi = view.cloud.ptr<Vec3f>(y);
+		for(int x=0;x<view.cloud.cols;++x)
+			Vi[x] = Mi[x*step];
+	}
+
+	view.means = g_means;
+
+	view.votes.resize( g_votes.size() );
+	for(unsigned int i=0;i<g_votes.size();++i)
+		view.votes[i] = Vec3f( g_votes[i].vote[0], g_votes[i].vote[1], g_votes[i].vote[2] );
+
+	view.clusters.resize( g_clusters.size() );
+	for(unsigned int c=0;c<g_clusters.size();++c){
+
+		view.clusters[c].resize( g_clusters[c].size() );
+		for(unsigned int i=0;i<g_clusters[c].size();++i)
+			view.clusters[c][i] = Vec3f( g_clusters[c][i]->vote[0], g_clusters[c][i]->vote[1], g_clusters[c][i]->vote[2] );
+	}
+
+	view.has_scene = !g_first_rigid;
+	view.scene_center = g_scene_center;
+	view.scene_radius = g_scene_radius;
+
+	g_view.publish();
+}
+
+// estimation with the visualization, never waits for the viewer
+void *estimation_threadfunc(void *arg)
+{
+	while( !atomic_load( &g_quit ) ){
+
+		if( !process() )
+			continue;
+
+		g_frame_no++;
+		publish_view();
+	}
+
+	return NULL;
+}
+
+void stop_estimation(){
+
+	if( !g_estimating )
+		return;
+
+	atomic_store( &g_quit, 1 );
+	pthread_join( g_estimation_thread, NULL );
+	g_estimating = false;
+
+	double seconds = (getTickCount()-g_estimation_t0)/getTickFrequency();
+	printf("estimation: %d frames in %.1f s (%.1f fps), %ld drawn, %ld not drawn\n",
+		   g_frame_no, seconds, seconds > 0 ? g_frame_no/seconds : 0.0, g_view_drawn, g_view.overwritten());
+}
+
 // ##############################################################################
 void key(int _k, int, int) {
 
@@ -634,8 +1053,9 @@ void key(int _k, int, int) {
 
 		case 's': {
 
-			g_show_votes = !g_show_votes;
-			cout << "toggled votes " << g_show_votes << endl;
+			long show_votes = !atomic_load( &g_show_votes );
+			atomic_store( &g_show_votes, show_votes );
+			cout << "toggled votes " << show_votes << endl;
 			break;
 
 		}
@@ -650,35 +1070,38 @@ void key(int _k, int, int) {
 
 		case '+': {
 
-			g_stride++;
-			cout << "stride : " << g_stride << endl;
+			long stride = atomic_load( &g_stride ) + 1;
+			atomic_store( &g_stride, stride );
+			cout << "stride : " << stride << endl;
 			break;
 
 		}
 		case '-':{
 
-			g_stride = MAX(0, g_stride-1);
-			cout << "stride : " << g_stride << endl;
+			long stride = MAX(1, atomic_load( &g_stride ) - 1);
+			atomic_store( &g_stride, stride );
+			cout << "stride : " << stride << endl;
 			break;
 
 		}
 		case '*': {
 
-			g_th += 20;
-			cout << "head threshold : " << g_th << endl;
+			long th = atomic_load( &g_th ) + 20;
+			atomic_store( &g_th, th );
+			cout << "head threshold : " << th << endl;
 			break;
 		}
 
 		case '/':{
 
-			g_th -= 20;
-			cout << "head threshold : " << g_th << endl;
+			long th = atomic_load( &g_th ) - 20;
+			atomic_store( &g_th, th );
+			cout << "head threshold : " << th << endl;
 			break;
 		}
 			
 		case 'q':{
 			
-			//kill = true;
 			printf("Goodbye..... \n");
 			exit (0);
 			break;
@@ -731,7 +1154,7 @@ void key(int _k, int, int) {
 		break;
 
 	}
-	glutSwapBuffers();
+	glutPostRedisplay();
 
 }
 
@@ -746,6 +1169,7 @@ void mm(int x, int y)
 {
 	y = h-y;
 	g_camera.mouse_move(x,y);
+	glutPostRedisplay();
 
 }
 
@@ -776,109 +1200,127 @@ void mb(int button, int state, int x, int y)
 		g_camera.mouse_wheel(-20);
 	}
 
+	glutPostRedisplay();
 
 }
 
+// redraws when the estimation thread published a new frame, at most g_view_fps times a second
 void idle(){
 	
-		process();
-		g_frame_no++;
-
-}
-
-// draws the scan and the estimated head pose
-void draw()
-{
-	if(1){
-
-		glEnable(GL_NORMALIZE);
-		glEnable(GL_DEPTH_TEST);
+		if( atomic_load( &g_quit ) )
+			exit(0);
+
+		double now = getTickCount()/getTickFrequency();
+		double wait = g_last_draw + 1.0/g_view_fps - now;
+		if( wait > 0 ){
+			usleep( (useconds_t)( wait*1e6 ) );
+			return;
+		}
 
-		g_camera.set_viewport(0,0,w,h);
-		g_camera.setup();
-		g_camera.use_light(true);
+		//sleeps for at most a frame of the viewer, to stay responsive to the mouse
+		if( g_view.wait_update( (int)( 1000/g_view_fps ) ) ){
+			g_last_draw = now;
+			glutPostRedisplay();
+		}
 
-		glClearColor(1,1,1,1);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glDisable(GL_CULL_FACE);
+}
 
-		glPushMatrix();
-		glColor3f(0.9f,0.9f,1.f);
+// vertex and normal arrays of the point cloud (or the triangles between neighbouring points)
+void build_mesh( const Mat& cloud, bool triangles, int step ){
 
-		if(g_draw_triangles){
+	g_mesh_vertices.clear();
+	g_mesh_normals.clear();
 
-			math_vector_3f d1,d2;
-			glBegin(GL_TRIANGLES);
+	math_vector_3f d1,d2;
 
-			for(int y = 0; y < g_im3D.rows-1; y++)
-			{
+	for(int y = 0; y < cloud.rows-1; y++)
+	{
 
-				const Vec3f* Mi = g_im3D.ptr<Vec3f>(y);
-				const Vec3f* Mi1 = g_im3D.ptr<Vec3f>(y+1);
+		const Vec3f* Mi = cloud.ptr<Vec3f>(y);
+		const Vec3f* Mi1 = cloud.ptr<Vec3f>(y+1);
 
-				for(int x = 0; x < g_im3D.cols-1; x++){
+		for(int x = 0; x < cloud.cols-1; x++){
 
-					if( Mi[x][2] <= 0 || Mi1[x][2] <= 0 || Mi[x+1][2] <= 0 || Mi1[x+1][2] <= 0 )
-						continue;
+			if( Mi[x][2] <= 0 )
+				continue;
+			if( triangles && ( Mi1[x][2] <= 0 || Mi[x+1][2] <= 0 || Mi1[x+1][2] <= 0 ) )
+				continue;
 
-					d1[0] = Mi[x][0] - Mi1[x][0];// v1 - v2;
-					d1[1] = Mi[x][1] - Mi1[x][1];
-					d1[2] = Mi[x][2] - Mi1[x][2];
+			d1[0] = Mi[x][0] - Mi1[x][0];// v1 - v2;
+			d1[1] = Mi[x][1] - Mi1[x][1];
+			d1[2] = Mi[x][2] - Mi1[x][2];
 
-					d2[0] = Mi[x+1][0] - Mi1[x][0];// v1 - v2;
-					d2[1] = Mi[x+1][1] - Mi1[x][1];
-					d2[2] = Mi[x+1][2] - Mi1[x][2];
+			d2[0] = Mi[x+1][0] - Mi1[x][0];// v1 - v2;
+			d2[1] = Mi[x+1][1] - Mi1[x][1];
+			d2[2] = Mi[x+1][2] - Mi1[x][2];
 
-					if ( fabs(d2[2])>20 || fabs(d1[2])>20 )
-						continue;
+			math_vector_3f norm = cross_product(d2,d1);
+			Vec3f n( norm[0], norm[1], norm[2] );
 
-					math_vector_3f norm = cross_product(d2,d1);
+			if( !triangles ){
+				g_mesh_vertices.push_back( Mi[x] );
+				g_mesh_normals.push_back( n );
+				continue;
+			}
 
-					glNormal3f(norm[0],norm[1],norm[2]);
-					glVertex3f(Mi[x][0],Mi[x][1],Mi[x][2]);
-					glVertex3f(Mi1[x][0],Mi1[x][1],Mi1[x][2]);
-					glVertex3f(Mi[x+1][0],Mi[x+1][1],Mi[x+1][2]);
-					glVertex3f(Mi1[x][0],Mi1[x][1],Mi1[x][2]);
-					glVertex3f(Mi1[x+1][0],Mi1[x+1][1],Mi1[x+1][2]);
-					glVertex3f(Mi[x+1][0],Mi[x+1][1],Mi[x+1][2]);
+			//the neighbours are step pixels apart
+			if ( fabs(d2[2])>20*step || fabs(d1[2])>20*step )
+				continue;
 
-				}
+			const Vec3f* corners[6] = { &Mi[x], &Mi1[x], &Mi[x+1], &Mi1[x], &Mi1[x+1], &Mi[x+1] };
+			for(int i=0;i<6;++i){
+				g_mesh_vertices.push_back( *corners[i] );
+				g_mesh_normals.push_back( n );
 			}
-			glEnd();
 
 		}
-		else{
+	}
 
-			math_vector_3f d1,d2;
-			glBegin(GL_POINTS);
+}
 
-			for(int y = 0; y < g_im3D.rows-1; y++)
-			{
+// draws the scan and the estimated head pose of the newest frame of the estimation thread
+void draw()
+{
+	const ViewFrame& view = g_view.front();
 
-				const Vec3f* Mi = g_im3D.ptr<Vec3f>(y);
-				const Vec3f* Mi1 = g_im3D.ptr<Vec3f>(y+1);
+	if( g_view.front_seq() >= 0 && view.has_scene && !g_view_placed ){
 
-				for(int x = 0; x < g_im3D.cols-1; x++){
+		g_camera.resetview( math_vector_3f(view.scene_center[0],view.scene_center[1],view.scene_center[2]), view.scene_radius );
+		g_camera.rotate_180();
+		g_view_placed = true;
+	}
 
-					if( Mi[x][2] <= 0 || Mi[x][2] <= 0 )
-						continue;
+	if(1){
 
-					d1[0] = Mi[x][0] - Mi1[x][0];// v1 - v2;
-					d1[1] = Mi[x][1] - Mi1[x][1];
-					d1[2] = Mi[x][2] - Mi1[x][2];
+		glEnable(GL_NORMALIZE);
+		glEnable(GL_DEPTH_TEST);
 
-					d2[0] = Mi[x+1][0] - Mi1[x][0];// v1 - v2;
-					d2[1] = Mi[x+1][1] - Mi1[x][1];
-					d2[2] = Mi[x+1][2] - Mi1[x][2];
+		g_camera.set_viewport(0,0,w,h);
+		g_camera.setup();
+		g_camera.use_light(true);
 
-					math_vector_3f norm = cross_product(d2,d1);
-					glNormal3f(norm[0],norm[1],norm[2]);
-					glVertex3f(Mi[x][0],Mi[x][1],Mi[x][2]);
+		glClearColor(1,1,1,1);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glDisable(GL_CULL_FACE);
 
-				}
-			}
-			glEnd();
+		glPushMatrix();
+		glColor3f(0.9f,0.9f,1.f);
 
+		if( g_view.front_seq() >= 0 && ( g_mesh_frame != g_view.front_seq() || g_mesh_triangles != g_draw_triangles ) ){
+			build_mesh( view.cloud, g_draw_triangles, MAX( 1, g_view_step ) );
+			g_mesh_frame = g_view.front_seq();
+			g_mesh_triangles = g_draw_triangles;
+		}
+
+		if( !g_mesh_vertices.empty() ){
+
+			glEnableClientState( GL_VERTEX_ARRAY );
+			glEnableClientState( GL_NORMAL_ARRAY );
+			glVertexPointer( 3, GL_FLOAT, 0, &g_mesh_vertices[0] );
+			glNormalPointer( GL_FLOAT, 0, &g_mesh_normals[0] );
+			glDrawArrays( g_mesh_triangles ? GL_TRIANGLES : GL_POINTS, 0, (GLsizei)g_mesh_vertices.size() );
+			glDisableClientState( GL_NORMAL_ARRAY );
+			glDisableClientState( GL_VERTEX_ARRAY );
 		}
 
 		glPopMatrix();
@@ -888,16 +1330,16 @@ void draw()
 		gluQuadricNormals(quadric, GLU_SMOOTH);
 
 		//draw head poses
-		if(g_means.size()>0){
+		if(view.means.size()>0){
 
 			glColor3f( 0, 1, 0);
 			float mult = 0.0174532925f;
 
-			for(unsigned int i=0;i<g_means.size();++i){
+			for(unsigned int i=0;i<view.means.size();++i){
 
 				rigid_motion<float> rm;
-				rm.m_rotation = euler_to_rotation_matrix( mult*g_means[i][3], mult*g_means[i][4], mult*g_means[i][5] );
-				math_vector_3f head_center( g_means[i][0], g_means[i][1], g_means[i][2] );
+				rm.m_rotation = euler_to_rotation_matrix( mult*view.means[i][3], mult*view.means[i][4], mult*view.means[i][5] );
+				math_vector_3f head_center( view.means[i][0], view.means[i][1], view.means[i][2] );
 
 				glPushMatrix();
 				glTranslatef( head_center[0], head_center[1], head_center[2] );
@@ -914,21 +1356,21 @@ void draw()
 		}
 
 		//draw the single votes
-		if(g_show_votes){
+		if( atomic_load( &g_show_votes ) ){
 
 			int rate = 1;
 			glColor3f( 0 , 0, 1);
 
-			for (unsigned int i = 0; i<g_votes.size();i+=rate){
+			for (unsigned int i = 0; i<view.votes.size();i+=rate){
 
 				glPushMatrix();
-				glTranslatef( g_votes[i].vote[0], g_votes[i].vote[1], g_votes[i].vote[2] );
+				glTranslatef( view.votes[i][0], view.votes[i][1], view.votes[i][2] );
 				gluSphere( point, 2.f, 10, 10 );
 				glPopMatrix();
 
 			}
 
-			for(unsigned int c=0;c<g_clusters.size();c++){
+			for(unsigned int c=0;c<view.clusters.size();c++){
 
 				switch(c%5){
 
@@ -941,10 +1383,10 @@ void draw()
 
 				}
 
-				for(unsigned int i=0;i<g_clusters[c].size();i+=rate){
+				for(unsigned int i=0;i<view.clusters[c].size();i+=rate){
 
 					glPushMatrix();
-					glTranslatef(  g_clusters[c][i]->vote[0],  g_clusters[c][i]->vote[1],  g_clusters[c][i]->vote[2] );
+					glTranslatef(  view.clusters[c][i][0],  view.clusters[c][i][1],  view.clusters[c][i][2] );
 					gluSphere( point, 3.f, 10, 10 );
 					glPopMatrix();
 
@@ -960,7 +1402,7 @@ void draw()
 	}
 
 	glutSwapBuffers();
-	glutPostRedisplay();
+	g_view_drawn++;
 
 }
 
@@ -969,10 +1411,117 @@ int main(int argc, char* argv[])
 
 	if( argc < 2 ){
 
-		cout << "usage: ./head_demo config_file <show_visual send_osc osc_ip osc_port>" << endl;
+		cout << "usage: ./head_demo config_file <show_visual send_osc osc_ip osc_port> [options]" << endl;
+		cout << "options:" << endl;
+		cout << "  --pipeline <depth>   headless only: run capture, ingest, regression, clustering" << endl;
+		cout << "                       and output on separate threads with <depth> frames in flight" << endl;
+		cout << "  --track <n>          track heads with stable OSC user ids, full detection only" << endl;
+		cout << "                       every n frames, otherwise only checked around their last pose" << endl;
+		cout << "  --warm-start         start the mean shift from the heads of the previous frame" << endl;
+		cout << "  --record <file>      write the depth frames with timestamps into a recording" << endl;
+		cout << "  --replay <file>      use a recording instead of the sensor, in real time" << endl;
+		cout << "  --fast               replay as fast as possible" << endl;
+		cout << "  --shm <name>         also write the poses to a shared memory ring for local consumers" << endl;
+		cout << "  --serve <address>    stream the poses to subscribers over TCP (port: local only, or host:port)" << endl;
+		cout << "                       or a Unix domain socket (path)" << endl;
+		cout << "  --view-step <n>      visualization: draw every n-th point of the scan (default 2)" << endl;
+		cout << "  --view-fps <hz>      visualization: redraw at most hz times a second (default 30)" << endl;
+		exit(-1);
+	}
+
+	//positional arguments end at the first option
+	int n_args = argc;
+	for(int i=2;i<argc;++i){
+		if( strncmp(argv[i], "--", 2) == 0 ){
+			n_args = i;
+			break;
+		}
+	}
+
+	const char* record_file = 0;
+	const char* replay_file = 0;
+	const char* shm_name = 0;
+	const char* serve_address = 0;
+
+	for(int i=n_args;i<argc;++i){
+
+		if( strcmp(argv[i], "--pipeline") == 0 && i+1 < argc )
+			g_pipeline_depth = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--track") == 0 && i+1 < argc )
+			g_track_every = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--warm-start") == 0 )
+			g_workspace.warm_start = true;
+		else if( strcmp(argv[i], "--record") == 0 && i+1 < argc )
+			record_file = argv[++i];
+		else if( strcmp(argv[i], "--replay") == 0 && i+1 < argc )
+			replay_file = argv[++i];
+		else if( strcmp(argv[i], "--fast") == 0 )
+			g_replay_fast = true;
+		else if( strcmp(argv[i], "--shm") == 0 && i+1 < argc )
+			shm_name = argv[++i];
+		else if( strcmp(argv[i], "--serve") == 0 && i+1 < argc )
+			serve_address = argv[++i];
+		else if( strcmp(argv[i], "--view-step") == 0 && i+1 < argc )
+			g_view_step = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--view-fps") == 0 && i+1 < argc )
+			g_view_fps = atof(argv[++i]);
+		else {
+			cerr << "unknown option " << argv[i] << endl;
+			exit(-1);
+		}
+
+	}
+
+	//the pipeline stages only run the plain estimation
+	if( g_pipeline_depth > 0 && g_track_every > 0 ){
+		cerr << "--track cannot be used with --pipeline" << endl;
+		exit(-1);
+	}
+	if( g_pipeline_depth > 0 && g_workspace.warm_start ){
+		cerr << "--warm-start cannot be used with --pipeline" << endl;
 		exit(-1);
 	}
 
+	//at least every point and one redraw a second
+	g_view_step = MAX( 1, g_view_step );
+	g_view_fps = MAX( 1.0, g_view_fps );
+
+	if( replay_file ){
+
+		g_replay = new DepthRecording();
+		if( !g_replay->open( replay_file ) )
+			exit(-1);
+		g_im_w = g_replay->width();
+		g_im_h = g_replay->height();
+		printf("replaying %u frames (%.1f s)\n", g_replay->frames(), g_replay->duration());
+	}
+
+	if( record_file ){
+
+		g_recorder = new DepthRecorder();
+		if( !g_recorder->open( record_file, g_im_w, g_im_h ) )
+			exit(-1);
+		atexit( close_recording );
+	}
+
+	if( shm_name ){
+
+		g_pose_ring = new PoseRing();
+		if( !g_pose_ring->create( shm_name ) )
+			exit(-1);
+		atexit( close_pose_ring );
+		printf("Writing the poses to shared memory %s\n", shm_name);
+	}
+
+	if( serve_address ){
+
+		g_pose_server = new PoseServer();
+		if( !g_pose_server->start( serve_address ) )
+			exit(-1);
+		atexit( stop_pose_server );
+		printf("Serving the poses on %s\n", serve_address);
+	}
+
 	loadConfig( argv[1] );
 	g_Estimate =  new CRForestEstimator();
 	if( !g_Estimate->load_forest(g_treepath.c_str(), g_ntrees) ){
@@ -981,13 +1530,20 @@ int main(int argc, char* argv[])
 		exit(-1);
 	}
 
+	if( g_track_every > 0 ){
+
+		TrackerParams tparams;
+		tparams.detect_every = g_track_every;
+		g_tracker = new HeadTracker( g_Estimate, estimation_params(), tparams );
+	}
+
 	if(!initialize()){
 		cerr << "could not initialize Kinect!" << endl;
 		exit(-1);
 	}
 
 	// visual on or off by MK
-	if (argc > 2) {
+	if (n_args > 2) {
 		if (atoi(argv[2]) == 0)
 		{ 
 			show_visual = FALSE;
@@ -997,7 +1553,7 @@ int main(int argc, char* argv[])
 	}
 
 	// osc on or off by MK
-	if (argc > 3) {
+	if (n_args > 3) {
 		if (atoi(argv[3]) == 0)
 		{ 
 			send_osc = FALSE;
@@ -1010,20 +1566,38 @@ int main(int argc, char* argv[])
 	// OSC by Matthias Kronlachner
 	if (send_osc)
 	{
-		if (argc > 4) {
+		if (n_args > 4) {
 			ADDRESS = argv[4];
 		}
-		if (argc > 5) {
+		if (n_args > 5) {
 			PORT = argv[5];
 		}
-		addr = lo_address_new(ADDRESS, PORT);
-		printf("Configured to send OSC messages to %s:%s\n", ADDRESS, PORT);
+		if( !g_osc.start(ADDRESS, PORT) ){
+			cerr << "could not start sending OSC to " << ADDRESS << ":" << PORT << endl;
+			exit(-1);
+		}
+		atexit( stop_osc );
+		printf("Configured to send OSC bundles to %s:%s\n", ADDRESS, PORT);
 	}
 	#endif
 
 	
 
+	//the outputs are closed by their atexit handlers on the way out
+	signal( SIGINT, on_signal );
+	signal( SIGTERM, on_signal );
+
 	if(show_visual){
+
+		//the estimation runs on its own thread, the GLUT thread only draws
+		g_estimation_t0 = getTickCount();
+		if( pthread_create( &g_estimation_thread, NULL, estimation_threadfunc, NULL ) ){
+			cerr << "could not start the estimation thread!" << endl;
+			exit(-1);
+		}
+		g_estimating = true;
+		atexit( stop_estimation );
+
 		// initialize GLUT
 		glutInitWindowSize(800, 600);
 		glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
@@ -1038,25 +1612,71 @@ int main(int argc, char* argv[])
 		glutIdleFunc(idle);
 		glutMainLoop();
 	}
+	else if(g_pipeline_depth > 0){
+
+		g_pipeline.add_stage( "capture", stage_capture );
+		g_pipeline.add_stage( "ingest", stage_ingest );
+		g_pipeline.add_stage( "regression", stage_regression );
+		g_pipeline.add_stage( "clustering", stage_clustering );
+		g_pipeline.add_stage( "output", stage_output );
+
+		if( !g_pipeline.start( g_pipeline_depth ) ){
+			cerr << "could not start the pipeline!" << endl;
+			exit(-1);
+		}
+		printf("Running pipelined with %d frames in flight\n", g_pipeline_depth);
+
+		int64 t0 = getTickCount();
+		double cpu0 = cpu_seconds();
+
+		//a signal cuts the sleep short
+		for(int s=1; !atomic_load( &g_quit ); ++s){
+
+			sleep(1);
+			if( s%10 == 0 ){
+				g_pipeline.print_stats( cout );
+				print_cpu_usage( g_pipeline.stage_stats( g_pipeline.stages()-1 ).frames, cpu0, t0 );
+				#ifdef LIBLO
+				if( send_osc )
+					g_osc.print_stats( cout );
+				#endif
+				if( g_pose_server )
+					g_pose_server->print_stats( cout );
+			}
+
+		}
+
+		g_pipeline.stop();
+		g_pipeline.print_stats( cout );
+		print_cpu_usage( g_pipeline.stage_stats( g_pipeline.stages()-1 ).frames, cpu0, t0 );
+	}
 	else{
 
-		while(!kill){
+		int64 t0 = getTickCount();
+		double cpu0 = cpu_seconds();
+		long frames = 0;
 
-			process();
+		//process() waits for the next frame of the sensor or until the replayed one is due
+		while(!atomic_load( &g_quit )){
 
-			
-			if(g_means.size()>0){
-			
-				cout << g_means.size() << " " << flush;
+			if( !process() )
+				continue;
 
-				for(uint v=0;v<6;v++)
-					cout << g_means[0][v] << " ";
-				cout << endl;
-			}
+			print_poses( g_means );
 			g_frame_no++;
 
+			if( ++frames%300 == 0 )
+				print_cpu_usage( frames, cpu0, t0 );
+
+		}
 
+		if( g_replay ){
+			double seconds = (getTickCount()-t0)/getTickFrequency();
+			unsigned int processed = g_replay_frame - g_replay_skipped;
+			printf("replay: %u frames processed in %.2f s (%.1f fps), %u skipped\n",
+				   processed, seconds, processed/seconds, g_replay_skipped);
 		}
+		print_cpu_usage( frames, cpu0, t0 );
 	}
 
 	return 0;
@@ -0,0 +1,149 @@
+#include "osc_sender.hpp"
+
+#include <stdio.h>
+
+using namespace std;
+
+OscSender::OscSender() : m_addr(0), m_running(false){
+
+	m_stop = 0;
+	m_sent = m_coalesced = m_dropped = m_failed = m_truncated = 0;
+
+}
+
+OscSender::~OscSender(){
+
+	stop();
+	if( m_addr )
+		lo_address_free( m_addr );
+
+}
+
+bool OscSender::start( const char* host, const char* port, unsigned int queue_size ){
+
+	if( m_running )
+		return false;
+
+	if( m_addr )
+		lo_address_free( m_addr );
+	m_addr = lo_address_new( host, port );
+	if( !m_addr )
+		return false;
+
+	m_queue.reset( MAX( 1, queue_size ) );
+	m_stop = 0;
+
+	if( pthread_create( &m_thread, NULL, sender_thread, this ) ){
+		printf("pthread_create failed for the OSC sender\n");
+		return false;
+	}
+
+	m_running = true;
+	return true;
+
+}
+
+void OscSender::stop(){
+
+	if( !m_running )
+		return;
+
+	atomic_store( &m_stop, 1 );
+	m_queue.wake();
+	pthread_join( m_thread, NULL );
+
+	m_running = false;
+
+}
+
+bool OscSender::send( const std::vector< cv::Vec<float,POSE_SIZE> >& means, const std::vector< int >* ids ){
+
+	if( !m_running || means.empty() )
+		return true;
+
+	OscFrame frame;
+	lo_timetag_now( &frame.time );
+	frame.count = MIN( (int)means.size(), OSC_MAX_HEADS );
+	if( frame.count < (int)means.size() )
+		atomic_fetch_add( &m_truncated, (long)means.size() - frame.count );
+
+	for(int i=0;i<frame.count;++i){
+
+		frame.heads[i][0] = ids ? (float)(*ids)[i] : (float)i;
+		for(int n=0;n<6;++n)
+			frame.heads[i][1+n] = means[i][n];
+
+	}
+
+	if( !m_queue.push( frame ) ){
+		atomic_fetch_add( &m_dropped, 1 );
+		return false;
+	}
+	return true;
+
+}
+
+void* OscSender::sender_thread( void* arg ){
+
+	((OscSender*)arg)->run();
+	return NULL;
+
+}
+
+void OscSender::run(){
+
+	OscFrame frame, newer;
+
+	for(;;){
+
+		bool stopping = !m_queue.pop_wait( frame, &m_stop );
+
+		//the network was slower than the estimation, only the newest frame is still of interest
+		bool have = !stopping;
+		while( m_queue.pop( newer ) ){
+			if( have )
+				atomic_fetch_add( &m_coalesced, 1 );
+			frame = newer;
+			have = true;
+		}
+
+		if( have )
+			send_bundle( frame );
+
+		if( stopping )
+			break;
+
+	}
+
+}
+
+void OscSender::send_bundle( const OscFrame& frame ){
+
+	lo_bundle bundle = lo_bundle_new( frame.time );
+
+	for(int i=0;i<frame.count;++i){
+
+		lo_message msg = lo_message_new();
+		for(int n=0;n<7;++n)
+			lo_message_add_float( msg, frame.heads[i][n] );
+		lo_bundle_add_message( bundle, "/head_pose", msg );
+
+	}
+
+	if( lo_send_bundle( m_addr, bundle ) < 0 )
+		atomic_fetch_add( &m_failed, 1 );
+	else
+		atomic_fetch_add( &m_sent, 1 );
+
+	//also frees the messages
+	lo_bundle_free_messages( bundle );
+
+}
+
+void OscSender::print_stats( std::ostream& os ) const {
+
+	os << "osc: " << sent() << " bundles sent, " << coalesced() << " outdated frames coalesced, "
+	   << dropped() << " dropped (queue full), " << failed() << " send errors, "
+	   << truncated() << " heads over the limit of " << OSC_MAX_HEADS << " not sent" << endl;
+
+}
@@ -0,0 +1,72 @@
+#ifndef _OSC_SENDER_H_
+#define _OSC_SENDER_H_
+
+#include <vector>
+#include <iostream>
+#include <pthread.h>
+#include <lo/lo.h>
+
+#include "../CRForestEstimator.h"
+#include "../BoundedQueue.h"
+
+//enough for the crowded scenes of head_pose_synth, heads beyond are counted as truncated
+#define OSC_MAX_HEADS 32
+
+// the heads of one frame as they go out: user, x, y, z, pitch, yaw, roll
+struct OscFrame {
+
+	lo_timetag time; //when the frame was handed to the sender
+	int count;
+	float heads[OSC_MAX_HEADS][7];
+
+};
+
+// Sends the poses from its own thread, so a slow network never holds up the estimation.
+// Each frame goes out as one OSC bundle with a /head_pose message per head. Frames are
+// handed over through a lock-free queue; if several are waiting when the sender gets to
+// them, only the newest is sent and the older ones are counted as coalesced.
+class OscSender {
+
+public:
+
+	OscSender();
+	~OscSender();
+
+	bool start( const char* host, const char* port, unsigned int queue_size = 4 );
+
+	//sends the frame still waiting, if any, then ends the thread
+	void stop();
+	bool running() const { return m_running; }
+
+	//estimation thread, never blocks. ids = user id of each pose, output order if null.
+	//Frames without heads are not sent. Returns false if the queue was full and the frame dropped.
+	bool send( const std::vector< cv::Vec<float,POSE_SIZE> >& means, const std::vector< int >* ids = 0 );
+
+	long sent() const { return atomic_load( &m_sent ); } //bundles
+	long coalesced() const { return atomic_load( &m_coalesced ); } //outdated frames not sent
+	long dropped() const { return atomic_load( &m_dropped ); } //frames that found the queue full
+	long failed() const { return atomic_load( &m_failed ); } //lo_send_bundle errors
+	long truncated() const { return atomic_load( &m_truncated ); } //heads beyond OSC_MAX_HEADS not sent
+
+	void print_stats( std::ostream& os ) const;
+
+private:
+
+	static void* sender_thread( void* arg );
+	void run();
+	void send_bundle( const OscFrame& frame );
+
+	lo_address m_addr;
+	BoundedQueue< OscFrame > m_queue;
+	pthread_t m_thread;
+	bool m_running;
+
+	volatile long m_stop;
+	volatile long m_sent, m_coalesced, m_dropped, m_failed, m_truncated;
+
+	OscSender( const OscSender& );
+	OscSender& operator=( const OscSender& );
+
+};
+
+#endif
@@ -0,0 +1,209 @@
+/*
+// Decode throughput of the *_depth.bin format: the old fread based reader against
+// the mapped decoder, decoding into depth or straight into the 3D input image.
+// Also checks that decoding and encoding reproduce the files exactly.
+*/
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "DepthIO.h"
+
+using namespace std;
+using namespace cv;
+
+//reader this replaces: one fread per run header and payload, empty runs zeroed pixel by pixel
+static bool loadDepthImageStream( Mat& depthImg, const char* fname ){
+
+	FILE* pFile = fopen(fname, "rb");
+	if(!pFile)
+		return false;
+
+	int im_width = 0;
+	int im_height = 0;
+	bool success = true;
+
+	success &= ( fread(&im_width,sizeof(int),1,pFile) == 1 );
+	success &= ( fread(&im_height,sizeof(int),1,pFile) == 1 );
+
+	depthImg.create( im_height, im_width, CV_16SC1 );
+	depthImg.setTo(0);
+
+	int numempty;
+	int numfull;
+	int p = 0;
+
+	int16_t* data = depthImg.ptr<int16_t>(0);
+	while( success && p < im_width*im_height ){
+
+		success &= ( fread( &numempty,sizeof(int),1,pFile) == 1 );
+
+		for(int i = 0; i < numempty; i++)
+			data[ p + i ] = 0;
+
+		success &= ( fread( &numfull,sizeof(int), 1, pFile) == 1 );
+		success &= ( fread( &data[ p + numempty ], sizeof(int16_t), numfull, pFile) == (unsigned int) numfull );
+		p += numempty+numfull;
+
+	}
+
+	fclose(pFile);
+	return success;
+
+}
+
+static double elapsed_ms( int64 t0, int frames ){
+
+	return 1000.0*(getTickCount()-t0)/getTickFrequency()/frames;
+
+}
+
+int main(int argc, char* argv[])
+{
+
+	if( argc < 2 ){
+
+		cout << "usage: ./head_pose_depth_bench <depth dir | file list | depth file>... [-r repetitions] [-z max_z]" << endl;
+		exit(-1);
+	}
+
+	int reps = 50;
+	int max_z = 1300;
+
+	vector< string > files;
+	for(int i=1;i<argc;++i){
+
+		if( strcmp(argv[i], "-r") == 0 && i+1 < argc )
+			reps = atoi(argv[++i]);
+		else if( strcmp(argv[i], "-z") == 0 && i+1 < argc )
+			max_z = atoi(argv[++i]);
+		else if( !collectDepthFiles( argv[i], files ) )
+			exit(-1);
+
+	}
+
+	if( files.empty() ){
+		cerr << "no *_depth.bin files found" << endl;
+		exit(-1);
+	}
+
+	reps = MAX( 1, reps );
+
+	//encoded frames in memory and their calibration, also checks the round trip
+	vector< vector< char > > encoded( files.size() );
+	vector< Vec<float,9> > cal( files.size() );
+	vector< Mat > depths( files.size() ); //decoded, for the encoder
+	size_t bytes = 0, pixels = 0;
+	int bad = 0;
+
+	for(unsigned int f=0;f<files.size();++f){
+
+		MappedFile file;
+		if( !file.open( files[f].c_str() ) ){
+			cerr << "could not open " << files[f] << endl;
+			exit(-1);
+		}
+		encoded[f].assign( file.data(), file.data() + file.size() );
+		bytes += file.size();
+
+		if( !loadDepthCalibration( depthCalibrationFile( files[f] ), &cal[f][0] ) ){
+			cerr << "no depth.cal next to " << files[f] << endl;
+			exit(-1);
+		}
+
+		Mat a, b, a3D, b3D;
+		vector< char > again;
+		bool same = loadDepthImageStream( a, files[f].c_str() ) && loadDepthImageCompressed( b, files[f].c_str() );
+		pixels += a.rows*a.cols;
+		depths[f] = a;
+
+		same = same && memcmp( a.ptr<int16_t>(0), b.ptr<int16_t>(0), a.rows*a.cols*sizeof(int16_t) ) == 0;
+
+		encodeDepthImage( a.ptr<int16_t>(0), a.cols, a.rows, again );
+		same = same && again == encoded[f];
+
+		int valid = depthTo3D( a, a3D, &cal[f][0], max_z );
+		same = same && loadDepthTo3D( files[f].c_str(), b3D, &cal[f][0], max_z ) == valid;
+		same = same && memcmp( a3D.ptr<float>(0), b3D.ptr<float>(0), a.rows*a.cols*3*sizeof(float) ) == 0;
+
+		if( !same ){
+			cerr << "decoding differs: " << files[f] << endl;
+			bad++;
+		}
+
+	}
+
+	int frames = reps*files.size();
+	printf( "%u files, %.1f KB and %.0f kpixels per frame, %d repetitions, %s\n",
+			(unsigned int)files.size(), bytes/1024.0/files.size(), pixels/1000.0/files.size(), reps,
+			bad ? "ROUND TRIP FAILED" : "decoder and encoder reproduce the files" );
+
+	Mat depthImg, img3D;
+	vector< char > out;
+	int64 t0;
+
+	t0 = getTickCount();
+	for(int r=0;r<reps;++r)
+		for(unsigned int f=0;f<files.size();++f)
+			loadDepthImageStream( depthImg, files[f].c_str() );
+	double ms_stream = elapsed_ms( t0, frames );
+
+	t0 = getTickCount();
+	for(int r=0;r<reps;++r)
+		for(unsigned int f=0;f<files.size();++f)
+			loadDepthImageCompressed( depthImg, files[f].c_str() );
+	double ms_mapped = elapsed_ms( t0, frames );
+
+	//the files need not all have the same size, the buffer is sized from each header
+	int failed = 0;
+	t0 = getTickCount();
+	for(int r=0;r<reps;++r)
+		for(unsigned int f=0;f<files.size();++f){
+			int width, height;
+			if( !depthImageSize( &encoded[f][0], encoded[f].size(), width, height ) ){
+				failed++;
+				continue;
+			}
+			depthImg.create( height, width, CV_16SC1 );
+			if( !decodeDepthImage( &encoded[f][0], encoded[f].size(), depthImg.ptr<int16_t>(0), width, height ) )
+				failed++;
+		}
+	double ms_memory = elapsed_ms( t0, frames );
+
+	t0 = getTickCount();
+	for(int r=0;r<reps;++r)
+		for(unsigned int f=0;f<files.size();++f){
+			loadDepthImageStream( depthImg, files[f].c_str() );
+			depthTo3D( depthImg, img3D, &cal[f][0], max_z );
+		}
+	double ms_stream3D = elapsed_ms( t0, frames );
+
+	t0 = getTickCount();
+	for(int r=0;r<reps;++r)
+		for(unsigned int f=0;f<files.size();++f)
+			loadDepthTo3D( files[f].c_str(), img3D, &cal[f][0], max_z );
+	double ms_mapped3D = elapsed_ms( t0, frames );
+
+	t0 = getTickCount();
+	for(int r=0;r<reps;++r)
+		for(unsigned int f=0;f<files.size();++f)
+			encodeDepthImage( depths[f].ptr<int16_t>(0), depths[f].cols, depths[f].rows, out );
+	double ms_encode = elapsed_ms( t0, frames );
+
+	double mb = bytes/1048576.0/files.size();
+	printf( "file -> depth, fread per run : %7.3f ms/frame %8.1f MB/s\n", ms_stream, mb/ms_stream*1000 );
+	printf( "file -> depth, mapped        : %7.3f ms/frame %8.1f MB/s\n", ms_mapped, mb/ms_mapped*1000 );
+	printf( "memory -> depth              : %7.3f ms/frame %8.1f MB/s\n", ms_memory, mb/ms_memory*1000 );
+	printf( "file -> depth -> 3D          : %7.3f ms/frame\n", ms_stream3D );
+	printf( "file -> 3D, mapped           : %7.3f ms/frame\n", ms_mapped3D );
+	printf( "depth -> memory (encode)     : %7.3f ms/frame\n", ms_encode );
+
+	if( failed )
+		printf( "DECODING FAILED for %d of %d frames from memory\n", failed, frames );
+
+	return bad || failed ? 1 : 0;
+
+}
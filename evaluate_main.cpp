@@ -0,0 +1,317 @@
+/*
+// Dataset evaluation: runs the forest over BIWI-style folders of *_depth.bin frames
+// with *_pose.bin ground truth on all cores, and reports accuracy (position and angle
+// errors, detection rate) together with speed (per-frame latencies, throughput).
+// The summary can be written as JSON, to compare forests, parameters and builds.
+*/
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CRForestEstimator.h"
+#include "BatchEstimator.h"
+#include "DepthIO.h"
+
+using namespace std;
+using namespace cv;
+
+// mean, standard deviation and percentiles of a list of values
+struct Summary {
+
+	unsigned int count;
+	double mean, std, median, p90, p99, max;
+
+	Summary( std::vector< float > values ){
+
+		count = values.size();
+		mean = std = median = p90 = p99 = max = 0;
+		if( values.empty() )
+			return;
+
+		for(unsigned int i=0;i<values.size();++i)
+			mean += values[i];
+		mean /= count;
+
+		for(unsigned int i=0;i<values.size();++i)
+			std += (values[i]-mean)*(values[i]-mean);
+		std = sqrt( std/count );
+
+		sort( values.begin(), values.end() );
+		median = percentile( values, 0.5 );
+		p90 = percentile( values, 0.9 );
+		p99 = percentile( values, 0.99 );
+		max = values.back();
+
+	}
+
+	//nearest rank
+	static double percentile( const std::vector< float >& sorted, double p ){
+
+		unsigned int rank = (unsigned int)ceil( p*sorted.size() );
+		return sorted[ MIN( (unsigned int)sorted.size(), MAX( 1u, rank ) ) - 1 ];
+
+	}
+
+	void print( const char* name, const char* unit ) const {
+
+		printf( "%-16s mean %7.2f  std %7.2f  median %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f %s\n",
+				name, mean, std, median, p90, p99, max, unit );
+
+	}
+
+	void write_json( FILE* out, const char* name, bool last = false ) const {
+
+		fprintf( out, "    \"%s\": { \"count\": %u, \"mean\": %g, \"std\": %g, \"median\": %g, \"p90\": %g, \"p99\": %g, \"max\": %g }%s\n",
+				 name, count, mean, std, median, p90, p99, max, last ? "" : "," );
+
+	}
+
+};
+
+// collects the errors and latencies of all frames, in input order
+struct Evaluation {
+
+	Evaluation() : frames(0), failed(0), with_gt(0), detected(0), heads_without_gt(0), per_frame(0) { }
+
+	unsigned int frames;
+	unsigned int failed; //could not be read
+	unsigned int with_gt; //frames with ground truth
+	unsigned int detected; //frames with ground truth and at least one head
+	unsigned int heads_without_gt; //found in frames without ground truth
+
+	std::vector< float > head_error; //mm, between the strongest head and the ground truth
+	std::vector< float > angle_error; //degrees, norm of the pitch, yaw and roll errors
+	std::vector< float > axis_error[3]; //absolute pitch, yaw and roll errors
+
+	std::vector< float > decode_ms;
+	std::vector< float > estimate_ms;
+	std::vector< float > total_ms;
+
+	FILE* per_frame; //one line per frame if not null
+
+};
+
+void add_result( const BatchResult& result, void* user ){
+
+	Evaluation& eval = *(Evaluation*)user;
+	eval.frames++;
+
+	if( !result.ok ){
+		eval.failed++;
+		if( eval.per_frame )
+			fprintf( eval.per_frame, "%s -1\n", result.filename.c_str() );
+		return;
+	}
+
+	eval.decode_ms.push_back( result.decode_ms );
+	eval.estimate_ms.push_back( result.estimate_ms );
+	eval.total_ms.push_back( result.decode_ms + result.estimate_ms );
+
+	cv::Vec<float,POSE_SIZE> gt;
+	bool have_gt = loadGroundTruth( groundTruthFile( result.filename ), &gt[0] );
+
+	float h_err = -1, a_err = -1;
+
+	if( !have_gt )
+		eval.heads_without_gt += result.means.size();
+	else{
+
+		eval.with_gt++;
+
+		//assuming there's only one head in the image, as in the ground truth
+		if( result.means.size() > 0 ){
+
+			eval.detected++;
+
+			cv::Vec<float,POSE_SIZE> err = (gt-result.means[0]);
+			for(int n=0;n<POSE_SIZE;++n)
+				err[n] = err[n]*err[n];
+
+			h_err = sqrt(err[0]+err[1]+err[2]);
+			a_err = sqrt(err[3]+err[4]+err[5]);
+
+			eval.head_error.push_back( h_err );
+			eval.angle_error.push_back( a_err );
+			for(int n=0;n<3;++n)
+				eval.axis_error[n].push_back( sqrt( err[3+n] ) );
+
+		}
+
+	}
+
+	//file, no. of heads, head and angle error (-1 if not available), decoding and estimation time
+	if( eval.per_frame )
+		fprintf( eval.per_frame, "%s %d %g %g %.3f %.3f\n", result.filename.c_str(), (int)result.means.size(),
+				 h_err, a_err, result.decode_ms, result.estimate_ms );
+
+}
+
+//tree paths can have backslashes on Windows
+static std::string json_escape( const std::string& s ){
+
+	std::string escaped;
+	for(unsigned int i=0;i<s.size();++i){
+		if( s[i] == '\\' || s[i] == '"' )
+			escaped += '\\';
+		escaped += s[i];
+	}
+	return escaped;
+
+}
+
+static void write_json( FILE* out,
+						const Evaluation& eval,
+						const BatchStats& stats,
+						const std::string& treepath,
+						int ntrees,
+						int max_z,
+						const EstimationParams& params,
+						unsigned int threads ){
+
+	fprintf( out, "{\n" );
+
+	fprintf( out, "  \"build\": { \"date\": \"%s %s\"", __DATE__, __TIME__ );
+#ifdef __VERSION__
+	fprintf( out, ", \"compiler\": \"%s\"", __VERSION__ );
+#endif
+#ifdef NDEBUG
+	fprintf( out, ", \"ndebug\": true },\n" );
+#else
+	fprintf( out, ", \"ndebug\": false },\n" );
+#endif
+
+	fprintf( out, "  \"config\": { \"trees\": \"%s\", \"ntrees\": %d, \"max_z\": %d, \"stride\": %d, \"max_variance\": %g, "
+				  "\"larger_radius_ratio\": %g, \"smaller_radius_ratio\": %g, \"threshold\": %d, \"max_no_faces\": %d, \"threads\": %u },\n",
+			 json_escape( treepath ).c_str(), ntrees, max_z, params.stride, params.max_variance,
+			 params.larger_radius_ratio, params.smaller_radius_ratio, params.threshold, params.max_no_faces, threads );
+
+	fprintf( out, "  \"frames\": %u,\n", eval.frames );
+	fprintf( out, "  \"failed\": %u,\n", eval.failed );
+	fprintf( out, "  \"with_ground_truth\": %u,\n", eval.with_gt );
+	fprintf( out, "  \"detected\": %u,\n", eval.detected );
+	fprintf( out, "  \"detection_rate\": %g,\n", eval.with_gt ? eval.detected/(double)eval.with_gt : 0.0 );
+	fprintf( out, "  \"heads_without_ground_truth\": %u,\n", eval.heads_without_gt );
+
+	fprintf( out, "  \"accuracy\": {\n" );
+	Summary( eval.head_error ).write_json( out, "head_error_mm" );
+	Summary( eval.angle_error ).write_json( out, "angle_error_deg" );
+	Summary( eval.axis_error[0] ).write_json( out, "pitch_error_deg" );
+	Summary( eval.axis_error[1] ).write_json( out, "yaw_error_deg" );
+	Summary( eval.axis_error[2] ).write_json( out, "roll_error_deg", true );
+	fprintf( out, "  },\n" );
+
+	fprintf( out, "  \"latency\": {\n" );
+	Summary( eval.decode_ms ).write_json( out, "decode_ms" );
+	Summary( eval.estimate_ms ).write_json( out, "estimate_ms" );
+	Summary( eval.total_ms ).write_json( out, "total_ms", true );
+	fprintf( out, "  },\n" );
+
+	fprintf( out, "  \"seconds\": %g,\n", stats.seconds );
+	fprintf( out, "  \"fps\": %g\n", stats.fps() );
+
+	fprintf( out, "}\n" );
+
+}
+
+int main(int argc, char* argv[])
+{
+
+	if( argc < 3 ){
+
+		cout << "usage: ./head_pose_evaluate config_file <dataset dir | file list | depth file>... [-t threads] [-f max_faces]" << endl;
+		cout << "                            [-j summary.json] [-o per_frame.txt]" << endl;
+		exit(-1);
+	}
+
+	string treepath;
+	int ntrees = 0;
+	int max_z = 0;
+	EstimationParams params;
+	unsigned int threads = 0;
+	const char* json_file = 0;
+	const char* frames_file = 0;
+
+	if( !loadEstimatorConfig( argv[1], treepath, ntrees, max_z, params ) )
+		exit(-1);
+
+	vector< string > files;
+	for(int i=2;i<argc;++i){
+
+		if( strcmp(argv[i], "-t") == 0 && i+1 < argc )
+			threads = atoi(argv[++i]);
+		else if( strcmp(argv[i], "-f") == 0 && i+1 < argc )
+			params.max_no_faces = atoi(argv[++i]);
+		else if( strcmp(argv[i], "-j") == 0 && i+1 < argc )
+			json_file = argv[++i];
+		else if( strcmp(argv[i], "-o") == 0 && i+1 < argc )
+			frames_file = argv[++i];
+		else if( !collectDepthFiles( argv[i], files ) )
+			exit(-1);
+
+	}
+
+	if( files.empty() ){
+		cerr << "no *_depth.bin files found" << endl;
+		exit(-1);
+	}
+
+	CRForestEstimator estimator;
+	if( !estimator.load_forest(treepath.c_str(), ntrees) ){
+
+		cerr << "could not read forest!" << endl;
+		exit(-1);
+	}
+
+	Evaluation eval;
+	if( frames_file ){
+
+		eval.per_frame = fopen( frames_file, "w" );
+		if( !eval.per_frame ){
+			cerr << "could not open " << frames_file << endl;
+			exit(-1);
+		}
+	}
+
+	if( threads == 0 )
+		threads = BatchEstimator::default_threads();
+	fprintf( stderr, "evaluating %u frames on %u threads\n", (unsigned int)files.size(), threads );
+
+	BatchEstimator batch( &estimator, params, max_z );
+	BatchStats stats = batch.run( files, threads, add_result, &eval );
+
+	if( eval.per_frame )
+		fclose( eval.per_frame );
+
+	printf( "frames:          %u (%u failed, %u with ground truth)\n", eval.frames, eval.failed, eval.with_gt );
+	printf( "detection rate:  %.2f %% (%u of %u), %u heads in frames without ground truth\n",
+			eval.with_gt ? 100.0*eval.detected/eval.with_gt : 0.0, eval.detected, eval.with_gt, eval.heads_without_gt );
+	Summary( eval.head_error ).print( "head error", "mm" );
+	Summary( eval.angle_error ).print( "angle error", "deg" );
+	Summary( eval.axis_error[0] ).print( "  pitch", "deg" );
+	Summary( eval.axis_error[1] ).print( "  yaw", "deg" );
+	Summary( eval.axis_error[2] ).print( "  roll", "deg" );
+	Summary( eval.decode_ms ).print( "decoding", "ms" );
+	Summary( eval.estimate_ms ).print( "estimation", "ms" );
+	Summary( eval.total_ms ).print( "per frame", "ms" );
+	printf( "throughput:      %.2f frames/s on %u threads (%.2f s)\n", stats.fps(), threads, stats.seconds );
+
+	if( json_file ){
+
+		FILE* out = fopen( json_file, "w" );
+		if( !out ){
+			cerr << "could not open " << json_file << endl;
+			exit(-1);
+		}
+		write_json( out, eval, stats, treepath, ntrees, max_z, params, threads );
+		fclose( out );
+
+	}
+
+	return stats.failed == stats.frames ? -1 : 0;
+
+}
@@ -55,6 +55,7 @@
 #include <vector>
 #include <stdint.h>
 #include "CRForestEstimator.h"
+#include "DepthIO.h"
 
 using namespace std;
 using namespace cv;
@@ -91,55 +92,6 @@ std::vector< cv::Vec<float,POSE_SIZE> > g_means; //outputs
 std::vector< std::vector< const Vote* > > g_clusters; //full clusters of votes
 std::vector< Vote > g_votes; //all votes returned by the forest
 
-bool loadDepthImageCompressed(Mat& depthImg, const char* fname ){
-
-	//now read the depth image
-	FILE* pFile = fopen(fname, "rb");
-	if(!pFile){
-		cerr << "could not open file " << fname << endl;
-		return false;
-	}
-
-	int im_width = 0;
-	int im_height = 0;
-	bool success = true;
-
-	success &= ( fread(&im_width,sizeof(int),1,pFile) == 1 ); // read width of depthmap
-	success &= ( fread(&im_height,sizeof(int),1,pFile) == 1 ); // read height of depthmap
-
-	depthImg.create( im_height, im_width, CV_16SC1 );
-	depthImg.setTo(0);
-
-
-	int numempty;
-	int numfull;
-	int p = 0;
-
-	if(!depthImg.isContinuous())
-	{
-		cerr << "Image has the wrong size! (should be 640x480)" << endl;
-		return false;
-	}
-
-	int16_t* data = depthImg.ptr<int16_t>(0);
-	while(p < im_width*im_height ){
-
-		success &= ( fread( &numempty,sizeof(int),1,pFile) == 1 );
-
-		for(int i = 0; i < numempty; i++)
-			data[ p + i ] = 0;
-
-		success &= ( fread( &numfull,sizeof(int), 1, pFile) == 1 );
-		success &= ( fread( &data[ p + numempty ], sizeof(int16_t), numfull, pFile) == (unsigned int) numfull );
-		p += numempty+numfull;
-
-	}
-
-	fclose(pFile);
-
-	return success;
-}
-
 void loadConfig(const char* filename) {
 
 	ifstream in(filename);
@@ -212,73 +164,27 @@ int main(int argc, char* argv[])
 	string depth_fname(argv[2]);
 
 	//read calibration file (should be in the same directory as the depth image!)
-	string cal_filename = depth_fname.substr(0,depth_fname.find_last_of("/")+1);
-
-	cal_filename += "depth.cal";
-	ifstream is(cal_filename.c_str());
-	if (!is){
+	float depth_intrinsic[9];
+	if (!loadDepthCalibration( depthCalibrationFile(depth_fname), depth_intrinsic )){
 		cerr << "depth.cal file not found in the same folder as the depth image! " << endl;
 		return -1;
 	}
-	//read intrinsics only
-	float depth_intrinsic[9];
-	for(int i =0; i<9; ++i)	is >> depth_intrinsic[i];
-	is.close();
-
-	Mat depthImg;
-	//read depth image (compressed!)
-	if (!loadDepthImageCompressed( depthImg, depth_fname.c_str() ))
-		return -1;
 
+	//read depth image (compressed!) and get 3D from depth
 	Mat img3D;
-	img3D.create( depthImg.rows, depthImg.cols, CV_32FC3 );
-
-	//get 3D from depth
-	for(int y = 0; y < img3D.rows; y++)
-	{
-		Vec3f* img3Di = img3D.ptr<Vec3f>(y);
-		const int16_t* depthImgi = depthImg.ptr<int16_t>(y);
-
-		for(int x = 0; x < img3D.cols; x++){
-
-			float d = (float)depthImgi[x];
-
-			if ( d < g_max_z && d > 0 ){
-
-				img3Di[x][0] = d * (float(x) - depth_intrinsic[2])/depth_intrinsic[0];
-				img3Di[x][1] = d * (float(y) - depth_intrinsic[5])/depth_intrinsic[4];
-				img3Di[x][2] = d;
-
-			}
-			else{
-
-				img3Di[x] = 0;
-			}
-
-		}
-	}
+	if ( loadDepthTo3D( depth_fname.c_str(), img3D, depth_intrinsic, g_max_z ) < 0 )
+		return -1;
 
 	g_means.clear();
 	g_votes.clear();
 	g_clusters.clear();
 
-	string pose_filename(depth_fname.substr(0,depth_fname.find_last_of('_')));
-	pose_filename += "_pose.bin";
-
-	cv::Vec<float,POSE_SIZE> gt;
-	bool have_gt = false;
 	//try to read in the ground truth from a binary file
-	FILE* pFile = fopen(pose_filename.c_str(), "rb");
-	if(pFile){
-
-		have_gt = true;
-		have_gt &= ( fread( &gt[0], sizeof(float),POSE_SIZE, pFile) == POSE_SIZE );
-		fclose(pFile);
-
-	}
+	cv::Vec<float,POSE_SIZE> gt;
+	bool have_gt = loadGroundTruth( groundTruthFile(depth_fname), &gt[0] );
 
 	//do the actual estimate
-	estimator.estimate_new( (const cv::Mat&)img3D,
+	estimator.estimate( (const cv::Mat&)img3D,
 								 g_means,
 								 g_clusters,
 								 g_votes,
@@ -17,11 +17,13 @@
 
 //#include <string>
 #include <algorithm>
+#include <map>
 //#include <iostream>
 //#include <vector>
 #include "Gem/Exception.h"
 //#include "m_pd.h"
 #include "../CRForestEstimator.h"
+#include "../DepthIO.h"
 
 #include "pix_head_pose_estimation.h"
 
@@ -32,19 +34,71 @@ using namespace cv;
 
 CPPEXTERN_NEW(pix_head_pose_estimation);
 
-bool g_first_rigid = true;
+//forests loaded by any instance, shared by all instances reading the same trees.
+//Only used in constructors and destructors, i.e. in Pd's main thread
+struct SharedForest {
+	CRForestEstimator* estimator;
+	int instances;
+};
+static std::map< std::string, SharedForest > s_forests;
 
-//pointer to the actual estimator
+static std::string forestKey(const std::string& treepath, int ntrees)
+{
+	char n[16];
+	sprintf(n, ":%d", ntrees);
+	return treepath + n;
+}
 
-CRForestEstimator* g_Estimate;
+//returns the loaded forest or 0 if it could not be read
+static CRForestEstimator* acquireForest(const std::string& treepath, int ntrees)
+{
+	std::string key = forestKey(treepath, ntrees);
+	std::map< std::string, SharedForest >::iterator it = s_forests.find(key);
+	
+	if( it != s_forests.end() ){
+		it->second.instances++;
+		post("sharing trees from: %s", treepath.c_str());
+		return it->second.estimator;
+	}
+	
+	post("reading trees from: %s", treepath.c_str());
+	CRForestEstimator* estimator = new CRForestEstimator();
+	if( !estimator->load_forest(treepath.c_str(), ntrees) ){
+		delete estimator;
+		return 0;
+	}
+	
+	SharedForest forest;
+	forest.estimator = estimator;
+	forest.instances = 1;
+	s_forests[key] = forest;
+	return estimator;
+}
 
-//input 3D image
-Mat g_im3D;
+//the forest is freed with its last instance
+static void releaseForest(const std::string& treepath, int ntrees)
+{
+	std::map< std::string, SharedForest >::iterator it = s_forests.find(forestKey(treepath, ntrees));
+	if( it == s_forests.end() )
+		return;
+	
+	if( --it->second.instances == 0 ){
+		delete it->second.estimator;
+		s_forests.erase(it);
+	}
+}
 
-// STORAGE
-std::vector< cv::Vec<float,POSE_SIZE> > g_means; //outputs
-std::vector< std::vector< const Vote* > > g_clusters; //full clusters of votes
-std::vector< Vote > g_votes; //all votes returned by the forest
+//focal length of the Kinect's depth camera at 640x480, pixels
+#define KINECT_FOCAL (1.f/0.0017505f)
+
+//interval at which finished results are looked for, ms
+#define POLL_INTERVAL 2
+
+//coarsest stride the budget control goes to
+#define MAX_BUDGET_STRIDE 20
+
+//frames averaged after a change before the budget control changes anything again
+#define BUDGET_SETTLE_FRAMES 3
 
 
 // used for finding external path
@@ -81,6 +135,7 @@ static char sys_dllextent[] = ".m_i386", sys_dllextent2[] = ".dll";
 pix_head_pose_estimation :: pix_head_pose_estimation()
 {
 		m_dataout = outlet_new(this->x_obj, 0);
+		m_budgetout = outlet_new(this->x_obj, &s_list);
 		
 		post("pix_head_pose_estimation - experimental - 2012 by Matthias Kronlachner");
 
@@ -95,10 +150,18 @@ pix_head_pose_estimation :: pix_head_pose_estimation()
 		m_max_z = 1300.0;
 		m_th = 400;
 		
-		float m_prob_th = 1.0f;
+		m_prob_th = 1.0f;
 		
-		m_im_w = 640;
-		m_im_h = 480;
+		m_budget = 0;
+		m_min_trees = 0;
+		m_cur_stride = m_stride;
+		m_cur_trees = 0;
+		m_budget_avg = 0;
+		m_budget_frames = 0;
+		
+		m_fx = m_fy = 0;
+		m_cx = m_cy = -1;
+		setGreyRange(0, 2550);
 
     // get external path for loading tree
     // taken from mrpeach/which
@@ -121,19 +184,29 @@ pix_head_pose_estimation :: pix_head_pose_estimation()
     result = close(fd);
     
     strcat(dirbuf, "/trees/new_");
-    post("reading trees from: %s",dirbuf);
-    
+    g_treepath = dirbuf;
     
-        g_Estimate =  new CRForestEstimator();
-		if( !g_Estimate->load_forest(dirbuf, g_ntrees) ){
+		m_estimator = acquireForest(g_treepath, g_ntrees);
+		if( !m_estimator ){
             throw(GemException("could not read forest! \n"));
 		}
+		m_cur_trees = m_estimator->num_trees();
 		
-    
-		// creade 3d images
-		g_im3D.create(m_im_h,m_im_w,CV_32FC3);
-    
-    post ("created 3d image");
+		// the render callback only hands the frames over, only the latest frame waiting is estimated.
+		// Each instance has its own worker, the forest is only read by them
+		m_async = new AsyncEstimator( m_estimator, params(), 1, 1 );
+		if( !m_async->start() ){
+			delete m_async;
+			releaseForest(g_treepath, g_ntrees);
+            throw(GemException("could not start the estimation thread! \n"));
+		}
+		
+		m_last_frame = -1;
+		m_latency_sum = 0;
+		m_results = 0;
+		
+		m_clock = clock_new(this, reinterpret_cast<t_method>(&pix_head_pose_estimation::tickCallback));
+		clock_delay(m_clock, POLL_INTERVAL);
 		
 }
 
@@ -142,100 +215,180 @@ pix_head_pose_estimation :: pix_head_pose_estimation()
 //
 /////////////////////////////////////////////////////////
 pix_head_pose_estimation :: ~pix_head_pose_estimation()
-{ }
+{
+		clock_free(m_clock);
+		m_async->stop();
+		delete m_async;
+		releaseForest(g_treepath, g_ntrees);
+}
+
+EstimationParams pix_head_pose_estimation :: params() const
+{
+		EstimationParams params;
+		params.stride = m_budget > 0 ? m_cur_stride : m_stride;
+		params.trees = m_budget > 0 ? m_cur_trees : 0;
+		params.max_variance = m_maxv;
+		params.prob_th = m_prob_th;
+		params.larger_radius_ratio = m_larger_radius_ratio;
+		params.smaller_radius_ratio = m_smaller_radius_ratio;
+		params.threshold = m_th;
+		return params;
+}
 
 /////////////////////////////////////////////////////////
-// processImage
-//
+// adaptToBudget
+// keeps the estimation time under m_budget: coarser stride first, then fewer trees
+// (down to m_min_trees), and back when there is enough room. The time goes with
+// trees/stride^2, which predicts whether a finer setting still fits
 /////////////////////////////////////////////////////////
-void pix_head_pose_estimation :: processRGBAImage(imageStruct &image)
+void pix_head_pose_estimation :: adaptToBudget()
 {
-  // Read Data
-	int datasize = image.xsize * image.ysize;
-
-    unsigned char *base = image.data;
-		int value = 0;
+		// only frames estimated with the current settings tell something about them
+		if( m_budget <= 0 || m_result.params.stride != m_cur_stride || m_result.params.trees != m_cur_trees )
+			return;
 		
-		int valid_pixels = 0;
-		float d = 0.f;
+		m_budget_avg = m_budget_frames ? 0.7*m_budget_avg + 0.3*m_result.estimate_ms : m_result.estimate_ms;
 		
-			for(int y = 0; y < g_im3D.rows; y++)
-			{
-				Vec3f* Mi = g_im3D.ptr<Vec3f>(y);
-				for(int x = 0; x < g_im3D.cols; x++){
-
-					//d = (float)g_depthMD(x,y);
-					
-					d = (float)((int)base[chRed] << 8) + (int)base[chGreen];
-
-					if ( d < m_max_z && d > 0 ){
-
-						valid_pixels++;
-
-						Mi[x][0] = ( float(d * (x - 320)) * 0.0017505f );
-						Mi[x][1] = ( float(d * (y - 240)) * 0.0017505f );
-						Mi[x][2] = d;
-
-					}
-					else
-						Mi[x] = 0;
-
-					base += 4;
-				}
-			}
+		//a frame over twice the budget is acted on right away
+		if( ++m_budget_frames < BUDGET_SETTLE_FRAMES && m_result.estimate_ms < 2*m_budget )
+			return;
 		
-		// reset storage
-		g_means.clear();
-		g_votes.clear();
-		g_clusters.clear();
-
-    
-		//do the actual estimation
-		g_Estimate->estimate(g_im3D,
-									g_means,
-									g_clusters,
-									g_votes,
-									m_stride,
-									m_maxv,
-									m_prob_th,
-									m_larger_radius_ratio,
-									m_smaller_radius_ratio,
-									false,
-									m_th
-								);
+		double t = m_budget_frames < BUDGET_SETTLE_FRAMES ? m_result.estimate_ms : m_budget_avg;
+		double s = m_cur_stride;
+		
+		if( t > m_budget ){
+			
+			if( m_cur_stride < MAX_BUDGET_STRIDE )
+				m_cur_stride = min( MAX_BUDGET_STRIDE, max( m_cur_stride+1, (int)ceil( s*sqrt(t/m_budget) ) ) );
+			else if( m_cur_trees > max( 1, m_min_trees ) )
+				m_cur_trees--;
+			else
+				return;
+		}
+		//with some margin, so it does not go back and forth
+		else if( m_cur_trees < (int)m_estimator->num_trees() && t*(m_cur_trees+1)/m_cur_trees < 0.9*m_budget )
+			m_cur_trees++;
+		else if( m_cur_stride > m_stride && t*(s*s)/((s-1)*(s-1)) < 0.9*m_budget )
+			m_cur_stride--;
+		else
+			return;
+		
+		m_budget_frames = 0;
+}
 
+/////////////////////////////////////////////////////////
+// outputResults
+// sends out the newest finished frame, called in Pd's main thread
+/////////////////////////////////////////////////////////
+void pix_head_pose_estimation :: outputResults()
+{
+		if( !m_async->latest( m_result, m_last_frame ) )
+			return;
+		
+		m_last_frame = m_result.frame;
+		m_latency_sum += m_result.latency_ms;
+		m_results++;
+		
+		adaptToBudget();
+		
+		// stride, trees and estimation time of this frame
+		t_atom at[3];
+		SETFLOAT (at+0, m_result.params.stride);
+		SETFLOAT (at+1, m_result.params.trees > 0 ? m_result.params.trees : m_estimator->num_trees());
+		SETFLOAT (at+2, m_result.estimate_ms);
+		outlet_list(m_budgetout, &s_list, 3, at);
+		
             // Output Data
-			for(unsigned int i=0;i<g_means.size();++i) {
+			for(unsigned int i=0;i<m_result.means.size();++i) {
 				
 				t_atom ap[7];
 				SETFLOAT (ap+0, i); // id
-				SETFLOAT (ap+1, g_means[i][0]); // x
-				SETFLOAT (ap+2, g_means[i][1]); // y
-				SETFLOAT (ap+3, g_means[i][2]); // z
-				SETFLOAT (ap+4, g_means[i][3]); // pitch
-				SETFLOAT (ap+5, g_means[i][4]); // yaw
-				SETFLOAT (ap+6, g_means[i][5]); // roll
+				SETFLOAT (ap+1, m_result.means[i][0]); // x
+				SETFLOAT (ap+2, m_result.means[i][1]); // y
+				SETFLOAT (ap+3, m_result.means[i][2]); // z
+				SETFLOAT (ap+4, m_result.means[i][3]); // pitch
+				SETFLOAT (ap+5, m_result.means[i][4]); // yaw
+				SETFLOAT (ap+6, m_result.means[i][5]); // roll
 				
 				outlet_anything(m_dataout, gensym("head_pose"), 7, ap);
 			}
+}
 
+void pix_head_pose_estimation :: setGreyRange(float near_z, float far_z)
+{
+		//0 stays without depth
+		m_grey_lut[0] = 0;
+		for(int i=1;i<256;++i)
+			m_grey_lut[i] = (int16_t)( near_z + (far_z-near_z)*i/255.f );
 }
 
 /////////////////////////////////////////////////////////
-// YUV Depth Image --> Has to be corrected
-//
+// pushDepth
+// hands a depth image to the worker, which back-projects and estimates it
 /////////////////////////////////////////////////////////
-void pix_head_pose_estimation :: processYUVImage(imageStruct &image)
+void pix_head_pose_estimation :: pushDepth(const Mat& depth, double timestamp)
 {
-    int datasize = image.xsize * image.ysize;
+		float scale = depth.cols/640.f;
+		float depth_intrinsic[9] = {
+			m_fx > 0 ? m_fx : KINECT_FOCAL*scale, 0, m_cx >= 0 ? m_cx : depth.cols/2.f,
+			0, m_fy > 0 ? m_fy : KINECT_FOCAL*scale, m_cy >= 0 ? m_cy : depth.rows/2.f,
+			0, 0, 1 };
+		
+		//the estimation runs on the worker thread, the poses are sent out by the clock
+		m_async->set_params( params() );
+		m_async->push_depth( depth, depth_intrinsic, (int)m_max_z, timestamp );
+}
 
-    unsigned char *base = image.data;
-		int value = 0;
-    while(datasize--)
-    {
+/////////////////////////////////////////////////////////
+// processImage
+// depth in mm packed into red (msb) and green (lsb)
+/////////////////////////////////////////////////////////
+void pix_head_pose_estimation :: processRGBAImage(imageStruct &image)
+{
+		m_depth.create( image.ysize, image.xsize, CV_16SC1 );
+		
+		const unsigned char *base = image.data;
+		for(int y = 0; y < m_depth.rows; y++)
+		{
+			int16_t* Di = m_depth.ptr<int16_t>(y);
+			for(int x = 0; x < m_depth.cols; x++)
+				Di[x] = (int16_t)( (base[4*x+chRed] << 8) | base[4*x+chGreen] );
+			base += 4*m_depth.cols;
+		}
+		
+		pushDepth( m_depth, clock_getlogicaltime() );
+}
+
+/////////////////////////////////////////////////////////
+// YUV Depth Image
+// two bytes per pixel hold the depth in mm as 16 bit integer (e.g. raw output of pix_openni),
+// handed over as it is
+/////////////////////////////////////////////////////////
+void pix_head_pose_estimation :: processYUVImage(imageStruct &image)
+{
+		Mat depth( image.ysize, image.xsize, CV_16SC1, image.data );
+		
+		pushDepth( depth, clock_getlogicaltime() );
+}
 
-		base += 2;
-    }    
+/////////////////////////////////////////////////////////
+// Grey Depth Image
+// 8 bit depth, mapped to mm by grey_range
+/////////////////////////////////////////////////////////
+void pix_head_pose_estimation :: processGrayImage(imageStruct &image)
+{
+		m_depth.create( image.ysize, image.xsize, CV_16SC1 );
+		
+		const unsigned char *base = image.data;
+		for(int y = 0; y < m_depth.rows; y++)
+		{
+			int16_t* Di = m_depth.ptr<int16_t>(y);
+			for(int x = 0; x < m_depth.cols; x++)
+				Di[x] = m_grey_lut[ base[x] ];
+			base += m_depth.cols;
+		}
+		
+		pushDepth( m_depth, clock_getlogicaltime() );
 }
 
 /////////////////////////////////////////////////////////
@@ -256,6 +409,14 @@ void pix_head_pose_estimation :: obj_setupCallback(t_class *classPtr)
     	    gensym("max_z"), A_FLOAT, A_NULL);
     class_addmethod(classPtr, reinterpret_cast<t_method>(&pix_head_pose_estimation::floatThMessCallback),
     	    gensym("th"), A_FLOAT, A_NULL);
+    class_addmethod(classPtr, reinterpret_cast<t_method>(&pix_head_pose_estimation::infoMessCallback),
+    	    gensym("info"), A_NULL);
+    class_addmethod(classPtr, reinterpret_cast<t_method>(&pix_head_pose_estimation::intrinsicsMessCallback),
+    	    gensym("intrinsics"), A_GIMME, A_NULL);
+    class_addmethod(classPtr, reinterpret_cast<t_method>(&pix_head_pose_estimation::greyRangeMessCallback),
+    	    gensym("grey_range"), A_FLOAT, A_FLOAT, A_NULL);
+    class_addmethod(classPtr, reinterpret_cast<t_method>(&pix_head_pose_estimation::budgetMessCallback),
+    	    gensym("budget"), A_GIMME, A_NULL);
 }
 void pix_head_pose_estimation :: floatMaxvMessCallback(void *data, t_floatarg arg)
 {
@@ -276,6 +437,7 @@ void pix_head_pose_estimation :: floatStrideMessCallback(void *data, t_floatarg
 {
 	pix_head_pose_estimation *me = (pix_head_pose_estimation*)GetMyClass(data);
   me->m_stride=(float)arg;
+  me->m_cur_stride=max(me->m_cur_stride, me->m_stride);
 }
 void pix_head_pose_estimation :: floatMaxZMessCallback(void *data, t_floatarg arg)
 {
@@ -287,3 +449,62 @@ void pix_head_pose_estimation :: floatThMessCallback(void *data, t_floatarg arg)
 	pix_head_pose_estimation *me = (pix_head_pose_estimation*)GetMyClass(data);
   me->m_th=(float)arg;
 }
+void pix_head_pose_estimation :: tickCallback(void *data)
+{
+	pix_head_pose_estimation *me = (pix_head_pose_estimation*)data;
+  me->outputResults();
+  clock_delay(me->m_clock, POLL_INTERVAL);
+}
+// info <frames> <estimated> <dropped> <latency ms> <mean latency ms> <estimation ms>
+void pix_head_pose_estimation :: infoMessCallback(void *data)
+{
+	pix_head_pose_estimation *me = (pix_head_pose_estimation*)GetMyClass(data);
+  t_atom ap[6];
+  SETFLOAT (ap+0, me->m_async->pushed());
+  SETFLOAT (ap+1, me->m_async->processed());
+  SETFLOAT (ap+2, me->m_async->dropped());
+  SETFLOAT (ap+3, me->m_results ? me->m_result.latency_ms : 0);
+  SETFLOAT (ap+4, me->m_results ? me->m_latency_sum/me->m_results : 0);
+  SETFLOAT (ap+5, me->m_results ? me->m_result.estimate_ms : 0);
+  outlet_anything(me->m_dataout, gensym("info"), 6, ap);
+}
+// intrinsics <fx> <fy> <cx> <cy> in pixels, without arguments the Kinect's are used again
+void pix_head_pose_estimation :: intrinsicsMessCallback(void *data, t_symbol *s, int argc, t_atom *argv)
+{
+	pix_head_pose_estimation *me = (pix_head_pose_estimation*)GetMyClass(data);
+  if (argc == 0) {
+    me->m_fx = me->m_fy = 0;
+    me->m_cx = me->m_cy = -1;
+    return;
+  }
+  if (argc != 4) {
+    error("pix_head_pose_estimation: intrinsics <fx> <fy> <cx> <cy>");
+    return;
+  }
+  me->m_fx=atom_getfloat(argv+0);
+  me->m_fy=atom_getfloat(argv+1);
+  me->m_cx=atom_getfloat(argv+2);
+  me->m_cy=atom_getfloat(argv+3);
+}
+void pix_head_pose_estimation :: greyRangeMessCallback(void *data, t_floatarg near_z, t_floatarg far_z)
+{
+	pix_head_pose_estimation *me = (pix_head_pose_estimation*)GetMyClass(data);
+  me->setGreyRange((float)near_z, (float)far_z);
+}
+// budget <ms> [min_trees]: adapts stride and trees to keep the estimation under ms, 0 = off.
+// The stride message sets the finest stride, trees are only left out with min_trees
+void pix_head_pose_estimation :: budgetMessCallback(void *data, t_symbol *s, int argc, t_atom *argv)
+{
+	pix_head_pose_estimation *me = (pix_head_pose_estimation*)GetMyClass(data);
+  if (argc < 1 || argc > 2) {
+    error("pix_head_pose_estimation: budget <ms> [min_trees]");
+    return;
+  }
+  me->m_budget=atom_getfloat(argv+0);
+  me->m_min_trees=me->m_estimator->num_trees();
+  if (argc == 2)
+    me->m_min_trees=min((int)me->m_estimator->num_trees(), max(1, (int)atom_getfloat(argv+1)));
+  me->m_cur_stride=me->m_stride;
+  me->m_cur_trees=me->m_estimator->num_trees();
+  me->m_budget_frames=0;
+}
@@ -18,6 +18,7 @@ WARRANTIES, see the file, "GEM.LICENSE.TERMS" in this distribution.
 
 #include "Base/GemPixObj.h"
 #include "Gem/Settings.h"
+#include "../AsyncEstimator.h"
 
 using namespace std;
 using namespace cv;
@@ -56,6 +57,7 @@ class GEM_EXTERN pix_head_pose_estimation : public GemPixObj
     	pix_head_pose_estimation();
     	
 			t_outlet 	*m_dataout;
+			t_outlet 	*m_budgetout; //stride trees ms of each result
 			
 			//////////      
 			// settings
@@ -79,11 +81,45 @@ class GEM_EXTERN pix_head_pose_estimation : public GemPixObj
     	// Do the processing
     	virtual void 	processRGBAImage(imageStruct &image);
     	virtual void 	processYUVImage(imageStruct &image);
+    	virtual void 	processGrayImage(imageStruct &image);
     	
+			//////////
+			// depth in mm of the current frame, unpacked from any input format
+			Mat m_depth;
 			
-			//input image size
-			int m_im_w;
-			int m_im_h;
+			//intrinsics in pixels, <= 0 (cx,cy < 0) means the Kinect's, scaled to the image size
+			float m_fx, m_fy, m_cx, m_cy;
+			
+			//depth of the grey levels 0..255 of 8 bit images
+			int16_t m_grey_lut[256];
+			
+			void setGreyRange(float near_z, float far_z);
+			void pushDepth(const Mat& depth, double timestamp);
+			
+			//forest shared with all instances using the same trees
+			CRForestEstimator* m_estimator;
+			
+			//////////
+			// the estimation runs on a worker thread, a clock sends out its results in Pd's main thread
+			AsyncEstimator* m_async;
+			t_clock* m_clock;
+			long m_last_frame; //newest result sent out
+			AsyncResult m_result;
+			double m_latency_sum; //of the results sent out, ms
+			long m_results;
+			
+			//////////
+			// budget control, see adaptToBudget()
+			float m_budget; //ms, 0 = off
+			int m_min_trees;
+			int m_cur_stride;
+			int m_cur_trees;
+			double m_budget_avg; //estimation time with the current settings
+			int m_budget_frames; //results since the last change
+			
+			EstimationParams params() const;
+			void adaptToBudget();
+			void outputResults();
 			
     private:
     
@@ -95,6 +131,11 @@ class GEM_EXTERN pix_head_pose_estimation : public GemPixObj
 			static void 	floatStrideMessCallback(void *data, t_floatarg arg);
 			static void 	floatMaxZMessCallback(void *data, t_floatarg arg);
 			static void 	floatThMessCallback(void *data, t_floatarg arg);
+			static void 	infoMessCallback(void *data);
+			static void 	intrinsicsMessCallback(void *data, t_symbol *s, int argc, t_atom *argv);
+			static void 	greyRangeMessCallback(void *data, t_floatarg near_z, t_floatarg far_z);
+			static void 	budgetMessCallback(void *data, t_symbol *s, int argc, t_atom *argv);
+			static void 	tickCallback(void *data);
 			
 };
 
@@ -0,0 +1,201 @@
+/*
+// Example subscriber of the pose server of the demo (--serve): connects over TCP or a
+// Unix domain socket, asks for a reduced rate if wanted and prints the frames or, with
+// -q, once a second how many frames arrived, how many were skipped and their latency.
+*/
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "PoseServer.h"
+
+using namespace std;
+
+// host:port or a socket path
+static int connect_to( const char* address ){
+
+	const char* colon = strrchr( address, ':' );
+
+	if( !colon ){
+
+		sockaddr_un sa;
+		memset( &sa, 0, sizeof(sa) );
+		sa.sun_family = AF_UNIX;
+		strncpy( sa.sun_path, address, sizeof(sa.sun_path)-1 );
+
+		int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if( fd >= 0 && connect( fd, (sockaddr*)&sa, sizeof(sa) ) == 0 )
+			return fd;
+		if( fd >= 0 )
+			close( fd );
+		return -1;
+
+	}
+
+	string host( address, colon );
+	addrinfo hints, *found = 0;
+	memset( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if( getaddrinfo( host.c_str(), colon+1, &hints, &found ) != 0 )
+		return -1;
+
+	int fd = -1;
+	for(addrinfo* a=found; a && fd<0; a=a->ai_next){
+
+		fd = socket( a->ai_family, a->ai_socktype, a->ai_protocol );
+		if( fd >= 0 && connect( fd, a->ai_addr, a->ai_addrlen ) != 0 ){
+			close( fd );
+			fd = -1;
+		}
+
+	}
+
+	freeaddrinfo( found );
+	return fd;
+
+}
+
+static bool read_all( int fd, void* data, size_t size ){
+
+	char* p = (char*)data;
+	while( size > 0 ){
+
+		ssize_t n = read( fd, p, size );
+		if( n <= 0 )
+			return false;
+		p += n;
+		size -= n;
+
+	}
+	return true;
+
+}
+
+int main(int argc, char* argv[])
+{
+
+	if( argc < 2 ){
+
+		cout << "usage: ./head_pose_client <host:port | socket path> [-every n] [-rate hz] [-q] [-stall seconds]" << endl;
+		cout << "  -every n         only every n-th frame" << endl;
+		cout << "  -rate hz         at most hz frames per second" << endl;
+		cout << "  -q               statistics once a second instead of the poses" << endl;
+		cout << "  -stall seconds   stop reading for a while after connecting (backpressure test)" << endl;
+		exit(-1);
+	}
+
+	int every = 0;
+	double rate = 0;
+	bool quiet = false;
+	int stall = 0;
+
+	for(int i=2;i<argc;++i){
+
+		if( strcmp(argv[i], "-every") == 0 && i+1 < argc )
+			every = atoi(argv[++i]);
+		else if( strcmp(argv[i], "-rate") == 0 && i+1 < argc )
+			rate = atof(argv[++i]);
+		else if( strcmp(argv[i], "-q") == 0 )
+			quiet = true;
+		else if( strcmp(argv[i], "-stall") == 0 && i+1 < argc )
+			stall = atoi(argv[++i]);
+		else {
+			cerr << "unknown option " << argv[i] << endl;
+			exit(-1);
+		}
+
+	}
+
+	int fd = connect_to( argv[1] );
+	if( fd < 0 ){
+		cerr << "could not connect to " << argv[1] << endl;
+		exit(-1);
+	}
+
+	char command[64];
+	if( every > 0 ){
+		int n = sprintf( command, "every %d\n", every );
+		if( write( fd, command, n ) != n )
+			exit(-1);
+	}
+	if( rate > 0 ){
+		int n = sprintf( command, "rate %g\n", rate );
+		if( write( fd, command, n ) != n )
+			exit(-1);
+	}
+
+	if( stall > 0 )
+		sleep( stall );
+
+	PoseStreamHeader header;
+	vector< PoseStreamHead > heads;
+	long frames = 0, skipped = 0, total = 0, total_skipped = 0;
+	double latency = 0, max_latency = 0;
+	double next_report = PoseServer::now() + 1;
+
+	while( read_all( fd, &header, sizeof(header) ) ){
+
+		if( memcmp( header.magic, POSE_STREAM_MAGIC, 4 ) != 0 || header.heads < 0 ||
+			header.size != sizeof(header) + header.heads*sizeof(PoseStreamHead) ){
+			cerr << "broken stream" << endl;
+			exit(-1);
+		}
+
+		heads.resize( header.heads );
+		if( header.heads > 0 && !read_all( fd, &heads[0], header.heads*sizeof(PoseStreamHead) ) )
+			break;
+
+		//same clock as the server, if it runs on this machine
+		double now = PoseServer::now();
+		double age = 1000*( now - header.timestamp );
+
+		frames++;
+		skipped += header.skipped;
+		latency += age;
+		max_latency = max( max_latency, age );
+
+		if( !quiet ){
+
+			if( header.skipped )
+				printf( "(%d frames skipped)\n", header.skipped );
+			if( heads.empty() )
+				printf( "%ld no heads\n", (long)header.frame );
+
+			//frame id x y z pitch yaw roll confidence, latency in ms
+			for(unsigned int i=0;i<heads.size();++i){
+				const PoseStreamHead& h = heads[i];
+				printf( "%ld %d %.1f %.1f %.1f %.1f %.1f %.1f %.2f %.3f\n", (long)header.frame, h.id,
+						h.pose[0], h.pose[1], h.pose[2], h.pose[3], h.pose[4], h.pose[5], h.confidence, age );
+			}
+
+		}
+		else if( now >= next_report ){
+
+			printf( "%ld frames, %ld skipped, latency mean %.3f max %.3f ms\n",
+					frames, skipped, latency/frames, max_latency );
+			total += frames;
+			total_skipped += skipped;
+			frames = skipped = 0;
+			latency = max_latency = 0;
+			next_report = now + 1;
+
+		}
+
+	}
+
+	total += frames;
+	total_skipped += skipped;
+	printf( "server closed the connection after %ld frames, %ld skipped\n", total, total_skipped );
+	close( fd );
+	return 0;
+
+}
@@ -0,0 +1,114 @@
+/*
+// Example consumer of the shared memory output of the demo (--shm): prints the head
+// poses as they are written, or only the newest frame, and can time the polling.
+// Needs nothing but PoseRing.cpp, consumers can be built the same way.
+*/
+
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "PoseRing.h"
+
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+
+	if( argc < 2 ){
+
+		cout << "usage: ./head_pose_ring_reader name [-latest] [-bench calls]" << endl;
+		cout << "  -latest        only the heads of the newest frame, older frames are skipped" << endl;
+		cout << "  -bench calls   times the polling and exits" << endl;
+		exit(-1);
+	}
+
+	bool latest = false;
+	long bench = 0;
+
+	for(int i=2;i<argc;++i){
+
+		if( strcmp(argv[i], "-latest") == 0 )
+			latest = true;
+		else if( strcmp(argv[i], "-bench") == 0 && i+1 < argc )
+			bench = atol(argv[++i]);
+		else {
+			cerr << "unknown option " << argv[i] << endl;
+			exit(-1);
+		}
+
+	}
+
+	PoseRingReader reader;
+	while( !reader.open( argv[1] ) ){
+		cerr << "waiting for " << argv[1] << endl;
+		sleep(1);
+	}
+
+	PoseRecord record;
+	vector< PoseRecord > heads;
+
+	if( bench > 0 ){
+
+		long records = 0, frames = 0;
+		double t0 = PoseRing::now();
+
+		for(long i=0;i<bench;++i){
+
+			if( latest )
+				frames += reader.latest( heads );
+			else
+				records += reader.poll( record );
+
+		}
+
+		double ns = 1e9*( PoseRing::now() - t0 )/bench;
+		printf( "%ld calls, %.1f ns per call, %ld records and %ld frames read, %ld lost\n",
+				bench, ns, records, frames, reader.lost() );
+		return 0;
+
+	}
+
+	//frame id x y z pitch yaw roll confidence, and the age of the record in ms
+	while( !reader.closed() ){
+
+		bool any = false;
+
+		if( latest ){
+
+			if( reader.latest( heads ) ){
+				any = true;
+				if( heads.empty() )
+					printf( "%ld no heads\n", reader.last_frame() );
+			}
+
+		}
+		else if( reader.poll( record ) ){
+			any = true;
+			heads.assign( 1, record );
+		}
+
+		if( !any ){
+			usleep( 1000 );
+			continue;
+		}
+
+		double now = PoseRing::now();
+		for(unsigned int i=0;i<heads.size();++i){
+
+			const PoseRecord& r = heads[i];
+			printf( "%ld %d %.1f %.1f %.1f %.1f %.1f %.1f %.2f %.3f\n", (long)r.frame, r.id,
+					r.pose[0], r.pose[1], r.pose[2], r.pose[3], r.pose[4], r.pose[5],
+					r.confidence, 1000*( now - r.timestamp ) );
+
+		}
+		heads.clear();
+
+	}
+
+	printf( "writer closed the ring, %ld records lost\n", reader.lost() );
+	return 0;
+
+}
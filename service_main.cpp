@@ -0,0 +1,587 @@
+/*
+// Estimation service for several depth streams in one process: recordings replayed in
+// real time, Kinects (built with USE_LIBFREENECT) and frames pushed by other programs
+// over a Unix domain socket all share one loaded forest and one set of worker threads,
+// which take the newest frame of each stream round robin. The poses are printed per
+// stream, the latency of every stream once in a while.
+*/
+
+//#define USE_LIBFREENECT
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "CRForestEstimator.h"
+#include "BatchEstimator.h"
+#include "StreamEstimator.h"
+#include "DepthRecording.h"
+
+#ifdef USE_LIBFREENECT
+#include "libfreenect.h"
+#endif
+
+using namespace std;
+using namespace cv;
+
+//frames pushed over -listen: this header followed by width*height int16 depth values
+//in mm, row by row, in the byte order of the service
+#define DEPTH_STREAM_MAGIC "HPDF"
+
+struct DepthStreamHeader {
+
+	char magic[4];
+	uint32_t size; //bytes of the record, header included
+	double timestamp; //seconds, any clock
+	int32_t width;
+	int32_t height;
+
+};
+
+#define KINECT_FOCAL (1.f/0.0017505f)
+
+StreamEstimator* g_service = 0;
+int g_max_z = 0;
+bool g_quiet = false;
+volatile long g_quit = 0;
+volatile long g_sources = 0; //replays and connections still delivering frames
+
+// seconds
+static double now(){
+
+	return getTickCount()/getTickFrequency();
+}
+
+void on_signal( int ){
+
+	atomic_store( &g_quit, 1 );
+}
+
+// no calibration comes with the streams: the Kinect's, the focal length scaled to the image width
+void kinect_intrinsics( int width, int height, float* depth_intrinsic ){
+
+	float focal = KINECT_FOCAL*width/640.f;
+	float k[9] = { focal, 0, width/2.f,
+				   0, focal, height/2.f,
+				   0, 0, 1 };
+	memcpy( depth_intrinsic, k, sizeof(k) );
+}
+
+//one line per frame: stream, frame, no. of heads, then votes x y z pitch yaw roll for each head
+void print_result( int stream, const AsyncResult& result, void* ){
+
+	if( g_quiet )
+		return;
+
+	string line = g_service->name( stream );
+	char buf[64];
+	sprintf( buf, " %ld %d", result.frame, (int)result.means.size() );
+	line += buf;
+
+	for(unsigned int i=0;i<result.means.size();++i){
+
+		sprintf( buf, " %u", result.cluster_sizes[i] );
+		line += buf;
+		for(int n=0;n<POSE_SIZE;++n){
+			sprintf( buf, " %g", result.means[i][n] );
+			line += buf;
+		}
+
+	}
+
+	//one call, lines of different streams do not get mixed up
+	line += "\n";
+	fputs( line.c_str(), stdout );
+
+}
+
+struct ReplaySource {
+
+	string file;
+	DepthRecording recording;
+	int stream;
+	bool loop;
+	pthread_t thread;
+
+};
+
+// pushes the frames of a recording when they are due
+void* replay_thread( void* arg ){
+
+	ReplaySource* src = (ReplaySource*)arg;
+	DepthRecording& rec = src->recording;
+
+	float depth_intrinsic[9];
+	kinect_intrinsics( rec.width(), rec.height(), depth_intrinsic );
+
+	Mat depth;
+	unsigned int frame = 0;
+	double start = now();
+
+	while( !atomic_load( &g_quit ) ){
+
+		if( frame >= rec.frames() ){
+
+			if( !src->loop || rec.frames() == 0 )
+				break;
+			frame = 0;
+			start = now();
+		}
+
+		double wait = start + rec.timestamp( frame ) - rec.timestamp( 0 ) - now();
+		if( wait > 0 )
+			usleep( (useconds_t)( wait*1e6 ) );
+
+		if( rec.read( frame, depth ) ){
+
+			//CV_16UC1 from the recording, the same bits as CV_16SC1 up to 32 m
+			Mat sdepth( depth.rows, depth.cols, CV_16SC1, depth.data, depth.step );
+			g_service->push_depth( src->stream, sdepth, depth_intrinsic, g_max_z, rec.timestamp( frame ) );
+		}
+		frame++;
+
+	}
+
+	atomic_fetch_add( &g_sources, -1 );
+	return NULL;
+}
+
+// waits for fd to become readable, false when quitting
+static bool wait_readable( int fd ){
+
+	pollfd p;
+	p.fd = fd;
+	p.events = POLLIN;
+
+	while( !atomic_load( &g_quit ) ){
+
+		int n = poll( &p, 1, 200 );
+		if( n > 0 )
+			return true;
+		if( n < 0 )
+			return false;
+	}
+	return false;
+}
+
+static bool read_all( int fd, void* data, size_t size ){
+
+	char* p = (char*)data;
+	while( size > 0 ){
+
+		if( !wait_readable( fd ) )
+			return false;
+
+		ssize_t n = read( fd, p, size );
+		if( n <= 0 )
+			return false;
+		p += n;
+		size -= n;
+
+	}
+	return true;
+}
+
+struct Connection {
+
+	int fd;
+	int stream;
+	pthread_t thread;
+	volatile long done; //the thread has finished and can be joined
+
+};
+
+// one stream per connection, until the other side closes it
+void* connection_thread( void* arg ){
+
+	Connection* c = (Connection*)arg;
+
+	DepthStreamHeader header;
+	Mat depth;
+	float depth_intrinsic[9];
+	int width = 0, height = 0;
+
+	while( read_all( c->fd, &header, sizeof(header) ) ){
+
+		if( memcmp( header.magic, DEPTH_STREAM_MAGIC, 4 ) != 0 || header.width <= 0 || header.height <= 0 ||
+			header.width > 4096 || header.height > 4096 ||
+			header.size != sizeof(header) + (size_t)header.width*header.height*sizeof(int16_t) ){
+			cerr << g_service->name( c->stream ) << ": broken stream" << endl;
+			break;
+		}
+
+		if( header.width != width || header.height != height ){
+			width = header.width;
+			height = header.height;
+			kinect_intrinsics( width, height, depth_intrinsic );
+		}
+
+		depth.create( height, width, CV_16SC1 );
+		if( !read_all( c->fd, depth.data, (size_t)width*height*sizeof(int16_t) ) )
+			break;
+
+		g_service->push_depth( c->stream, depth, depth_intrinsic, g_max_z, header.timestamp );
+
+	}
+
+	cerr << "end of stream " << g_service->name( c->stream ) << endl;
+	g_service->remove_stream( c->stream );
+
+	close( c->fd );
+	atomic_fetch_add( &g_sources, -1 );
+	atomic_store( &c->done, 1 );
+	return NULL;
+}
+
+struct Listener {
+
+	string path;
+	int fd;
+	int connections;
+	vector< Connection* > clients;
+	pthread_t thread;
+
+};
+
+void* listen_thread( void* arg ){
+
+	Listener* l = (Listener*)arg;
+
+	while( wait_readable( l->fd ) ){
+
+		int fd = accept( l->fd, NULL, NULL );
+		if( fd < 0 )
+			continue;
+
+		//connections that have ended
+		for(unsigned int i=0;i<l->clients.size();){
+			if( atomic_load( &l->clients[i]->done ) ){
+				pthread_join( l->clients[i]->thread, NULL );
+				delete l->clients[i];
+				l->clients.erase( l->clients.begin() + i );
+			}
+			else
+				++i;
+		}
+
+		char name[32];
+		sprintf( name, "socket%d", ++l->connections );
+
+		Connection* c = new Connection();
+		c->fd = fd;
+		c->done = 0;
+		c->stream = g_service->add_stream( name );
+
+		atomic_fetch_add( &g_sources, 1 );
+		if( pthread_create( &c->thread, NULL, connection_thread, c ) != 0 ){
+			printf("pthread_create failed\n");
+			atomic_fetch_add( &g_sources, -1 );
+			g_service->remove_stream( c->stream );
+			close( fd );
+			delete c;
+			continue;
+		}
+		l->clients.push_back( c );
+		cerr << "new stream " << name << endl;
+
+	}
+
+	for(unsigned int i=0;i<l->clients.size();++i){
+		pthread_join( l->clients[i]->thread, NULL );
+		delete l->clients[i];
+	}
+	return NULL;
+}
+
+static bool start_listener( Listener& l ){
+
+	sockaddr_un sa;
+	memset( &sa, 0, sizeof(sa) );
+	sa.sun_family = AF_UNIX;
+	strncpy( sa.sun_path, l.path.c_str(), sizeof(sa.sun_path)-1 );
+	unlink( l.path.c_str() );
+
+	l.fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( l.fd < 0 || bind( l.fd, (sockaddr*)&sa, sizeof(sa) ) != 0 || listen( l.fd, 16 ) != 0 ){
+		cerr << "could not listen on " << l.path << endl;
+		return false;
+	}
+
+	l.connections = 0;
+	if( pthread_create( &l.thread, NULL, listen_thread, &l ) != 0 ){
+		printf("pthread_create failed\n");
+		return false;
+	}
+	return true;
+}
+
+#ifdef USE_LIBFREENECT
+freenect_context* g_f_ctx = 0;
+pthread_t g_kinect_thread;
+
+struct KinectSource {
+
+	int index;
+	int stream;
+	freenect_device* dev;
+	float depth_intrinsic[9];
+
+};
+
+void kinect_depth_cb( freenect_device* dev, void* v_depth, uint32_t timestamp ){
+
+	KinectSource* src = (KinectSource*)freenect_get_user( dev );
+	Mat depth( 480, 640, CV_16SC1, v_depth );
+	g_service->push_depth( src->stream, depth, src->depth_intrinsic, g_max_z, now() );
+}
+
+// all sensors are served by one context and one thread
+void* kinect_thread( void* arg ){
+
+	vector< KinectSource* >& kinects = *(vector< KinectSource* >*)arg;
+
+	while( !atomic_load( &g_quit ) && freenect_process_events( g_f_ctx ) >= 0 ){
+
+	}
+
+	for(unsigned int i=0;i<kinects.size();++i){
+		freenect_stop_depth( kinects[i]->dev );
+		freenect_close_device( kinects[i]->dev );
+	}
+	freenect_shutdown( g_f_ctx );
+	return NULL;
+}
+
+static bool start_kinects( vector< KinectSource* >& kinects ){
+
+	if( freenect_init( &g_f_ctx, NULL ) < 0 ){
+		printf("freenect_init() failed\n");
+		return false;
+	}
+
+	freenect_set_log_level( g_f_ctx, FREENECT_LOG_ERROR );
+	freenect_select_subdevices( g_f_ctx, (freenect_device_flags)FREENECT_DEVICE_CAMERA );
+	printf("Number of devices found: %d\n", freenect_num_devices( g_f_ctx ));
+
+	for(unsigned int i=0;i<kinects.size();++i){
+
+		KinectSource* src = kinects[i];
+		if( freenect_open_device( g_f_ctx, &src->dev, src->index ) < 0 ){
+			printf("Could not open device %d\n", src->index);
+			freenect_shutdown( g_f_ctx );
+			return false;
+		}
+
+		kinect_intrinsics( 640, 480, src->depth_intrinsic );
+		freenect_set_user( src->dev, src );
+		freenect_set_depth_callback( src->dev, kinect_depth_cb );
+		freenect_set_depth_mode( src->dev, freenect_find_depth_mode( FREENECT_RESOLUTION_MEDIUM, FREENECT_DEPTH_MM ) );
+		freenect_start_depth( src->dev );
+
+	}
+
+	if( pthread_create( &g_kinect_thread, NULL, kinect_thread, &kinects ) != 0 ){
+		printf("pthread_create failed\n");
+		return false;
+	}
+	return true;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+
+	if( argc < 3 ){
+
+		cout << "usage: ./head_pose_service config_file <sources> [-loop] [-t threads] [-q] [-stats seconds]" << endl;
+		cout << "sources, any number of each:" << endl;
+		cout << "  -replay <file>   a recording of the demo (--record), in real time" << endl;
+		cout << "  -listen <path>   a Unix domain socket, each connection pushes one stream of" << endl;
+		cout << "                   frames (\"HPDF\" header, see service_main.cpp, then the depth)" << endl;
+#ifdef USE_LIBFREENECT
+		cout << "  -kinect <index>  a Kinect, by libfreenect device number" << endl;
+#endif
+		cout << "  -loop            start the recordings over at their end" << endl;
+		cout << "  -t threads       workers shared by all streams, one per core by default" << endl;
+		cout << "  -q               no poses, only the statistics" << endl;
+		cout << "  -stats seconds   latency of each stream every so many seconds (default 10)" << endl;
+		exit(-1);
+	}
+
+	string treepath;
+	int ntrees = 0;
+	EstimationParams params;
+	unsigned int threads = 0;
+	int stats_every = 10;
+	bool loop = false;
+
+	if( !loadEstimatorConfig( argv[1], treepath, ntrees, g_max_z, params ) )
+		exit(-1);
+
+	vector< string > replays, listens;
+	vector< int > kinect_indices;
+
+	for(int i=2;i<argc;++i){
+
+		if( strcmp(argv[i], "-replay") == 0 && i+1 < argc )
+			replays.push_back( argv[++i] );
+		else if( strcmp(argv[i], "-listen") == 0 && i+1 < argc )
+			listens.push_back( argv[++i] );
+#ifdef USE_LIBFREENECT
+		else if( strcmp(argv[i], "-kinect") == 0 && i+1 < argc )
+			kinect_indices.push_back( atoi(argv[++i]) );
+#endif
+		else if( strcmp(argv[i], "-loop") == 0 )
+			loop = true;
+		else if( strcmp(argv[i], "-t") == 0 && i+1 < argc )
+			threads = atoi(argv[++i]);
+		else if( strcmp(argv[i], "-q") == 0 )
+			g_quiet = true;
+		else if( strcmp(argv[i], "-stats") == 0 && i+1 < argc )
+			stats_every = atoi(argv[++i]);
+		else {
+			cerr << "unknown option " << argv[i] << endl;
+			exit(-1);
+		}
+
+	}
+
+	stats_every = MAX( 1, stats_every );
+
+	if( replays.empty() && listens.empty() && kinect_indices.empty() ){
+		cerr << "no sources" << endl;
+		exit(-1);
+	}
+
+	CRForestEstimator estimator;
+	if( !estimator.load_forest(treepath.c_str(), ntrees) ){
+
+		cerr << "could not read forest!" << endl;
+		exit(-1);
+	}
+
+	if( threads == 0 )
+		threads = BatchEstimator::default_threads();
+
+	StreamEstimator service( &estimator, params, threads );
+	g_service = &service;
+	service.set_callback( print_result );
+
+	vector< ReplaySource* > replay_sources;
+	for(unsigned int i=0;i<replays.size();++i){
+
+		ReplaySource* src = new ReplaySource();
+		src->file = replays[i];
+		src->loop = loop;
+		if( !src->recording.open( replays[i].c_str() ) )
+			exit(-1);
+
+		char name[32];
+		sprintf( name, "replay%u", i+1 );
+		src->stream = service.add_stream( name );
+		replay_sources.push_back( src );
+		cerr << name << ": " << replays[i] << ", " << src->recording.frames() << " frames" << endl;
+
+	}
+
+#ifdef USE_LIBFREENECT
+	vector< KinectSource* > kinects;
+	for(unsigned int i=0;i<kinect_indices.size();++i){
+
+		char name[32];
+		sprintf( name, "kinect%d", kinect_indices[i] );
+
+		KinectSource* src = new KinectSource();
+		src->index = kinect_indices[i];
+		src->stream = service.add_stream( name );
+		kinects.push_back( src );
+
+	}
+#endif
+
+	if( !service.start() ){
+		cerr << "could not start the workers!" << endl;
+		exit(-1);
+	}
+	fprintf( stderr, "estimating on %u threads\n", threads );
+
+	signal( SIGINT, on_signal );
+	signal( SIGTERM, on_signal );
+	signal( SIGPIPE, SIG_IGN );
+
+	for(unsigned int i=0;i<replay_sources.size();++i){
+
+		atomic_fetch_add( &g_sources, 1 );
+		if( pthread_create( &replay_sources[i]->thread, NULL, replay_thread, replay_sources[i] ) != 0 ){
+			printf("pthread_create failed\n");
+			exit(-1);
+		}
+	}
+
+	vector< Listener > listeners( listens.size() );
+	for(unsigned int i=0;i<listens.size();++i){
+
+		listeners[i].path = listens[i];
+		if( !start_listener( listeners[i] ) )
+			exit(-1);
+		cerr << "listening on " << listens[i] << endl;
+	}
+
+#ifdef USE_LIBFREENECT
+	if( !kinects.empty() && !start_kinects( kinects ) )
+		exit(-1);
+#endif
+
+	//runs until a signal, or the replays are over if nothing else can deliver frames
+	bool endless = !listeners.empty() || !kinect_indices.empty();
+
+	for(int s=1; !atomic_load( &g_quit ); ++s){
+
+		sleep(1);
+
+		if( s%stats_every == 0 ){
+			cerr << "last " << stats_every << " s:" << endl;
+			service.print_stats( cerr, true );
+		}
+
+		if( !endless && atomic_load( &g_sources ) == 0 )
+			break;
+
+	}
+
+	atomic_store( &g_quit, 1 );
+
+	for(unsigned int i=0;i<replay_sources.size();++i){
+		pthread_join( replay_sources[i]->thread, NULL );
+		delete replay_sources[i];
+	}
+
+	for(unsigned int i=0;i<listeners.size();++i){
+		pthread_join( listeners[i].thread, NULL );
+		close( listeners[i].fd );
+		unlink( listeners[i].path.c_str() );
+	}
+
+#ifdef USE_LIBFREENECT
+	if( !kinects.empty() )
+		pthread_join( g_kinect_thread, NULL );
+	for(unsigned int i=0;i<kinects.size();++i)
+		delete kinects[i];
+#endif
+
+	service.stop();
+	cerr << "since the last statistics:" << endl;
+	service.print_stats( cerr );
+
+	return 0;
+
+}
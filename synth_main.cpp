@@ -0,0 +1,450 @@
+/*
+// Synthetic depth scenes for load testing: the head and upper body of the people in
+// recorded frames (cut around their ground truth head centre) are placed at random
+// positions, depths and yaw angles, then sensor noise and holes are added. People are
+// turned with the ray through their head, so the camera sees the side that was recorded.
+// Frames are written as *_depth.bin with *_pose.bin ground truth, reproducible from the seed.
+*/
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "CRTree.h"
+#include "DepthIO.h"
+
+using namespace std;
+using namespace cv;
+
+// a person cut from a recorded frame
+struct SourcePerson {
+
+	std::vector< Vec3f > points;
+	Vec<float,POSE_SIZE> pose; //ground truth of the frame
+	std::string cal_file;
+
+};
+
+// where a person goes in the scene
+struct Placement {
+
+	unsigned int source;
+	Vec3f head; //new head centre
+	float yaw; //degrees, around the vertical axis through the head centre
+	Rect head_box; //image areas
+	Rect body_box;
+
+};
+
+struct SynthParams {
+
+	SynthParams() :
+		frames(100), min_people(1), max_people(1),
+		min_z(800), max_z(1200), max_yaw(0),
+		cut_below(250), cut_width(300),
+		noise(1.f), holes(0.01f), blobs(3), seed(1) { }
+
+	int frames;
+	int min_people, max_people; //frame f has min_people + f%(max_people-min_people+1) people
+	float min_z, max_z; //mm, head centre depth
+	float max_yaw; //degrees, the yaw of the ground truth changes by the same angle
+	float cut_below; //mm below the head centre kept of the source person
+	float cut_width; //mm left and right of the head centre
+	float noise; //std. deviation of the depth noise at 1 m, in mm (grows with z^2)
+	float holes; //fraction of the pixels dropped
+	int blobs; //no. of larger holes per frame
+	int seed;
+
+};
+
+static const float HEAD_HALF_WIDTH = 0.5f*AVG_FACE_DIAMETER;
+static const float HEAD_HALF_HEIGHT = 130.f;
+
+static bool loadSource( const std::string& depth_file, const SynthParams& params, SourcePerson& person ){
+
+	float K[9];
+	Mat depth;
+
+	person.cal_file = depthCalibrationFile( depth_file );
+	if( !loadDepthCalibration( person.cal_file, K ) ||
+		!loadGroundTruth( groundTruthFile( depth_file ), &person.pose[0] ) ||
+		!loadDepthImageCompressed( depth, depth_file.c_str() ) ){
+
+		cerr << "need the depth, ground truth and depth.cal of " << depth_file << endl;
+		return false;
+	}
+
+	//back-projected as in depthTo3D, only the box around the head
+	for(int y=0;y<depth.rows;++y){
+
+		const int16_t* Di = depth.ptr<int16_t>(y);
+		for(int x=0;x<depth.cols;++x){
+
+			float d = (float)Di[x];
+			if( d <= 0 )
+				continue;
+
+			Vec3f p( d * (float(x) - K[2])/K[0], d * (float(y) - K[5])/K[4], d );
+			if( p[1] - person.pose[1] < params.cut_below && fabs( p[0] - person.pose[0] ) < params.cut_width )
+				person.points.push_back( p );
+
+		}
+	}
+
+	return !person.points.empty();
+
+}
+
+static Rect projectBox( const Vec3f& centre, float left, float right, float top, float bottom, const float* K ){
+
+	float s = K[0]/centre[2];
+	int x0 = cvRound( K[0]*centre[0]/centre[2] + K[2] - left*s );
+	int y0 = cvRound( K[4]*centre[1]/centre[2] + K[5] - top*s );
+	return Rect( x0, y0, cvRound( (left+right)*s ), cvRound( (top+bottom)*s ) );
+
+}
+
+static bool overlap( const Rect& a, const Rect& b ){
+
+	return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+
+}
+
+// random position for one more person, so that no head is hidden by a nearer person
+static bool place( const std::vector< SourcePerson >& sources,
+				   const std::vector< Placement >& placed,
+				   const SynthParams& params,
+				   const float* K, int width, int height,
+				   RNG& rng, Placement& p ){
+
+	for(int attempt=0; attempt<1000; ++attempt){
+
+		p.source = rng.uniform( 0, (int)sources.size() );
+		p.yaw = params.max_yaw > 0 ? rng.uniform( -params.max_yaw, params.max_yaw ) : 0.f;
+
+		float z = rng.uniform( params.min_z, params.max_z );
+		float margin = HEAD_HALF_HEIGHT*K[0]/z;
+		if( width <= 2*margin || height <= 2*margin )
+			return false;
+
+		float u = rng.uniform( margin, width-margin );
+		float v = rng.uniform( margin, height-margin );
+		p.head = Vec3f( z*(u - K[2])/K[0], z*(v - K[5])/K[4], z );
+
+		p.head_box = projectBox( p.head, HEAD_HALF_WIDTH, HEAD_HALF_WIDTH, HEAD_HALF_HEIGHT, HEAD_HALF_HEIGHT, K );
+		p.body_box = projectBox( p.head, params.cut_width, params.cut_width, HEAD_HALF_HEIGHT, params.cut_below, K );
+
+		bool free = true;
+		for(unsigned int i=0; i<placed.size() && free; ++i){
+
+			const Placement& o = placed[i];
+			bool nearer = p.head[2] < o.head[2];
+
+			if( overlap( p.head_box, o.head_box ) ||
+				( !nearer && overlap( p.head_box, o.body_box ) ) ||
+				( nearer && overlap( p.body_box, o.head_box ) ) )
+				free = false;
+
+		}
+
+		if( free )
+			return true;
+
+	}
+
+	return false;
+
+}
+
+// horizontal and vertical angle of the ray through a point, radians
+static float rayYaw( const Vec3f& p ){ return atan2( p[0], p[2] ); }
+static float rayPitch( const Vec3f& p ){ return atan2( p[1], sqrt( p[0]*p[0] + p[2]*p[2] ) ); }
+
+static Vec3f rotateY( const Vec3f& v, float a ){ return Vec3f( cos(a)*v[0] + sin(a)*v[2], v[1], -sin(a)*v[0] + cos(a)*v[2] ); }
+static Vec3f rotateX( const Vec3f& v, float a ){ return Vec3f( v[0], cos(a)*v[1] - sin(a)*v[2], sin(a)*v[1] + cos(a)*v[2] ); }
+
+// the person is turned with the ray through its head, so that the camera sees the same side
+// of it as in the source frame (moving it only would show surfaces the sensor never saw)
+static Vec3f moved( const Vec3f& point, const Vec3f& source_head, const Placement& p ){
+
+	Vec3f v = rotateY( point - source_head, p.yaw*(float)CV_PI/180.f );
+	v = rotateY( v, -rayYaw( source_head ) );
+	v = rotateX( v, rayPitch( source_head ) - rayPitch( p.head ) );
+	v = rotateY( v, rayYaw( p.head ) );
+	return v + p.head;
+
+}
+
+// ground truth of a placed person: the turn with the ray and the extra yaw are added to the
+// angles, which count in the opposite direction of rotateX and rotateY
+static Vec<float,POSE_SIZE> movedPose( const Vec<float,POSE_SIZE>& source, const Placement& p ){
+
+	Vec3f source_head( source[0], source[1], source[2] );
+	Vec<float,POSE_SIZE> pose = source;
+	for(int n=0;n<3;++n)
+		pose[n] = p.head[n];
+	pose[3] -= ( rayPitch( p.head ) - rayPitch( source_head ) )*180.f/(float)CV_PI;
+	pose[4] -= ( rayYaw( p.head ) - rayYaw( source_head ) )*180.f/(float)CV_PI + p.yaw;
+	return pose;
+
+}
+
+// draws a moved and rotated person into the depth buffer, nearer points win
+static void render( const SourcePerson& person, const Placement& p, const float* K, Mat& depth ){
+
+	Vec3f source_head( person.pose[0], person.pose[1], person.pose[2] );
+
+	for(unsigned int i=0;i<person.points.size();++i){
+
+		const Vec3f& src = person.points[i];
+		Vec3f q = moved( src, source_head, p );
+		if( q[2] <= 0 )
+			continue;
+
+		//a source pixel covers about src z / new z pixels in each direction
+		int size = MAX( 1, (int)ceil( src[2]/q[2] ) );
+		int x0 = cvRound( K[0]*q[0]/q[2] + K[2] - 0.5f*size );
+		int y0 = cvRound( K[4]*q[1]/q[2] + K[5] - 0.5f*size );
+		int16_t z = (int16_t)MIN( 32767, cvRound( q[2] ) );
+
+		for(int y=MAX(0,y0); y<MIN(depth.rows,y0+size); ++y){
+
+			int16_t* Di = depth.ptr<int16_t>(y);
+			for(int x=MAX(0,x0); x<MIN(depth.cols,x0+size); ++x)
+				if( Di[x] == 0 || z < Di[x] )
+					Di[x] = z;
+
+		}
+
+	}
+
+}
+
+// depth noise growing with z^2 as with structured light sensors, dropped pixels and blobs
+static void degrade( Mat& depth, const SynthParams& params, RNG& rng ){
+
+	for(int y=0;y<depth.rows;++y){
+
+		int16_t* Di = depth.ptr<int16_t>(y);
+		for(int x=0;x<depth.cols;++x){
+
+			if( Di[x] == 0 )
+				continue;
+
+			if( params.holes > 0 && rng.uniform( 0.f, 1.f ) < params.holes ){
+				Di[x] = 0;
+				continue;
+			}
+
+			float z = Di[x];
+			if( params.noise > 0 )
+				z += (float)rng.gaussian( params.noise*(z/1000.f)*(z/1000.f) );
+			Di[x] = (int16_t)MAX( 1, MIN( 32767, cvRound( z ) ) );
+
+		}
+	}
+
+	for(int b=0;b<params.blobs;++b){
+
+		int cx = rng.uniform( 0, depth.cols );
+		int cy = rng.uniform( 0, depth.rows );
+		int r = rng.uniform( 3, 16 );
+
+		for(int y=MAX(0,cy-r); y<MIN(depth.rows,cy+r+1); ++y)
+			for(int x=MAX(0,cx-r); x<MIN(depth.cols,cx+r+1); ++x)
+				if( (x-cx)*(x-cx) + (y-cy)*(y-cy) <= r*r )
+					depth.at<int16_t>(y,x) = 0;
+
+	}
+
+}
+
+static bool by_depth( const Placement& a, const Placement& b ){ return a.head[2] < b.head[2]; }
+
+static bool copyFile( const std::string& from, const std::string& to ){
+
+	FILE* in = fopen( from.c_str(), "rb" );
+	if( !in )
+		return false;
+	FILE* out = fopen( to.c_str(), "wb" );
+	if( !out ){
+		fclose( in );
+		return false;
+	}
+
+	char buffer[4096];
+	size_t n;
+	bool success = true;
+	while( (n = fread( buffer, 1, sizeof(buffer), in )) > 0 )
+		success &= ( fwrite( buffer, 1, n, out ) == n );
+
+	fclose( in );
+	success &= ( fclose( out ) == 0 );
+	return success;
+
+}
+
+int main(int argc, char* argv[])
+{
+
+	if( argc < 3 ){
+
+		cout << "usage: ./head_pose_synth output_dir <depth dir | file list | depth file>... [options]" << endl;
+		cout << "  -n <frames>           no. of frames (100)" << endl;
+		cout << "  -p <min> <max>        people per frame, frame f gets min + f%(max-min+1) (1 1)" << endl;
+		cout << "  -z <min> <max>        depth of the head centres in mm (800 1200)" << endl;
+		cout << "  -yaw <deg>            random yaw rotation up to +-deg, also applied to the ground truth (0)" << endl;
+		cout << "  -cut <below> <width>  mm kept below and left/right of the source head centre (250 300)" << endl;
+		cout << "  -noise <mm>           depth noise std. deviation at 1 m (1)" << endl;
+		cout << "  -holes <fraction>     pixels dropped (0.01)" << endl;
+		cout << "  -blobs <n>            larger holes per frame (3)" << endl;
+		cout << "  -seed <n>             random seed (1)" << endl;
+		exit(-1);
+	}
+
+	SynthParams params;
+	string out_dir = argv[1];
+	vector< string > files;
+
+	for(int i=2;i<argc;++i){
+
+		if( strcmp(argv[i], "-n") == 0 && i+1 < argc )
+			params.frames = atoi(argv[++i]);
+		else if( strcmp(argv[i], "-p") == 0 && i+2 < argc ){
+			params.min_people = atoi(argv[++i]);
+			params.max_people = atoi(argv[++i]);
+		}
+		else if( strcmp(argv[i], "-z") == 0 && i+2 < argc ){
+			params.min_z = atof(argv[++i]);
+			params.max_z = atof(argv[++i]);
+		}
+		else if( strcmp(argv[i], "-yaw") == 0 && i+1 < argc )
+			params.max_yaw = atof(argv[++i]);
+		else if( strcmp(argv[i], "-cut") == 0 && i+2 < argc ){
+			params.cut_below = atof(argv[++i]);
+			params.cut_width = atof(argv[++i]);
+		}
+		else if( strcmp(argv[i], "-noise") == 0 && i+1 < argc )
+			params.noise = atof(argv[++i]);
+		else if( strcmp(argv[i], "-holes") == 0 && i+1 < argc )
+			params.holes = atof(argv[++i]);
+		else if( strcmp(argv[i], "-blobs") == 0 && i+1 < argc )
+			params.blobs = atoi(argv[++i]);
+		else if( strcmp(argv[i], "-seed") == 0 && i+1 < argc )
+			params.seed = atoi(argv[++i]);
+		else if( !collectDepthFiles( argv[i], files ) )
+			exit(-1);
+
+	}
+
+	if( params.min_people < 1 || params.max_people < params.min_people || params.min_z <= 0 || params.max_z < params.min_z ){
+		cerr << "invalid no. of people or depth range" << endl;
+		exit(-1);
+	}
+
+	//people to place, all sources have to share the intrinsics of the first one
+	vector< SourcePerson > sources;
+	for(unsigned int f=0;f<files.size();++f){
+
+		SourcePerson person;
+		if( loadSource( files[f], params, person ) )
+			sources.push_back( person );
+
+	}
+
+	if( sources.empty() ){
+		cerr << "no source frames with ground truth found" << endl;
+		exit(-1);
+	}
+
+	float K[9];
+	Mat size_of;
+	loadDepthCalibration( sources[0].cal_file, K );
+	loadDepthImageCompressed( size_of, files[0].c_str() );
+	int width = size_of.cols, height = size_of.rows;
+
+	mkdir( out_dir.c_str(), 0755 );
+	if( !copyFile( sources[0].cal_file, out_dir + "/depth.cal" ) ){
+		cerr << "could not write to " << out_dir << endl;
+		exit(-1);
+	}
+
+	FILE* list = fopen( (out_dir + "/scenes.txt").c_str(), "w" );
+	if( !list ){
+		cerr << "could not write to " << out_dir << endl;
+		exit(-1);
+	}
+	fprintf( list, "#file people foreground_pixels\n" );
+
+	int crowded = 0;
+	Mat depth( height, width, CV_16SC1 );
+
+	for(int f=0;f<params.frames;++f){
+
+		//each frame from its own seed, so any frame can be made again alone
+		RNG rng( (uint64)params.seed*1000003 + f );
+
+		int people = params.min_people + f%(params.max_people-params.min_people+1);
+
+		vector< Placement > placed;
+		for(int k=0;k<people;++k){
+
+			Placement p;
+			if( !place( sources, placed, params, K, width, height, rng, p ) )
+				break;
+			placed.push_back( p );
+
+		}
+		if( (int)placed.size() < people )
+			crowded++;
+
+		//nearest head first in the ground truth
+		sort( placed.begin(), placed.end(), by_depth );
+
+		depth.setTo( 0 );
+		for(unsigned int k=0;k<placed.size();++k)
+			render( sources[ placed[k].source ], placed[k], K, depth );
+
+		degrade( depth, params, rng );
+
+		char name[64];
+		sprintf( name, "/frame_%05d_depth.bin", f );
+		string depth_file = out_dir + name;
+		sprintf( name, "/frame_%05d_pose.bin", f );
+		string pose_file = out_dir + name;
+
+		if( !saveDepthImageCompressed( depth, depth_file.c_str() ) )
+			exit(-1);
+
+		//POSE_SIZE floats per head, the first one is what loadGroundTruth reads
+		FILE* pose_out = fopen( pose_file.c_str(), "wb" );
+		if( !pose_out ){
+			cerr << "could not write " << pose_file << endl;
+			exit(-1);
+		}
+		for(unsigned int k=0;k<placed.size();++k){
+
+			Vec<float,POSE_SIZE> pose = movedPose( sources[ placed[k].source ].pose, placed[k] );
+			fwrite( &pose[0], sizeof(float), POSE_SIZE, pose_out );
+
+		}
+		fclose( pose_out );
+
+		fprintf( list, "%s %u %d\n", depth_file.c_str(), (unsigned int)placed.size(), countNonZero( depth ) );
+
+	}
+
+	fclose( list );
+
+	printf( "%d frames written to %s\n", params.frames, out_dir.c_str() );
+	if( crowded )
+		printf( "%d frames got fewer people than asked for, there was no room without hiding a head\n", crowded );
+
+	return 0;
+
+}